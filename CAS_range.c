@@ -1,6 +1,6 @@
 /*
  *  CAS_range.c: Sample code to demonstrate the Less-Than Compare-And-Swap
- *  primitive (LT-CAS) presented in the paper.
+ *  primitive (LT-CAS) presented in the paper, as provided by lt_cas.h.
  *
  *  This program is free software: you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -21,39 +21,64 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include "lt_cas.h"
+
+static int errors;
+
+static void check(int ok, const char *what)
+{
+	printf("%s %s\n", ok ? "       " : "ERROR: ", what);
+	if (!ok)
+		errors ++;
+}
 
 int main(void)
 {
 	uint16_t target = 0x01FF;
-	uint8_t value;
-
-	value = *((char *)&target + 1);
-	*(char *)&target = 0xFE;
-	printf("%X, (should be 0x01FE)\n", target);
+	uint32_t word;
+	uint64_t info;
 
-	if (__sync_bool_compare_and_swap(((char *)&target)+1, value, 2)) {
-		printf("First CAS succeed!\n");
-	} else {
-		printf("ERROR: First CAS failed!\n");
-	}
-	printf("%X, (should be 0x02FE)\n", target);
+	/* 16 bits, bound 2^8: one byte CAS on the high byte. */
+	target = (target & 0xFF00) | 0xFE;
+	check(lt_cas16(&target, 8, 0x0100, 0x0200),
+			"16-bit: first CAS succeeds, low byte ignored");
+	check(target == 0x02FE, "16-bit: 0x02FE");
 
 	target += 3;
-	printf("%X, (should be 0x0301)\n", target);
+	check(!lt_cas16(&target, 8, 0x0200, 0x0200),
+			"16-bit: second CAS fails, low byte carried into high byte");
+	check(lt_cas16(&target, 8, 0x0300, 0x0400),
+			"16-bit: third CAS succeeds");
+	check(target == 0x0401, "16-bit: 0x0401");
 
-	if ( ! __sync_bool_compare_and_swap(((char *)&target)+1, 0x02, 2)) {
-		printf("Second CAS succeed!\n");
-	} else {
-		printf("ERROR: Second CAS failed!\n");
-	}
+	/* 32 bits, bound 2^16: one half-word CAS. */
+	word = 0x0005ABCD;
+	check(lt_cas32(&word, 16, 0x00050000, 0x00070000),
+			"32-bit: half-word CAS succeeds");
+	check(word == 0x0007ABCD, "32-bit: 0x0007ABCD");
 
-	if ( __sync_bool_compare_and_swap(((char *)&target)+1, 0x03, 0x0404)) {
-		printf("Third CAS succeed!\n");
-	} else {
-		printf("ERROR: Third CAS failed!\n");
-	}
+	/* 32 bits, bound 2^10: not byte aligned, CAS loop. */
+	word = 0x00000123;
+	check(lt_cas32(&word, 10, 0, 0x80000000),
+			"32-bit: low field 0x123 < 2^10, CAS succeeds");
+	check(word == 0x80000123, "32-bit: 0x80000123");
+	word = 0x00000523;
+	check(!lt_cas32(&word, 10, 0, 0x80000000),
+			"32-bit: low field 0x523 >= 2^10, CAS fails");
 
-	printf("%X, (should be 0x0401)\n", target);
+	/* 64 bits: struct info_t of fifo.c, halve queue_size 2048 while
+	 * head < 1024. */
+	info = (2048UL << 32) | 1000;
+	check(lt_cas64(&info, lt_cas_shift(1024), 2048UL << 32, 1024UL << 32),
+			"64-bit: head 1000 < 1024, shrink succeeds");
+	check(info == ((1024UL << 32) | 1000), "64-bit: queue_size 1024, head kept");
+	info = (2048UL << 32) | 1500;
+	check(!lt_cas64(&info, lt_cas_shift(1024), 2048UL << 32, 1024UL << 32),
+			"64-bit: head 1500 >= 1024, shrink fails");
+	check(lt_cas64(&info, 32, 2048UL << 32, 4096UL << 32),
+			"64-bit: word CAS on queue_size alone succeeds");
+	check(info == ((4096UL << 32) | 1500), "64-bit: queue_size 4096, head kept");
 
-	return 1;
+	printf("%s\n", errors ? "LT-CAS test FAILED" : "LT-CAS test passed");
+	return errors ? 1 : 0;
 }
@@ -0,0 +1,92 @@
+/*
+ *  atomics.h: Shared-memory accesses of fifo.c, bcast.c and migrate.c,
+ *  with two backends.
+ *
+ *  By default they are the volatile accesses of api.h (READ_ONCE and
+ *  WRITE_ONCE) and __sync_bool_compare_and_swap(), i.e. the queue as it
+ *  always was: correct on x86 thanks to TSO, but with every access
+ *  volatile, and invisible to ThreadSanitizer.
+ *
+ *  Build with -DC11_ATOMICS to get <stdatomic.h> accesses with the
+ *  ordering each site needs:
+ *
+ *      LOAD_ACQUIRE / STORE_RELEASE    publish and consume a slot (or a
+ *                                      spill index); a consumer's
+ *                                      clearing store is a release too,
+ *                                      so that the producer reuses the
+ *                                      slot only after it was read
+ *      LOAD_RELAXED / STORE_RELAXED    indexes, sizes and counters read
+ *                                      by the other side as hints
+ *      INC_RELAXED                     counter with a single writer
+ *      CAS                             acquire-release on success
+ *      FENCE_RELEASE / FENCE_ACQUIRE   order a flag against the relaxed
+ *                                      data accesses after (writer) or
+ *                                      before (reader) it, as in a
+ *                                      seqlock; ThreadSanitizer does
+ *                                      not model them
+ *
+ *  On x86 acquire loads and release stores are plain moves and the two
+ *  fences only stop the compiler, so the code
+ *  the two backends produce differs only in what the compiler may move
+ *  around the non-volatile accesses.  Both are plain C; C++ front ends
+ *  (fifo_coro.hpp) only call the functions of fifo.h.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _EQUEUE_ATOMICS_H_
+#define _EQUEUE_ATOMICS_H_
+
+#if defined(C11_ATOMICS)
+
+#include <stdatomic.h>
+
+/* The fields stay plain types in fifo.h; only their accesses are
+ * atomic. */
+#define ATOMIC_OF(x) ((_Atomic __typeof__(x) *)&(x))
+
+#define LOAD_ACQUIRE(x) atomic_load_explicit(ATOMIC_OF(x), memory_order_acquire)
+#define LOAD_RELAXED(x) atomic_load_explicit(ATOMIC_OF(x), memory_order_relaxed)
+#define STORE_RELEASE(x, v) \
+	atomic_store_explicit(ATOMIC_OF(x), (v), memory_order_release)
+#define STORE_RELAXED(x, v) \
+	atomic_store_explicit(ATOMIC_OF(x), (v), memory_order_relaxed)
+#define INC_RELAXED(x) STORE_RELAXED(x, LOAD_RELAXED(x) + 1)
+#define CAS(ptr, old, new) ({						\
+	__typeof__(*(ptr)) __cas_old = (old);				\
+	atomic_compare_exchange_strong_explicit(			\
+			(_Atomic __typeof__(*(ptr)) *)(ptr), &__cas_old, (new),	\
+			memory_order_acq_rel, memory_order_acquire);	\
+})
+#define FENCE_ACQUIRE() atomic_thread_fence(memory_order_acquire)
+#define FENCE_RELEASE() atomic_thread_fence(memory_order_release)
+
+#else
+
+#define LOAD_ACQUIRE(x) READ_ONCE(x)
+#define LOAD_RELAXED(x) READ_ONCE(x)
+#define STORE_RELEASE(x, v) WRITE_ONCE(x, v)
+#define STORE_RELAXED(x, v) WRITE_ONCE(x, v)
+#define INC_RELAXED(x) ((x) ++)
+#define CAS(ptr, old, new) __sync_bool_compare_and_swap(ptr, old, new)
+/* TSO keeps loads in order and stores in order. */
+#define FENCE_ACQUIRE() barrier()
+#define FENCE_RELEASE() barrier()
+
+#endif
+
+#endif
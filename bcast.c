@@ -0,0 +1,191 @@
+/*
+ *  bcast.c: Broadcast ring.  One producer, up to MAX_SUBSCRIBERS
+ *  consumers, every consumer sees every element.
+ *
+ *  A slot may be reused once every attached consumer has passed it.
+ *  The producer learns this from the slowest consumer tail, but reads
+ *  the tails only when it reaches the limit computed last time, so in
+ *  steady state it writes a ring's worth of elements per scan.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "bcast.h"
+#include "atomics.h"
+
+/* size is rounded up to a power of two. */
+void bcast_init(struct bcast_t *b, uint32_t nr_subs, uint64_t size,
+		uint64_t slow_limit)
+{
+	uint64_t s = 1;
+
+	if (nr_subs < 1 || nr_subs > MAX_SUBSCRIBERS) {
+		printf("Error: number of subscribers must be in [1, %d].\n",
+				MAX_SUBSCRIBERS);
+		exit(-1);
+	}
+	while (s < size)
+		s <<= 1;
+
+	memset(b, 0, sizeof(struct bcast_t));
+	b->data = aligned_alloc(128, s * sizeof(struct bcast_slot));
+	if (b->data == NULL) {
+		printf("Error in allocating broadcast ring.\n");
+		exit(-1);
+	}
+	memset(b->data, 0, s * sizeof(struct bcast_slot));
+	b->nr_subs = nr_subs;
+	b->size = s;
+	b->mask = s - 1;
+	b->slow_limit = slow_limit;
+	b->attached = (1U << nr_subs) - 1;
+	b->limit = s;
+}
+
+void bcast_destroy(struct bcast_t *b)
+{
+	free(b->data);
+	b->data = NULL;
+}
+
+/* Slowest attached tail plus the ring size.  Returns the index of the
+ * slowest subscriber in *slowest. */
+static uint64_t bcast_limit(struct bcast_t *b, uint32_t *slowest)
+{
+	uint64_t min = b->head, t;
+	uint32_t i;
+
+	b->min_scans ++;
+	*slowest = MAX_SUBSCRIBERS;
+	for (i = 0; i < b->nr_subs; i++) {
+		if (!(b->attached & (1U << i)))
+			continue;
+		t = LOAD_ACQUIRE(b->subs[i].tail);
+		if (t <= min) {
+			min = t;
+			*slowest = i;
+		}
+	}
+	return min + b->size;
+}
+
+/* Attach the evicted consumers that asked for it, at the current head. */
+static void bcast_attach(struct bcast_t *b)
+{
+	struct bcast_sub *s;
+	uint32_t i;
+
+	for (i = 0; i < b->nr_subs; i++) {
+		s = &b->subs[i];
+		if (!LOAD_RELAXED(s->evicted) || !LOAD_ACQUIRE(s->rejoin))
+			continue;
+		/* The release hands the new tail over to the consumer.
+		 * evicted before rejoin: the consumer must not see an
+		 * eviction without its rejoin request. */
+		STORE_RELAXED(s->tail, b->head);
+		STORE_RELEASE(s->evicted, 0);
+		STORE_RELEASE(s->rejoin, 0);
+		b->attached |= 1U << i;
+		b->nr_evicted --;
+	}
+}
+
+static void bcast_evict(struct bcast_t *b, uint32_t i)
+{
+	struct bcast_sub *s = &b->subs[i];
+
+	/* The flag goes out before any slot s still needs is overwritten;
+	 * the consumer checks it after reading a slot (seqlock-style, the
+	 * fences pair with the one in bcast_dequeue()). */
+	STORE_RELAXED(s->evicted, 1);
+	FENCE_RELEASE();
+	s->evictions ++;
+	b->attached &= ~(1U << i);
+	b->nr_evicted ++;
+	printf("(Broadcast) Evicted subscriber %u, %lu elements behind\n",
+			i, b->head - LOAD_RELAXED(s->tail));
+}
+
+int bcast_enqueue(struct bcast_t *b, ELEMENT_TYPE value)
+{
+	struct bcast_slot *slot;
+	uint64_t h = b->head;
+	uint32_t slowest;
+
+	if ( unlikely(b->nr_evicted) )
+		bcast_attach(b);
+
+	if ( unlikely(h >= b->limit) ) {
+		b->limit = bcast_limit(b, &slowest);
+		if (h >= b->limit) {
+			uint64_t now = rdtsc_bare();
+
+			if (b->full_start == 0) {
+				b->full_start = now;
+				b->full_counter ++;
+				b->subs[slowest].stalls ++;
+			} else if (b->slow_limit && now - b->full_start > b->slow_limit) {
+				bcast_evict(b, slowest);
+				b->full_start = 0;
+				b->limit = bcast_limit(b, &slowest);
+			}
+			if (h >= b->limit)
+				return BUFFER_FULL;
+		}
+		b->full_start = 0;
+	}
+
+	slot = &b->data[h & b->mask];
+	STORE_RELAXED(slot->value, value);
+	/* Publishes the value to the subscribers. */
+	STORE_RELEASE(slot->seq, h + 1);
+	b->head = h + 1;
+	return SUCCESS;
+}
+
+/* Consumer i only. */
+int bcast_dequeue(struct bcast_t *b, uint32_t i, ELEMENT_TYPE *value)
+{
+	struct bcast_sub *s = &b->subs[i];
+	struct bcast_slot *slot;
+	uint64_t t;
+
+	if ( unlikely(LOAD_ACQUIRE(s->evicted)) )
+		return LOAD_ACQUIRE(s->rejoin) ? BUFFER_EMPTY : BCAST_LAGGED;
+
+	t = LOAD_RELAXED(s->tail);
+	slot = &b->data[t & b->mask];
+	if (LOAD_ACQUIRE(slot->seq) != t + 1)
+		return BUFFER_EMPTY;
+	*value = LOAD_RELAXED(slot->value);
+	/* If we were evicted meanwhile the slot may have been reused.  The
+	 * fence keeps the check after the value load. */
+	FENCE_ACQUIRE();
+	if ( unlikely(LOAD_RELAXED(s->evicted)) )
+		return BCAST_LAGGED;
+	/* The producer reuses the slot only after this. */
+	STORE_RELEASE(s->tail, t + 1);
+	s->received ++;
+	return SUCCESS;
+}
+
+/* Called by an evicted consumer i: it will be attached again at the
+ * producer's position on the producer's next enqueue. */
+void bcast_rejoin(struct bcast_t *b, uint32_t i)
+{
+	STORE_RELEASE(b->subs[i].rejoin, 1);
+}
@@ -0,0 +1,94 @@
+/*
+ *  bcast.h: Broadcast ring.  One producer, up to MAX_SUBSCRIBERS
+ *  consumers, every consumer sees every element.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_BCAST_H_
+#define _FIFO_BCAST_H_
+
+#include "fifo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_SUBSCRIBERS 16
+
+/* Returned by bcast_dequeue() to a consumer that was evicted for being
+ * too slow; it has missed elements and must call bcast_rejoin(). */
+#define BCAST_LAGGED -3
+
+/* As in EQueue, consumers find elements by looking at the slot rather
+ * than at a shared head index.  Consumers cannot clear a slot the
+ * others still need, so instead of the 0 sentinel each slot carries
+ * the position it was written for, plus one. */
+struct bcast_slot {
+	uint64_t seq;
+	ELEMENT_TYPE value;
+};
+
+struct bcast_sub {
+	/* Written by the consumer (and by the producer while the consumer
+	 * is evicted). */
+	uint64_t tail __attribute__ ((aligned(128)));
+	uint64_t received;
+	uint32_t rejoin;		/* consumer asks to be attached again */
+
+	/* Written by the producer. */
+	uint32_t evicted __attribute__ ((aligned(128)));
+	uint64_t stalls;		/* full episodes this consumer caused */
+	uint64_t evictions;
+};
+
+struct bcast_t {
+	/* Accessed by producer only. */
+	uint64_t head __attribute__ ((aligned(128)));
+	/* The producer may write below limit without looking at the
+	 * tails: it is the slowest attached tail plus the ring size, and
+	 * is recomputed only when head reaches it. */
+	uint64_t limit;
+	uint32_t attached;		/* bit i: subscriber i holds slots */
+	uint32_t nr_evicted;
+	uint64_t full_start;		/* TSC when the ring became full */
+	uint64_t full_counter;
+	uint64_t min_scans;		/* limit recomputations */
+
+	/* readonly data */
+	uint32_t nr_subs __attribute__ ((aligned(128)));
+	uint32_t mask;
+	uint64_t size;
+	/* Evict the slowest consumer once the ring has been full for this
+	 * many cycles; 0: never, the producer waits. */
+	uint64_t slow_limit;
+	struct bcast_slot *data;
+
+	struct bcast_sub subs[MAX_SUBSCRIBERS];
+};
+
+void bcast_init(struct bcast_t *, uint32_t, uint64_t, uint64_t);
+void bcast_destroy(struct bcast_t *);
+int bcast_enqueue(struct bcast_t *, ELEMENT_TYPE);
+int bcast_dequeue(struct bcast_t *, uint32_t, ELEMENT_TYPE *);
+void bcast_rejoin(struct bcast_t *, uint32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+/*
+ *  bcast_bench.c: Producer cost of feeding 1..N subscribers through one
+ *  broadcast ring (bcast.c) against N separate EQueues written one by
+ *  one.
+ *
+ *  With -x the last subscriber spends that many cycles per element; with
+ *  -L the ring evicts it once it has kept the ring full for that many
+ *  cycles, and it rejoins at the producer's position.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "bcast.h"
+#include "tsc.h"
+#include "wait.h"
+
+#define DEFAULT_TEST_SIZE 2000000
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t workload = 0;
+static uint64_t slow_workload = 0;
+static uint64_t slow_limit = 0;
+/* The separate queues may grow up to MAX_QUEUE_SIZE, so by default the
+ * ring gets that many slots. */
+static uint64_t ring_size = MAX_QUEUE_SIZE;
+static uint64_t cores[MAX_SUBSCRIBERS + 1];
+static int nr_cores;
+
+static struct bcast_t bc __attribute__ ((aligned(128)));
+static struct queue_t sep[MAX_SUBSCRIBERS] __attribute__ ((aligned(128)));
+static uint32_t nr_subs;
+static int use_bcast;
+static volatile int producer_done;
+static uint64_t order_errors[MAX_SUBSCRIBERS];
+static uint64_t lagged[MAX_SUBSCRIBERS];
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static void *consumer(void *arg)
+{
+	uint32_t i = (uint32_t)(uintptr_t)arg;
+	uint64_t work = (slow_workload && i == nr_subs - 1) ? slow_workload : workload;
+	uint64_t expected = 1;
+	ELEMENT_TYPE value;
+	int ret, resync = 0;
+
+	if (nr_cores)
+		pin(cores[(i + 1) % nr_cores]);
+	for (;;) {
+		ret = use_bcast ? bcast_dequeue(&bc, i, &value) :
+			dequeue(&sep[i], &value);
+		if (ret == BCAST_LAGGED) {
+			lagged[i] ++;
+			bcast_rejoin(&bc, i);
+			resync = 1;
+			continue;
+		}
+		if (ret != SUCCESS) {
+			if (producer_done && (use_bcast ? bcast_dequeue(&bc, i, &value) :
+						dequeue(&sep[i], &value)) != SUCCESS)
+				break;
+			if (!producer_done)
+				continue;
+		}
+		if (resync)
+			expected = value;
+		else if (value != expected)
+			order_errors[i] ++;
+		expected = value + 1;
+		resync = 0;
+		if (work)
+			wait_ticks(work);
+	}
+	return NULL;
+}
+
+/* Returns producer cycles per element. */
+static double run_one(int bcast)
+{
+	pthread_t cons[MAX_SUBSCRIBERS];
+	struct wait_state ws;
+	uint64_t i, start;
+	uint32_t k;
+
+	use_bcast = bcast;
+	producer_done = 0;
+	memset(order_errors, 0, sizeof(order_errors));
+	memset(lagged, 0, sizeof(lagged));
+	if (bcast)
+		bcast_init(&bc, nr_subs, ring_size, slow_limit);
+	else
+		for (k = 0; k < nr_subs; k++)
+			queue_init(&sep[k], DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY,
+					OVERFLOW_BLOCK);
+
+	for (k = 0; k < nr_subs; k++)
+		pthread_create(&cons[k], NULL, consumer, (void *)(uintptr_t)k);
+
+	wait_init(&ws, wait_default);
+	start = rdtsc_bare();
+	for (i = 1; i <= test_size; i++) {
+		if (bcast) {
+			while (bcast_enqueue(&bc, (ELEMENT_TYPE)i) != SUCCESS)
+				wait_for(&ws, DEFAULT_PENALTY);
+			continue;
+		}
+		for (k = 0; k < nr_subs; k++) {
+			while (enqueue(&sep[k], (ELEMENT_TYPE)i) != SUCCESS) {
+				sep[k].full_counter ++;
+				sep[k].traffic_full ++;
+				wait_for(&ws, sep[k].penalty);
+			}
+		}
+	}
+	start = rdtsc_bare() - start;
+	producer_done = 1;
+
+	for (k = 0; k < nr_subs; k++)
+		pthread_join(cons[k], NULL);
+	return (double)start / test_size;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t max_subs = 8, k;
+	uint64_t errors, lags, evictions;
+	double b, s;
+	int opt;
+
+	char * usage =
+		"Usage: bcast_bench [-t test_size (default: 2,000,000)]\n\
+		[-n max subscribers, runs 1..n (default: 8)]\n\
+		[-w subscriber workload (default: 0 cycles)]\n\
+		[-x workload of the last subscriber (default: same as -w)]\n\
+		[-q broadcast ring size (default: 131072, MAX_QUEUE_SIZE)]\n\
+		[-L evict a subscriber that keeps the ring full this many cycles (default: never)]\n\
+		[-C cores, producer first, e.g. 0,2,4,6 (default: unpinned)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:n:w:x:q:L:C:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'n':
+				max_subs = atoi(optarg);
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'x':
+				slow_workload = atoll(optarg);
+				break;
+			case 'q':
+				ring_size = atoll(optarg);
+				break;
+			case 'L':
+				slow_limit = atoll(optarg);
+				break;
+			case 'C':
+				nr_cores = parse_list(optarg, cores, MAX_SUBSCRIBERS + 1);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (max_subs < 1 || max_subs > MAX_SUBSCRIBERS) {
+		printf("%s\n", usage);
+		exit(-1);
+	}
+
+	tsc_init();
+	if (nr_cores)
+		pin(cores[0]);
+
+	printf("%-5s %14s %14s %8s %10s %10s %8s %8s\n", "subs", "bcast/op",
+			"separate/op", "ratio", "scans/op", "evictions", "lagged",
+			"errors");
+	for (nr_subs = 1; nr_subs <= max_subs; nr_subs++) {
+		s = run_one(0);
+		for (k = 0; k < nr_subs; k++)
+			queue_destroy(&sep[k]);
+
+		b = run_one(1);
+		errors = lags = evictions = 0;
+		for (k = 0; k < nr_subs; k++) {
+			errors += order_errors[k];
+			lags += lagged[k];
+			evictions += bc.subs[k].evictions;
+		}
+		printf("%-5u %14.1f %14.1f %7.2fx %10.4f %10lu %8lu %8lu\n",
+				nr_subs, tsc_out(b), tsc_out(s), b > 0 ? s / b : 0.0,
+				(double)bc.min_scans / test_size, evictions, lags, errors);
+		bcast_destroy(&bc);
+	}
+	printf("Producer time per element in %s.\n", tsc_unit());
+	return 0;
+}
@@ -0,0 +1,266 @@
+/*
+ *  coro_bench.cpp: Compare the coroutine front end of EQueue with the
+ *  thread-pinned producer()/consumer() loops of main.c.
+ *
+ *  Two workloads are measured:
+ *    stream:    one side pushes test_size items, the other pops them.
+ *    pingpong:  one item bounces between two queues test_size times.
+ *
+ *  Each workload runs three ways: plain pinned threads spinning on
+ *  enqueue()/dequeue() (the main.c harness), coroutines on one executor
+ *  per pinned thread, and both coroutines sharing a single executor.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <unistd.h>
+#include <sched.h>
+#include "fifo_coro.hpp"
+#include "tsc.h"
+
+#define DEFAULT_TEST_SIZE 10000000
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static int cpu_a = 0;
+static int cpu_b = 1;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+/* Run a() and b() on two threads pinned to cpu_a and cpu_b.
+ * Returns the wall-clock cycles of the slower side. */
+template <typename A, typename B>
+static uint64_t run_pair(A a, B b)
+{
+	uint64_t start, stop_a = 0, stop_b = 0;
+
+	start = rdtsc_bare();
+	std::thread ta([&] { pin(cpu_a); a(); stop_a = rdtsc_bare(); });
+	std::thread tb([&] { pin(cpu_b); b(); stop_b = rdtsc_bare(); });
+	ta.join();
+	tb.join();
+	return (stop_a > stop_b ? stop_a : stop_b) - start;
+}
+
+/*************************************************/
+/********** Thread-pinned baseline ***************/
+/*************************************************/
+
+static void thread_push(struct queue_t *q, ELEMENT_TYPE v)
+{
+	int flag = 0;
+	while (enqueue(q, v) != SUCCESS) {
+		if (flag == 0) {
+			q->full_counter ++;
+			q->traffic_full ++;
+			flag = 1;
+		}
+		wait_ticks(q->penalty);
+	}
+}
+
+static ELEMENT_TYPE thread_pop(struct queue_t *q)
+{
+	ELEMENT_TYPE v;
+	int flag = 0;
+	while (dequeue(q, &v) != SUCCESS) {
+		if (flag == 0) {
+			q->empty_counter ++;
+			q->traffic_empty ++;
+			flag = 1;
+		}
+	}
+	return v;
+}
+
+static uint64_t stream_threads()
+{
+	equeue::queue q;
+
+	return run_pair(
+		[&] {
+			for (uint64_t i = 1; i <= test_size; i++)
+				thread_push(q.raw(), i);
+		},
+		[&] {
+			for (uint64_t i = 1; i <= test_size; i++)
+				if (thread_pop(q.raw()) != i)
+					printf("!!!ERROR!!! stream out of order at %lu\n", i);
+		});
+}
+
+static uint64_t pingpong_threads()
+{
+	equeue::queue ping, pong;
+
+	return run_pair(
+		[&] {
+			for (uint64_t i = 1; i <= test_size; i++) {
+				thread_push(ping.raw(), i);
+				thread_pop(pong.raw());
+			}
+		},
+		[&] {
+			for (uint64_t i = 1; i <= test_size; i++)
+				thread_push(pong.raw(), thread_pop(ping.raw()));
+		});
+}
+
+/*************************************************/
+/********** Coroutines ***************************/
+/*************************************************/
+
+static equeue::task stream_producer(equeue::queue &q)
+{
+	for (uint64_t i = 1; i <= test_size; i++)
+		co_await q.push(i);
+}
+
+static equeue::task stream_consumer(equeue::queue &q)
+{
+	for (uint64_t i = 1; i <= test_size; i++)
+		if (co_await q.pop() != i)
+			printf("!!!ERROR!!! stream out of order at %lu\n", i);
+}
+
+static equeue::task pinger(equeue::queue &ping, equeue::queue &pong)
+{
+	for (uint64_t i = 1; i <= test_size; i++) {
+		co_await ping.push(i);
+		co_await pong.pop();
+	}
+}
+
+static equeue::task ponger(equeue::queue &ping, equeue::queue &pong)
+{
+	for (uint64_t i = 1; i <= test_size; i++)
+		co_await pong.push(co_await ping.pop());
+}
+
+static void run_alone(equeue::task t)
+{
+	equeue::executor ex;
+	ex.spawn(std::move(t));
+	ex.run();
+}
+
+static uint64_t stream_coro()
+{
+	equeue::queue q;
+
+	return run_pair([&] { run_alone(stream_producer(q)); },
+			[&] { run_alone(stream_consumer(q)); });
+}
+
+static uint64_t pingpong_coro()
+{
+	equeue::queue ping, pong;
+
+	return run_pair([&] { run_alone(pinger(ping, pong)); },
+			[&] { run_alone(ponger(ping, pong)); });
+}
+
+static uint64_t stream_coro_shared()
+{
+	equeue::queue q;
+	equeue::executor ex;
+	uint64_t start;
+
+	pin(cpu_a);
+	ex.spawn(stream_producer(q));
+	ex.spawn(stream_consumer(q));
+	start = rdtsc_bare();
+	ex.run();
+	return rdtsc_bare() - start;
+}
+
+static uint64_t pingpong_coro_shared()
+{
+	equeue::queue ping, pong;
+	equeue::executor ex;
+	uint64_t start;
+
+	pin(cpu_a);
+	ex.spawn(pinger(ping, pong));
+	ex.spawn(ponger(ping, pong));
+	start = rdtsc_bare();
+	ex.run();
+	return rdtsc_bare() - start;
+}
+
+static void report(const char *name, uint64_t cycles)
+{
+	printf("%-28s %8.0f %s/op\n", name, tsc_out(cycles / test_size),
+			tsc_unit());
+}
+
+int main(int argc, char *argv[])
+{
+	int opt;
+	const char *usage =
+		"Usage: coro_bench [-t test_size (default: 10,000,000)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:a:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'a':
+				cpu_a = atoi(optarg);
+				break;
+			case 'b':
+				cpu_b = atoi(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+	tsc_init();
+	printf("Test ready to run. Items: %lu, cores: %d %d\n",
+			test_size, cpu_a, cpu_b);
+
+	report("stream   threads", stream_threads());
+	report("stream   coroutines", stream_coro());
+	report("stream   coroutines/shared", stream_coro_shared());
+	report("pingpong threads", pingpong_threads());
+	report("pingpong coroutines", pingpong_coro());
+	report("pingpong coroutines/shared", pingpong_coro_shared());
+
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ *  cqueue.c: Compact EQueue.  The elements of queue_t are 64 bits wide,
+ *  so a queue of 32-bit indices wastes half of every cache line the
+ *  producer and the consumer pass to each other.  A cqueue_t stores its
+ *  elements in 16, 32 or 64-bit slots, or in one slot per cache line.
+ *
+ *  The protocol is that of fifo.c with batching: 0 marks an empty slot,
+ *  so elements must be in [1, 2^width - 1], and the producer probes a
+ *  slot `batch' slots ahead before filling the ones in between.  Aligned
+ *  16 and 32-bit loads and stores are single-copy atomic on x86 like
+ *  64-bit ones.  The probe distance is kept constant in bytes rather
+ *  than in slots, so the producer stays as many cache lines ahead of
+ *  the consumer at every width.  The queue has a fixed size; resizing,
+ *  spilling and the overflow policies remain with queue_t.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "cqueue.h"
+#include "wait.h"
+
+static const char *slot_names[NR_SLOT_LAYOUTS] = { "16-bit", "32-bit",
+	"64-bit", "padded" };
+
+/* Memory taken by one slot. */
+uint32_t slot_bytes(uint32_t layout)
+{
+	switch (layout) {
+		case SLOT_16: return 2;
+		case SLOT_32: return 4;
+		case SLOT_64: return 8;
+		default: return CACHE_LINE;
+	}
+}
+
+const char *slot_name(uint32_t layout)
+{
+	return layout < NR_SLOT_LAYOUTS ? slot_names[layout] : "?";
+}
+
+/* size is rounded up to a power of two of at least MIN_QUEUE_SIZE. */
+void cqueue_init(struct cqueue_t *q, uint64_t size, uint32_t layout,
+		uint64_t penalty)
+{
+	uint64_t s = MIN_QUEUE_SIZE;
+	uint32_t width;
+
+	if (layout >= NR_SLOT_LAYOUTS) {
+		printf("Error: unknown slot layout %u.\n", layout);
+		exit(-1);
+	}
+	while (s < size)
+		s <<= 1;
+
+	memset(q, 0, sizeof(struct cqueue_t));
+	q->size = s;
+	q->mask = s - 1;
+	q->layout = layout;
+	q->penalty = penalty;
+	q->wait = wait_default;
+	width = layout == SLOT_PADDED ? 64 : slot_bytes(layout) * 8;
+	q->max_value = width == 64 ? ~0UL : (1UL << width) - 1;
+
+	/* The same distances in bytes as queue_t's 64-bit slots. */
+	q->batch = DEFAULT_BATCH_SIZE * sizeof(ELEMENT_TYPE) / slot_bytes(layout);
+	q->slice = BATCH_SLICE * sizeof(ELEMENT_TYPE) / slot_bytes(layout);
+	if (q->slice < 1)
+		q->slice = 1;
+	while (q->batch >= s)
+		q->batch >>= 1;
+	while (q->slice >= s)
+		q->slice >>= 1;
+
+	q->bytes = s * slot_bytes(layout);
+	q->data = aligned_alloc(128, (q->bytes + 127) & ~127UL);
+	if (q->data == NULL) {
+		printf("Error in allocating compact queue.\n");
+		exit(-1);
+	}
+	memset(q->data, 0, q->bytes);
+}
+
+void cqueue_destroy(struct cqueue_t *q)
+{
+	free(q->data);
+	q->data = NULL;
+}
+
+static inline __attribute__((always_inline))
+uint64_t slot_load(struct cqueue_t *q, uint32_t i, const int layout)
+{
+	switch (layout) {
+		case SLOT_16: return READ_ONCE(((uint16_t *)q->data)[i]);
+		case SLOT_32: return READ_ONCE(((uint32_t *)q->data)[i]);
+		case SLOT_64: return READ_ONCE(((uint64_t *)q->data)[i]);
+		default:
+			return READ_ONCE(((uint64_t *)q->data)[(uint64_t)i *
+					(CACHE_LINE / sizeof(uint64_t))]);
+	}
+}
+
+static inline __attribute__((always_inline))
+void slot_store(struct cqueue_t *q, uint32_t i, uint64_t v, const int layout)
+{
+	switch (layout) {
+		case SLOT_16:
+			WRITE_ONCE(((uint16_t *)q->data)[i], (uint16_t)v);
+			break;
+		case SLOT_32:
+			WRITE_ONCE(((uint32_t *)q->data)[i], (uint32_t)v);
+			break;
+		case SLOT_64:
+			WRITE_ONCE(((uint64_t *)q->data)[i], v);
+			break;
+		default:
+			WRITE_ONCE(((uint64_t *)q->data)[(uint64_t)i *
+					(CACHE_LINE / sizeof(uint64_t))], v);
+	}
+}
+
+/* enqueue_batching_detect() of fifo.c for a fixed-size ring. */
+static inline __attribute__((always_inline))
+int cqueue_detect(struct cqueue_t *q, const int layout)
+{
+	struct wait_state ws;
+	uint32_t batch = q->batch;
+	uint32_t probe = (q->head + batch) & q->mask;
+
+	wait_init(&ws, q->wait);
+	while ( slot_load(q, probe, layout) ) {
+		wait_for(&ws, q->penalty);
+		if ( batch > q->slice ) {
+			batch >>= 1;
+			probe = (q->head + batch) & q->mask;
+		}
+		else
+			return BUFFER_FULL;
+	}
+	q->batch_head = probe;
+	return SUCCESS;
+}
+
+/* `layout' is a constant at each call site, as `batching' is in
+ * fifo.c's __enqueue(). */
+static inline __attribute__((always_inline))
+int __cqueue_enqueue(struct cqueue_t *q, uint64_t value, const int layout)
+{
+	if ( unlikely(value == 0 || value > q->max_value) )
+		return CQUEUE_RANGE;
+
+	if ( q->head == q->batch_head ) {
+		if ( cqueue_detect(q, layout) != SUCCESS )
+			return BUFFER_FULL;
+	}
+	slot_store(q, q->head, value, layout);
+	q->head = (q->head + 1) & q->mask;
+	return SUCCESS;
+}
+
+static inline __attribute__((always_inline))
+int __cqueue_dequeue(struct cqueue_t *q, uint64_t *value, const int layout)
+{
+	uint64_t v = slot_load(q, q->tail, layout);
+
+	if ( !v )
+		return BUFFER_EMPTY;
+	slot_store(q, q->tail, 0, layout);
+	q->tail = (q->tail + 1) & q->mask;
+	*value = v;
+	return SUCCESS;
+}
+
+int cqueue_enqueue(struct cqueue_t *q, uint64_t value)
+{
+	switch (q->layout) {
+		case SLOT_16: return __cqueue_enqueue(q, value, SLOT_16);
+		case SLOT_32: return __cqueue_enqueue(q, value, SLOT_32);
+		case SLOT_64: return __cqueue_enqueue(q, value, SLOT_64);
+		default: return __cqueue_enqueue(q, value, SLOT_PADDED);
+	}
+}
+
+int cqueue_dequeue(struct cqueue_t *q, uint64_t *value)
+{
+	switch (q->layout) {
+		case SLOT_16: return __cqueue_dequeue(q, value, SLOT_16);
+		case SLOT_32: return __cqueue_dequeue(q, value, SLOT_32);
+		case SLOT_64: return __cqueue_dequeue(q, value, SLOT_64);
+		default: return __cqueue_dequeue(q, value, SLOT_PADDED);
+	}
+}
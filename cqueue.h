@@ -0,0 +1,79 @@
+/*
+ *  cqueue.h: Compact EQueue for small elements (e.g. 32-bit indices
+ *  into a shared table), with 16, 32 or 64-bit slots, and a padded
+ *  layout with one slot per cache line for comparison.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_CQUEUE_H_
+#define _FIFO_CQUEUE_H_
+
+#include "fifo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define CACHE_LINE 64
+
+/* Slot layouts */
+#define SLOT_16 0	/* 32 slots per cache line */
+#define SLOT_32 1	/* 16 slots per cache line */
+#define SLOT_64 2	/* 8 slots per cache line, as in queue_t */
+#define SLOT_PADDED 3	/* one 64-bit slot per cache line */
+#define NR_SLOT_LAYOUTS 4
+
+/* Returned by cqueue_enqueue() for 0 (the empty sentinel) or a value
+ * wider than the slot. */
+#define CQUEUE_RANGE -3
+
+struct cqueue_t {
+	/* Accessed by producer only. */
+	uint32_t head __attribute__ ((aligned(128)));
+	uint32_t batch_head;		/* slots up to here are known empty */
+	uint32_t full_counter;
+
+	/* Accessed by consumer only. */
+	uint32_t tail __attribute__ ((aligned(128)));
+	uint32_t empty_counter;
+
+	/* readonly data */
+	void * data __attribute__ ((aligned(128)));
+	uint32_t size;			/* slots, a power of two */
+	uint32_t mask;
+	uint32_t layout;		/* SLOT_* */
+	uint32_t batch;			/* producer probe distance, in slots */
+	uint32_t slice;			/* shortest probe distance, in slots */
+	uint64_t max_value;
+	uint64_t bytes;
+	uint64_t penalty;
+	uint32_t wait;			/* WAIT_* strategy, see wait.h */
+};
+
+void cqueue_init(struct cqueue_t *, uint64_t, uint32_t, uint64_t);
+void cqueue_destroy(struct cqueue_t *);
+int cqueue_enqueue(struct cqueue_t *, uint64_t);
+int cqueue_dequeue(struct cqueue_t *, uint64_t *);
+uint32_t slot_bytes(uint32_t);
+const char *slot_name(uint32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
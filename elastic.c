@@ -0,0 +1,309 @@
+/*
+ *  elastic.c: Elastic consumer pool.  One producer spreads elements over
+ *  the queues of the active workers; a controller thread adds workers
+ *  when the queues fill up and retires them when they run dry.
+ *
+ *  Workers are added and retired in LIFO order, so the k-th active
+ *  worker always sits on the k-th core of the configuration and the
+ *  active set stays packed on the first cores.  Retiring is done in
+ *  three steps so that no element is stranded: the controller drops
+ *  the worker from the producer's route, waits until the producer has
+ *  acknowledged the new route, and only then lets the worker drain its
+ *  queue and park.  Its share of the traffic is merged into the
+ *  remaining queues from the moment the route changes.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <sched.h>
+#include <unistd.h>
+#include "elastic.h"
+#include "wait.h"
+
+static void pin_self(struct elastic_worker *w, int core)
+{
+	cpu_set_t mask;
+
+	if (core < 0 || core == w->pinned)
+		return;
+	CPU_ZERO(&mask);
+	CPU_SET(core, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity for elastic worker %u\n", w->index);
+	else
+		w->pinned = core;
+}
+
+static void *elastic_worker_main(void *arg)
+{
+	struct elastic_worker *w = (struct elastic_worker *)arg;
+	struct elastic_t *e = w->e;
+	struct queue_t *q = &e->queues[w->index];
+	struct wait_state ws;
+	ELEMENT_TYPE value;
+	uint32_t state;
+	int core, flag = 0;
+
+	w->pinned = -1;
+	wait_init(&ws, q->wait);
+
+	for (;;) {
+		state = READ_ONCE(w->state);
+		if (state == EW_PARKED) {
+			pthread_mutex_lock(&e->lock);
+			while (w->state == EW_PARKED && !e->stop)
+				pthread_cond_wait(&w->wake, &e->lock);
+			state = w->state;
+			core = w->core;
+			pthread_mutex_unlock(&e->lock);
+			if (state == EW_PARKED)
+				break;		/* stopped while parked */
+			pin_self(w, core);
+			continue;
+		}
+
+		if (dequeue(q, &value) == SUCCESS) {
+			if (flag) {
+				wait_reset(&ws);
+				flag = 0;
+			}
+			e->cfg.fn(value, w->index, e->cfg.arg);
+			w->items ++;
+			continue;
+		}
+
+		if (flag == 0) {
+			q->empty_counter ++;
+			q->traffic_empty ++;
+			w->empty_polls ++;
+			flag = 1;
+		}
+		if (state == EW_RETIRING) {
+			/* The producer has stopped sending here, so an
+			 * empty queue is a drained one. */
+			pthread_mutex_lock(&e->lock);
+			if (w->state == EW_RETIRING)
+				w->state = EW_PARKED;
+			pthread_mutex_unlock(&e->lock);
+			continue;
+		}
+		if (READ_ONCE(e->stop)) {
+			/* Everything was sent before stop was set. */
+			if (dequeue(q, &value) != SUCCESS)
+				break;
+			e->cfg.fn(value, w->index, e->cfg.arg);
+			w->items ++;
+			continue;
+		}
+		wait_idle(&ws, &q->data[q->tail]);
+	}
+	return NULL;
+}
+
+/* Caller holds e->lock. */
+static void scale_up(struct elastic_t *e)
+{
+	uint32_t i = e->nr_active;
+	struct elastic_worker *w = &e->workers[i];
+
+	w->core = e->cfg.cores[i];
+	if (w->state == EW_PARKED)
+		pthread_cond_signal(&w->wake);
+	WRITE_ONCE(w->state, EW_ACTIVE);
+	WRITE_ONCE(e->nr_active, i + 1);
+	WRITE_ONCE(e->route_mask, e->route_mask | (1U << i));
+	WRITE_ONCE(e->route_gen, e->route_gen + 1);
+	e->scale_ups ++;
+}
+
+/* Caller holds e->lock.  Returns the worker to retire once the producer
+ * acknowledges the new route. */
+static uint32_t scale_down(struct elastic_t *e)
+{
+	uint32_t i = e->nr_active - 1;
+
+	WRITE_ONCE(e->nr_active, i);
+	WRITE_ONCE(e->route_mask, e->route_mask & ~(1U << i));
+	WRITE_ONCE(e->route_gen, e->route_gen + 1);
+	e->scale_downs ++;
+	return i;
+}
+
+static void *elastic_controller(void *arg)
+{
+	struct elastic_t *e = (struct elastic_t *)arg;
+	struct elastic_config *cfg = &e->cfg;
+	uint32_t prev_full[MAX_ELASTIC] = { 0 }, prev_empty[MAX_ELASTIC] = { 0 };
+	uint32_t i, n, cool = 0, full, empty, pct, pending = MAX_ELASTIC;
+	uint32_t pending_gen = 0;
+	uint64_t occ;
+
+	while (!READ_ONCE(e->stop)) {
+		usleep(cfg->interval_us);
+
+		if (pending < MAX_ELASTIC &&
+				READ_ONCE(e->producer_gen) == pending_gen) {
+			pthread_mutex_lock(&e->lock);
+			if (e->workers[pending].state == EW_ACTIVE &&
+					pending >= e->nr_active)
+				WRITE_ONCE(e->workers[pending].state, EW_RETIRING);
+			pthread_mutex_unlock(&e->lock);
+			pending = MAX_ELASTIC;
+		}
+
+		n = e->nr_active;
+		occ = 0;
+		full = empty = 0;
+		for (i = 0; i < cfg->max_workers; i++) {
+			struct queue_t *q = &e->queues[i];
+			uint32_t f = READ_ONCE(q->full_counter);
+			uint32_t m = READ_ONCE(q->empty_counter);
+
+			full += f - prev_full[i];
+			empty += m - prev_empty[i];
+			prev_full[i] = f;
+			prev_empty[i] = m;
+			if (i < n)
+				occ += queue_occupancy(q) * 100 /
+					READ_ONCE(q->info.queue_size);
+		}
+		pct = n ? occ / n : 0;
+
+		if (cool) {
+			cool --;
+			continue;
+		}
+		if (pending < MAX_ELASTIC)
+			continue;
+
+		pthread_mutex_lock(&e->lock);
+		if ((pct > cfg->high_watermark || full > 0) &&
+				n < cfg->max_workers) {
+			scale_up(e);
+			cool = cfg->cooldown;
+		} else if (pct < cfg->low_watermark && empty >= cfg->min_empty &&
+				n > cfg->min_workers) {
+			pending = scale_down(e);
+			pending_gen = e->route_gen;
+			cool = cfg->cooldown;
+		}
+		pthread_mutex_unlock(&e->lock);
+	}
+	return NULL;
+}
+
+int elastic_start(struct elastic_t *e, const struct elastic_config *cfg,
+		uint64_t queue_size, uint64_t penalty)
+{
+	uint32_t i;
+
+	if (cfg->min_workers < 1 || cfg->max_workers > MAX_ELASTIC ||
+			cfg->min_workers > cfg->max_workers || cfg->fn == NULL) {
+		printf("Error: elastic pool needs 1 <= min <= max <= %d workers.\n",
+				MAX_ELASTIC);
+		return -1;
+	}
+
+	memset(e, 0, sizeof(struct elastic_t));
+	e->cfg = *cfg;
+	pthread_mutex_init(&e->lock, NULL);
+	for (i = 0; i < cfg->max_workers; i++) {
+		struct elastic_worker *w = &e->workers[i];
+
+		queue_init(&e->queues[i], queue_size, penalty, OVERFLOW_BLOCK);
+		pthread_cond_init(&w->wake, NULL);
+		w->e = e;
+		w->index = i;
+		w->core = cfg->cores[i];
+		w->state = EW_PARKED;
+	}
+	for (i = 0; i < cfg->min_workers; i++)
+		scale_up(e);
+	e->scale_ups = 0;
+
+	for (i = 0; i < cfg->max_workers; i++) {
+		if (pthread_create(&e->workers[i].tid, NULL, elastic_worker_main,
+					&e->workers[i]) != 0) {
+			perror("cannot create elastic worker");
+			return -1;
+		}
+	}
+	if (pthread_create(&e->controller, NULL, elastic_controller, e) != 0) {
+		perror("cannot create elastic controller");
+		return -1;
+	}
+	return 0;
+}
+
+static void elastic_reroute(struct elastic_t *e, uint32_t gen)
+{
+	uint32_t mask = READ_ONCE(e->route_mask), i;
+
+	e->nr_route = 0;
+	for (i = 0; i < MAX_ELASTIC; i++)
+		if (mask & (1U << i))
+			e->route[e->nr_route++] = i;
+	e->rr = 0;
+	e->seen_gen = gen;
+	WRITE_ONCE(e->producer_gen, gen);
+}
+
+/* Producer only.  Blocks while the chosen queue is full. */
+void elastic_send(struct elastic_t *e, ELEMENT_TYPE value)
+{
+	uint32_t gen = READ_ONCE(e->route_gen);
+	struct queue_t *q;
+	struct wait_state ws;
+
+	if ( unlikely(gen != e->seen_gen) )
+		elastic_reroute(e, gen);
+
+	q = &e->queues[e->route[e->rr]];
+	if (++e->rr >= e->nr_route)
+		e->rr = 0;
+
+	if (enqueue(q, value) == SUCCESS)
+		return;
+	q->full_counter ++;
+	q->traffic_full ++;
+	wait_init(&ws, q->wait);
+	do {
+		wait_for(&ws, q->penalty);
+	} while (enqueue(q, value) != SUCCESS);
+}
+
+/* Called by the producer after its last elastic_send(): the workers
+ * drain their queues and exit. */
+void elastic_stop(struct elastic_t *e)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&e->lock);
+	WRITE_ONCE(e->stop, 1);
+	for (i = 0; i < e->cfg.max_workers; i++)
+		pthread_cond_signal(&e->workers[i].wake);
+	pthread_mutex_unlock(&e->lock);
+
+	for (i = 0; i < e->cfg.max_workers; i++)
+		pthread_join(e->workers[i].tid, NULL);
+	pthread_join(e->controller, NULL);
+	for (i = 0; i < e->cfg.max_workers; i++) {
+		queue_destroy(&e->queues[i]);
+		pthread_cond_destroy(&e->workers[i].wake);
+	}
+	pthread_mutex_destroy(&e->lock);
+}
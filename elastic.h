@@ -0,0 +1,111 @@
+/*
+ *  elastic.h: Elastic consumer pool.  One producer spreads elements over
+ *  the queues of the active workers; a controller thread adds workers
+ *  when the queues fill up and retires them when they run dry.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_ELASTIC_H_
+#define _FIFO_ELASTIC_H_
+
+#include <pthread.h>
+#include "fifo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_ELASTIC MAX_CORE_NUM
+
+/* Worker states */
+#define EW_PARKED 0
+#define EW_ACTIVE 1
+#define EW_RETIRING 2	/* no longer routed to; drains its queue, then parks */
+
+/* Called by a worker for every element it dequeues. */
+typedef void (*elastic_fn_t)(ELEMENT_TYPE, uint32_t, void *);
+
+struct elastic_config {
+	uint32_t min_workers;
+	uint32_t max_workers;
+	/* Average occupancy of the active queues, in percent of their
+	 * size, above which a worker is added (also whenever the producer
+	 * found a queue full) and below which one is retired. */
+	uint32_t high_watermark;
+	uint32_t low_watermark;
+	/* A worker is retired only if the workers found their queues
+	 * empty at least this many times per interval. */
+	uint32_t min_empty;
+	uint64_t interval_us;		/* controller period */
+	uint32_t cooldown;		/* intervals between two changes */
+	int cores[MAX_ELASTIC];		/* k-th active worker runs on cores[k] */
+	elastic_fn_t fn;
+	void *arg;
+};
+
+struct elastic_worker {
+	/* Accessed by the worker. */
+	uint64_t items __attribute__ ((aligned(128)));
+	uint64_t empty_polls;
+	int pinned;			/* core the thread is on, -1: none */
+
+	/* Written by the controller, under elastic_t.lock. */
+	uint32_t state __attribute__ ((aligned(128)));
+	int core;
+	pthread_cond_t wake;
+	pthread_t tid;
+	uint32_t index;
+	struct elastic_t *e;
+};
+
+struct elastic_t {
+	struct queue_t queues[MAX_ELASTIC];
+	struct elastic_worker workers[MAX_ELASTIC];
+
+	/* Accessed by producer only. */
+	uint32_t route[MAX_ELASTIC] __attribute__ ((aligned(128)));
+	uint32_t nr_route;
+	uint32_t rr;
+	uint32_t seen_gen;
+
+	/* Written by the controller: the producer sends to the queues in
+	 * route_mask, and acknowledges a new route_gen in producer_gen. */
+	uint32_t route_mask __attribute__ ((aligned(128)));
+	uint32_t route_gen;
+	uint32_t nr_active;
+	uint32_t producer_gen __attribute__ ((aligned(128)));
+
+	/* Controller */
+	struct elastic_config cfg __attribute__ ((aligned(128)));
+	pthread_mutex_t lock;
+	pthread_t controller;
+	int stop;
+	uint64_t scale_ups;
+	uint64_t scale_downs;
+};
+
+int elastic_start(struct elastic_t *, const struct elastic_config *,
+		uint64_t, uint64_t);
+void elastic_send(struct elastic_t *, ELEMENT_TYPE);
+void elastic_stop(struct elastic_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
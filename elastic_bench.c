@@ -0,0 +1,284 @@
+/*
+ *  elastic_bench.c: Cores used and latency of the elastic consumer pool
+ *  (elastic.c) over a time-varying load, against a pool with a fixed
+ *  number of workers.
+ *
+ *  The producer follows a load profile: a list of phases, each a rate
+ *  in elements per second held for some milliseconds.  Every element is
+ *  stamped with the TSC; a worker spends `workload' cycles on it and
+ *  records its latency.  Cores are taken from the consumer column of an
+ *  affinity file (see main.c), the producer runs on the first producer
+ *  core.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sched.h>
+#include <string.h>
+#include "elastic.h"
+#include "latency.h"
+#include "tsc.h"
+
+#define MAX_PHASES 16
+/* The producer samples the number of active workers this often. */
+#define SAMPLE_EVERY 256
+
+struct phase {
+	uint64_t rate;			/* elements per second */
+	uint64_t ms;
+	/* Results */
+	uint64_t items;
+	uint64_t active_sum;
+	uint64_t active_samples;
+	uint32_t active_max;
+};
+
+static struct phase phases[MAX_PHASES];
+static uint32_t nr_phases;
+static uint64_t workload = 4000;
+static int producer_core = -1;
+static int consumer_cores[MAX_CORE_NUM];
+
+/* Per worker and phase, so that workers never share a histogram. */
+static struct latency_hist lat[MAX_ELASTIC][MAX_PHASES];
+static volatile uint32_t cur_phase;
+
+static void consume(ELEMENT_TYPE v, uint32_t worker, void *arg)
+{
+	if (workload)
+		wait_ticks(workload);
+	latency_record(&lat[worker][cur_phase],
+			tsc_sub_overhead(rdtsc_bare() - v));
+}
+
+static int read_affinity(const char *path)
+{
+	FILE *fp = fopen(path, "r");
+	int i, p;
+
+	if (fp == NULL) {
+		printf("Incorrect affinity file parameter.\n");
+		return -1;
+	}
+	for (i = 0; i < MAX_CORE_NUM; i++) {
+		if (fscanf(fp, "%d", &p) != 1 ||
+				fscanf(fp, "%d", &consumer_cores[i]) != 1) {
+			fclose(fp);
+			printf("Incorrect affinity file format.\n");
+			return -1;
+		}
+		if (i == 0)
+			producer_core = p;
+	}
+	fclose(fp);
+	return 0;
+}
+
+/* "rate:ms,rate:ms,..." */
+static int parse_profile(const char *s)
+{
+	char *end;
+
+	nr_phases = 0;
+	while (*s && nr_phases < MAX_PHASES) {
+		phases[nr_phases].rate = strtoull(s, &end, 0);
+		if (*end != ':')
+			return -1;
+		phases[nr_phases].ms = strtoull(end + 1, &end, 0);
+		if (phases[nr_phases].rate == 0 || phases[nr_phases].ms == 0)
+			return -1;
+		nr_phases ++;
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return nr_phases ? 0 : -1;
+}
+
+static void run(const char *name, struct elastic_config *cfg)
+{
+	static struct elastic_t e __attribute__ ((aligned(128)));
+	uint64_t start, next, end, gap, i = 0, busy = 0, elapsed = 0, consumed = 0;
+	uint32_t p, k, n;
+
+	memset(lat, 0, sizeof(lat));
+	for (p = 0; p < nr_phases; p++) {
+		phases[p].items = 0;
+		phases[p].active_sum = 0;
+		phases[p].active_samples = 0;
+		phases[p].active_max = 0;
+	}
+	cur_phase = 0;
+	if (elastic_start(&e, cfg, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY) != 0)
+		exit(-1);
+
+	/* Open loop: element i of a phase is due at start + i * gap. */
+	for (p = 0; p < nr_phases; p++) {
+		cur_phase = p;
+		gap = (uint64_t)(1e9 * tsc_clock.ticks_per_ns / phases[p].rate);
+		start = next = rdtsc_bare();
+		end = start + (uint64_t)(phases[p].ms * 1e6 * tsc_clock.ticks_per_ns);
+		while (next < end) {
+			while (rdtsc_bare() < next)
+				;
+			elastic_send(&e, rdtsc_bare());
+			next += gap;
+			phases[p].items ++;
+			if ((i++ & (SAMPLE_EVERY - 1)) == 0) {
+				n = READ_ONCE(e.nr_active);
+				phases[p].active_sum += n;
+				phases[p].active_samples ++;
+				if (n > phases[p].active_max)
+					phases[p].active_max = n;
+			}
+		}
+	}
+	elastic_stop(&e);
+
+	printf("===== %s: %u-%u workers =====\n", name, cfg->min_workers,
+			cfg->max_workers);
+	printf("%-6s %10s %8s %10s %10s %12s %12s\n", "phase", "rate/s", "ms",
+			"avg cores", "max cores", "lat avg", "lat p99");
+	for (p = 0; p < nr_phases; p++) {
+		struct latency_hist all;
+		double cores = phases[p].active_samples ?
+			(double)phases[p].active_sum / phases[p].active_samples : 0;
+
+		memset(&all, 0, sizeof(all));
+		for (k = 0; k < MAX_ELASTIC; k++) {
+			uint32_t b;
+
+			all.count += lat[k][p].count;
+			all.sum += lat[k][p].sum;
+			if (lat[k][p].max > all.max)
+				all.max = lat[k][p].max;
+			for (b = 0; b < 65; b++)
+				all.hist[b] += lat[k][p].hist[b];
+		}
+		printf("%-6u %10lu %8lu %10.2f %10u %12.0f %12.0f\n", p,
+				phases[p].rate, phases[p].ms, cores,
+				phases[p].active_max, tsc_out(latency_avg(&all)),
+				tsc_out(latency_percentile(&all, 99)));
+		busy += (uint64_t)(cores * phases[p].ms);
+		elapsed += phases[p].ms;
+	}
+	for (k = 0; k < cfg->max_workers; k++)
+		consumed += e.workers[k].items;
+	printf("core-seconds: %.2f over %.2f s, scale ups %lu, downs %lu, "
+			"sent %lu, consumed %lu; latency in %s\n",
+			busy / 1e3, elapsed / 1e3, e.scale_ups, e.scale_downs,
+			i, consumed, tsc_unit());
+}
+
+int main(int argc, char *argv[])
+{
+	struct elastic_config cfg;
+	const char *affinity = "affinity.tree.conf";
+	int opt, fixed = 1, i;
+	cpu_set_t mask;
+
+	memset(&cfg, 0, sizeof(cfg));
+	cfg.min_workers = 1;
+	cfg.max_workers = 8;
+	cfg.high_watermark = 50;
+	cfg.low_watermark = 5;
+	cfg.min_empty = 1;
+	cfg.interval_us = 10000;
+	cfg.cooldown = 5;
+	cfg.fn = consume;
+
+	char * usage =
+		"Usage: elastic_bench [-P load profile, rate:ms,... (default: 20x swing, see README)]\n\
+		[-w workload per element (default: 4000 cycles)]\n\
+		[-m min workers (default: 1)]\n\
+		[-M max workers (default: 8)]\n\
+		[-H high watermark, percent occupancy (default: 50)]\n\
+		[-L low watermark, percent occupancy (default: 5)]\n\
+		[-i controller interval (default: 10000 us)]\n\
+		[-c cooldown intervals between changes (default: 5)]\n\
+		[-a affinity conf. (default: affinity.tree.conf)]\n\
+		[-e elastic only, skip the fixed pool]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	parse_profile("100000:500,2000000:500,500000:500,100000:500,1000000:500");
+	while ((opt = getopt(argc, argv, "heNP:w:m:M:H:L:i:c:a:")) != -1) {
+		switch (opt) {
+			case 'P':
+				if (parse_profile(optarg) != 0) {
+					printf("Incorrect load profile.\n");
+					exit(-1);
+				}
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'm':
+				cfg.min_workers = atoi(optarg);
+				break;
+			case 'M':
+				cfg.max_workers = atoi(optarg);
+				break;
+			case 'H':
+				cfg.high_watermark = atoi(optarg);
+				break;
+			case 'L':
+				cfg.low_watermark = atoi(optarg);
+				break;
+			case 'i':
+				cfg.interval_us = atoll(optarg);
+				break;
+			case 'c':
+				cfg.cooldown = atoi(optarg);
+				break;
+			case 'a':
+				affinity = optarg;
+				break;
+			case 'e':
+				fixed = 0;
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+	if (read_affinity(affinity) != 0)
+		exit(-1);
+	for (i = 0; i < MAX_ELASTIC; i++)
+		cfg.cores[i] = consumer_cores[i];
+	CPU_ZERO(&mask);
+	CPU_SET(producer_core, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity for producer\n");
+
+	tsc_init();
+	run("elastic", &cfg);
+	if (fixed) {
+		cfg.min_workers = cfg.max_workers;
+		run("fixed", &cfg);
+	}
+	return 0;
+}
@@ -22,6 +22,11 @@
 
 #include "fifo.h"
 #include <sched.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "lt_cas.h"
+#include "atomics.h"
+#include "wait.h"
 
 #if defined(FIFO_DEBUG)
 #include <assert.h>
@@ -44,6 +49,35 @@ inline uint64_t rdtsc_bare()
 	return time;
 }
 
+/* rdtscp waits until all earlier instructions have executed; the
+ * lfence keeps later ones from starting before the read. */
+uint64_t rdtscp(void)
+{
+	uint32_t	msw, lsw;
+	__asm__		__volatile__(
+			"rdtscp\n\t"
+			"lfence\n\t"
+			: "=d" (msw), "=a"(lsw)
+			:
+			: "%rcx", "memory");
+	return ((uint64_t) msw << 32) | lsw;
+}
+
+/* rdtsc fenced on both sides: neither earlier nor later instructions
+ * overlap the read. */
+uint64_t rdtsc_barrier(void)
+{
+	uint32_t	msw, lsw;
+	__asm__		__volatile__(
+			"lfence\n\t"
+			"rdtsc\n\t"
+			"lfence\n\t"
+			: "=d" (msw), "=a"(lsw)
+			:
+			: "memory");
+	return ((uint64_t) msw << 32) | lsw;
+}
+
 inline void wait_ticks(uint64_t ticks)
 {
 	uint64_t	current_time;
@@ -60,21 +94,358 @@ static ELEMENT_TYPE ELEMENT_ZERO = 0x0UL;
 /********** Queue Functions **********************/
 /*************************************************/
 
-void queue_init(struct queue_t *q, uint64_t queue_size, uint64_t penalty)
+/* policy selects what enqueue() does on a full queue.  With
+ * OVERFLOW_DROP_NEWEST and OVERFLOW_OVERWRITE_OLDEST, enqueue() never
+ * fails and every discarded element is counted in q->dropped.
+ * OVERFLOW_OVERWRITE_OLDEST queues keep their initial size. */
+void queue_init(struct queue_t *q, uint64_t queue_size, uint64_t penalty,
+		uint32_t policy)
 {
 	memset(q, 0, sizeof(struct queue_t));
 	q->info.queue_size = queue_size;
 	q->traffic_full = 0;
 	q->traffic_empty = 0;
 	q->penalty = penalty;
+	q->policy = policy;
+	q->wait = wait_default;
 	printf("===== EQueue starts ======\n");
-	q->data = (ELEMENT_TYPE *) calloc (MAX_QUEUE_SIZE, sizeof(ELEMENT_TYPE));
-	if (q->data == NULL) {
+	/* Reserve room for MAX_QUEUE_SIZE elements; pages are faulted in as
+	 * the queue grows and given back when it shrinks. */
+	q->data = (ELEMENT_TYPE *) mmap(NULL, MAX_QUEUE_SIZE * sizeof(ELEMENT_TYPE),
+			PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (q->data == MAP_FAILED) {
 		printf("Error in allocating FIFO queue.\n");
 		exit(-1);
 	}
 }
 
+void queue_destroy(struct queue_t *q)
+{
+	if (q->spill != NULL)
+		queue_spill_destroy(q);
+	munmap(q->data, MAX_QUEUE_SIZE * sizeof(ELEMENT_TYPE));
+	q->data = NULL;
+}
+
+/*************************************************/
+/********** Spill-to-file overflow ***************/
+/*************************************************/
+
+/* Must be called before the producer and consumer start. */
+int queue_spill_init(struct queue_t *q, const char *path, uint64_t max_bytes)
+{
+	struct spill_t *sp;
+	long page = sysconf(_SC_PAGESIZE);
+
+	if (max_bytes == 0)
+		max_bytes = DEFAULT_SPILL_SIZE;
+	max_bytes -= max_bytes % page;
+	if (max_bytes < (uint64_t)page) {
+		printf("Error: spill file must hold at least one page.\n");
+		return -1;
+	}
+
+	sp = aligned_alloc(128, sizeof(struct spill_t));
+	if (sp == NULL) {
+		printf("Error in allocating spill state.\n");
+		return -1;
+	}
+	memset(sp, 0, sizeof(struct spill_t));
+	snprintf(sp->path, sizeof(sp->path), "%s", path);
+
+	sp->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (sp->fd < 0) {
+		perror("spill file open");
+		free(sp);
+		return -1;
+	}
+	/* Reserve the whole range now; the file itself grows on demand. */
+	sp->map = mmap(NULL, max_bytes, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_NORESERVE, sp->fd, 0);
+	if (sp->map == MAP_FAILED) {
+		perror("spill file mmap");
+		close(sp->fd);
+		unlink(path);
+		free(sp);
+		return -1;
+	}
+	sp->map_items = max_bytes / sizeof(ELEMENT_TYPE);
+	q->spill = sp;
+
+	return 0;
+}
+
+void queue_spill_destroy(struct queue_t *q)
+{
+	struct spill_t *sp = q->spill;
+
+	munmap(sp->map, sp->map_items * sizeof(ELEMENT_TYPE));
+	close(sp->fd);
+	unlink(sp->path);
+	free(sp);
+	q->spill = NULL;
+}
+
+/* Make the file large enough to hold `items' elements. */
+static int spill_grow(struct spill_t *sp, uint64_t items)
+{
+	uint64_t bytes = items * sizeof(ELEMENT_TYPE);
+	uint64_t max_bytes = sp->map_items * sizeof(ELEMENT_TYPE);
+
+	bytes = (bytes + SPILL_CHUNK - 1) / SPILL_CHUNK * SPILL_CHUNK;
+	if (bytes > max_bytes)
+		bytes = max_bytes;
+	if (ftruncate(sp->fd, bytes) != 0) {
+		perror("spill file ftruncate");
+		return -1;
+	}
+	sp->file_items = bytes / sizeof(ELEMENT_TYPE);
+	return 0;
+}
+
+/* Producer side.  Fails only when the spill file itself is full. */
+static int spill_enqueue(struct queue_t *q, ELEMENT_TYPE value)
+{
+	struct spill_t *sp = q->spill;
+	uint64_t head = sp->head;
+	uint64_t lag = head - LOAD_ACQUIRE(sp->tail);
+
+	if (lag >= sp->map_items)
+		return BUFFER_FULL;
+	if (head >= sp->file_items && head < sp->map_items) {
+		if (spill_grow(sp, head + 1) != 0)
+			return BUFFER_FULL;
+	}
+
+	STORE_RELAXED(sp->map[head % sp->map_items], value);
+	STORE_RELEASE(sp->head, head + 1);
+	sp->spilled_bytes += sizeof(ELEMENT_TYPE);
+	if (lag + 1 > sp->max_lag)
+		sp->max_lag = lag + 1;
+
+	return SUCCESS;
+}
+
+/* Consumer side, called once the ring is empty.  Spilling starts only
+ * when the ring is full, so an empty slot under tail means every ring
+ * element older than the spilled ones has already been consumed. */
+static int spill_dequeue(struct queue_t *q, ELEMENT_TYPE *value)
+{
+	struct spill_t *sp = q->spill;
+	uint64_t tail = sp->tail;
+
+	if (tail == LOAD_ACQUIRE(sp->head))
+		return BUFFER_EMPTY;
+
+	*value = LOAD_RELAXED(sp->map[tail % sp->map_items]);
+	sp->drained_bytes += sizeof(ELEMENT_TYPE);
+	STORE_RELEASE(sp->tail, tail + 1);
+
+	return SUCCESS;
+}
+
+/* Number of elements discarded so far by the overflow policy. */
+uint64_t queue_dropped(struct queue_t *q)
+{
+	return LOAD_RELAXED(q->dropped);
+}
+
+/* Called by the consumer to detect gaps: returns the number of elements
+ * dropped since the previous call and records the new total in *seen.
+ * With OVERFLOW_OVERWRITE_OLDEST the gap lies right before the next
+ * element dequeued; with OVERFLOW_DROP_NEWEST it lies before the
+ * elements enqueued after the drop. */
+uint64_t queue_gap(struct queue_t *q, uint64_t *seen)
+{
+	uint64_t dropped = LOAD_RELAXED(q->dropped);
+	uint64_t gap = dropped - *seen;
+
+	*seen = dropped;
+	return gap;
+}
+
+/* ow_tail layout: lap count in the high 32 bits, index in the low 31
+ * bits.  OW_BUSY is set while either side is moving an element in or
+ * out of the slot under ow_tail; both critical sections are a few
+ * instructions long. */
+#define OW_BUSY (1UL << 31)
+#define OW_INDEX(t) ((uint32_t)((t) & (OW_BUSY - 1)))
+
+static inline uint64_t ow_next(uint64_t t, uint32_t qsize)
+{
+	if (OW_INDEX(t) + 1 >= qsize)
+		return ((t >> 32) + 1) << 32;
+	return t + 1;
+}
+
+/* Number of elements in the queue, spilled ones included.  Cheap and
+ * side-effect free, so any thread may call it per message: it reads the
+ * producer's local_head (the true head; info.head runs ahead of it by
+ * up to a batch) and the consumer's tail without synchronization, and
+ * is a snapshot that may miss elements moved meanwhile.  Only when the
+ * two indexes meet does it look at the slot, to tell full from empty. */
+uint64_t queue_occupancy(struct queue_t *q)
+{
+	uint32_t qsize = LOAD_RELAXED(q->info.queue_size);
+	uint32_t head = LOAD_RELAXED(q->local_head);
+	uint32_t tail;
+	uint64_t n;
+
+	if ( unlikely(q->policy == OVERFLOW_OVERWRITE_OLDEST) )
+		tail = OW_INDEX(LOAD_RELAXED(q->ow_tail));
+	else
+		tail = LOAD_RELAXED(q->tail);
+	/* Either index may be caught right before it wraps or right
+	 * after a resize. */
+	if (head >= qsize)
+		head %= qsize;
+	if (tail >= qsize)
+		tail %= qsize;
+
+	if (head != tail)
+		n = head > tail ? head - tail : head + qsize - tail;
+	else
+		n = LOAD_RELAXED(q->data[tail]) ? qsize : 0;
+
+	if ( unlikely(q->spill != NULL) )
+		n += LOAD_RELAXED(q->spill->head) - LOAD_RELAXED(q->spill->tail);
+	return n;
+}
+
+/* OVERFLOW_OVERWRITE_OLDEST: when the ring is full the oldest element
+ * sits in the slot we are about to write.  Lock ow_tail, overwrite the
+ * slot and move ow_tail past it.  The newest element thus lands behind
+ * every surviving one, keeping FIFO order. */
+static int enqueue_overwrite(struct queue_t *q, ELEMENT_TYPE value)
+{
+	uint32_t h = q->local_head;
+	uint32_t qsize = q->info.queue_size;
+	uint64_t t;
+
+	for (;;) {
+		/* Read ow_tail before the slot: a stale non-empty slot read
+		 * before ow_tail could let us overwrite a slot the consumer
+		 * has already emptied one lap later. */
+		t = LOAD_ACQUIRE(q->ow_tail);
+		if ( !LOAD_ACQUIRE(q->data[h]) )
+			break;
+		/* Either the consumer is in the middle of taking an element,
+		 * or it has just taken slot h and its clearing store is not
+		 * visible yet.  Both last a few instructions. */
+		if ((t & OW_BUSY) || OW_INDEX(t) != h)
+			continue;
+		if (CAS(&q->ow_tail, t, t | OW_BUSY)) {
+			STORE_RELAXED(q->data[h], value);
+			STORE_RELEASE(q->ow_tail, ow_next(t, qsize));
+			STORE_RELAXED(q->dropped, q->dropped + 1);
+			goto out;
+		}
+	}
+
+	STORE_RELEASE(q->data[h], value);
+out:
+	q->local_head = (h + 1 >= qsize) ? 0 : h + 1;
+
+	return SUCCESS;
+}
+
+/* The consumer marks ow_tail busy before it reads and clears the slot,
+ * so that the producer cannot overwrite the slot between the two. */
+static int dequeue_overwrite(struct queue_t *q, ELEMENT_TYPE *value)
+{
+	uint32_t qsize = q->info.queue_size;
+	uint64_t t;
+
+	for (;;) {
+		t = LOAD_ACQUIRE(q->ow_tail);
+		/* Busy: the producer is overwriting the slot right now. */
+		if ((t & OW_BUSY) || !LOAD_ACQUIRE(q->data[OW_INDEX(t)]))
+			return BUFFER_EMPTY;
+		/* Fails if the producer has taken the slot meanwhile. */
+		if (CAS(&q->ow_tail, t, t | OW_BUSY))
+			break;
+	}
+	*value = LOAD_RELAXED(q->data[OW_INDEX(t)]);
+	STORE_RELEASE(q->data[OW_INDEX(t)], ELEMENT_ZERO);
+	STORE_RELEASE(q->ow_tail, ow_next(t, qsize));
+
+	return SUCCESS;
+}
+
+/* The ring is full.  Apply the overflow policy, or spill if the ring
+ * cannot grow any more. */
+static int enqueue_full(struct queue_t *q, ELEMENT_TYPE value)
+{
+	if (q->policy == OVERFLOW_DROP_NEWEST) {
+		STORE_RELAXED(q->dropped, q->dropped + 1);
+		return SUCCESS;
+	}
+
+	if (q->spill == NULL ||
+			(LOAD_RELAXED(q->info.queue_size) << 1) <= MAX_QUEUE_SIZE)
+		return BUFFER_FULL;
+
+	q->spill->spilling = 1;
+	q->spill->spill_events ++;
+	printf("(SPILL: Queue %ld) Queue full at maximum size, spilling to %s\n",
+			(q - queues), q->spill->path);
+	return spill_enqueue(q, value);
+}
+
+/* Producer side.  Double the queue size unless the consumer changed it
+ * since the producer read qsize. */
+static int queue_enlarge(struct queue_t *q, uint32_t qsize)
+{
+	struct info_t tmp, tmp2;
+
+	tmp2 = tmp = LOAD_RELAXED(q->info);
+	if (tmp.queue_size != qsize)
+		return 0;
+	tmp2.queue_size = qsize << 1;
+	return CAS((uint64_t *)&(q->info),
+			*(uint64_t *)&tmp, *(uint64_t *)&tmp2);
+}
+
+/* Consumer side.  Halve the queue size if the producer's head is below
+ * the new size.  The LT-CAS compares queue_size and only the high bits
+ * of head, so it still succeeds when the producer moves head meanwhile,
+ * as long as head stays below the bound.  HEAD_LAPPED is one of those
+ * bits: while the frontier has wrapped behind local_head, the slots
+ * from local_head to the end of the ring are still occupied, and the
+ * shrink must fail.  Build with -DSHRINK_FULL_CAS
+ * for the former full-word CAS, which fails whenever head moved. */
+static int queue_shrink(struct queue_t *q, uint32_t qsize)
+{
+	uint64_t old_info = (uint64_t)qsize << 32;
+	uint64_t new_info = (uint64_t)(qsize >> 1) << 32;
+
+#if defined(SHRINK_FULL_CAS)
+	struct info_t tmp = LOAD_RELAXED(q->info);
+
+	if (tmp.queue_size != qsize || tmp.head >= (qsize >> 1))
+		return 0;
+	return CAS((uint64_t *)&(q->info),
+			old_info | tmp.head, new_info | tmp.head);
+#else
+	return lt_cas64((uint64_t *)&(q->info), lt_cas_shift(qsize >> 1),
+			old_info, new_info);
+#endif
+}
+
+/* Give the pages of slots [from, to) back to the OS.  Called by the
+ * consumer after a shrink to `from' elements; those slots are empty and
+ * read as zero again when the queue grows back. */
+static void queue_reclaim(struct queue_t *q, uint32_t from, uint32_t to)
+{
+	uintptr_t page = sysconf(_SC_PAGESIZE);
+	uintptr_t start = ((uintptr_t)&q->data[from] + page - 1) & ~(page - 1);
+	uintptr_t end = (uintptr_t)&q->data[to] & ~(page - 1);
+
+	if (end > start && madvise((void *)start, end - start, MADV_DONTNEED) == 0)
+		q->reclaimed_bytes += end - start;
+}
+
 uint32_t MOD(uint32_t val, uint32_t inc, uint32_t mod)
 {
 	if ((val + inc) >= mod)
@@ -83,109 +454,344 @@ uint32_t MOD(uint32_t val, uint32_t inc, uint32_t mod)
 		return val + inc;
 }
 
+/* The head to publish for a new frontier.  The producer publishes only
+ * when local_head has caught up with the old frontier, so a new one
+ * below local_head has wrapped. */
+static inline uint32_t head_publish(struct queue_t *q, uint32_t head)
+{
+	return head < q->local_head ? head | HEAD_LAPPED : head;
+}
+
+/* local_head has wrapped too: the slots above it are empty again. */
+static void head_unlap(struct queue_t *q)
+{
+	struct info_t info, tmp;
+
+	do {
+		info = LOAD_RELAXED(q->info);
+		if (!(info.head & HEAD_LAPPED))
+			return;
+		tmp = info;
+		tmp.head = HEAD_INDEX(info.head);
+	} while (!CAS((uint64_t *)&(q->info),
+				*(uint64_t *)&info, *(uint64_t *)&tmp));
+}
+
 int enqueue_batching_detect(struct queue_t * q )
 {
-	int batch_size = DEFAULT_BATCH_SIZE;
-	int batch_head = MOD(q->info.head, batch_size,
-			READ_ONCE(q->info.queue_size));
+	struct info_t info, tmp;
+	struct wait_state ws;
+	uint64_t wait_start = 0;
+	int batch_size;
+	int batch_head;
+
+	wait_init(&ws, q->wait);
+again:
+	info = LOAD_RELAXED(q->info);
+	batch_size = DEFAULT_BATCH_SIZE;
+	while ( batch_size >= info.queue_size )
+		batch_size = batch_size >> 1;
+	batch_head = MOD(HEAD_INDEX(info.head), batch_size, info.queue_size);
 
-	while ( READ_ONCE(q->data[batch_head]) ) {
-		wait_ticks(DEFAULT_PENALTY);
+	while ( LOAD_ACQUIRE(q->data[batch_head]) ) {
+		if (wait_start == 0) {
+			wait_start = rdtsc_bare();
+			q->detect_waits ++;
+		}
+		/* Lossy queues must not stall the producer. */
+		if (q->policy == OVERFLOW_BLOCK)
+			wait_for(&ws, DEFAULT_PENALTY);
 		if ( batch_size > BATCH_SLICE ) {
 			batch_size = batch_size >> 1;
-			batch_head = MOD(q->info.head, batch_size,
-					READ_ONCE(q->info.queue_size));
+			batch_head = MOD(HEAD_INDEX(info.head), batch_size,
+					info.queue_size);
 		}
-		else
+		else {
+			q->detect_cycles += rdtsc_bare() - wait_start;
 			return BUFFER_FULL;
+		}
 	}
-	q->info.head = batch_head;
+	if (wait_start) {
+		q->detect_cycles += rdtsc_bare() - wait_start;
+		wait_start = 0;
+	}
+
+	/* batch_head was computed with info.queue_size.  Publish it only if
+	 * the consumer has not shrunk the queue meanwhile, so that a shrink
+	 * either sees the new head or makes us start over. */
+	tmp = info;
+	tmp.head = head_publish(q, batch_head);
+	if (!CAS((uint64_t *)&(q->info),
+				*(uint64_t *)&info, *(uint64_t *)&tmp))
+		goto again;
 
 	return SUCCESS;
 }
 
-int enqueue(struct queue_t * q, ELEMENT_TYPE value)
+/* Without batching the producer checks every slot before writing it,
+ * but it still publishes a head BATCH_SLICE slots ahead of local_head,
+ * so that a concurrent shrink knows which slots it may write. */
+static void enqueue_reserve(struct queue_t *q)
 {
-#if defined(BATCHING)
-	if ( q->local_head == q->info.head ) {
-		if (enqueue_batching_detect(q) != SUCCESS)
-			return BUFFER_FULL;
+	struct info_t info, tmp;
+	uint32_t slice;
+
+	do {
+		info = LOAD_RELAXED(q->info);
+		slice = BATCH_SLICE;
+		while ( slice >= info.queue_size )
+			slice = slice >> 1;
+		tmp = info;
+		tmp.head = head_publish(q,
+				MOD(HEAD_INDEX(info.head), slice, info.queue_size));
+	} while (!CAS((uint64_t *)&(q->info),
+				*(uint64_t *)&info, *(uint64_t *)&tmp));
+}
+
+/* Take the slot at local_head for the producer and move local_head on
+ * (growing the queue at the end of the ring if needed).  Returns the
+ * slot's index, or -1 if the queue is full.  Nothing is written. */
+static inline __attribute__((always_inline))
+int64_t enqueue_claim(struct queue_t * q, const int batching)
+{
+	if ( batching ) {
+		if ( q->local_head == HEAD_INDEX(LOAD_RELAXED(q->info.head)) ) {
+			if (enqueue_batching_detect(q) != SUCCESS)
+				return -1;
+		}
 	}
-#else
-	if ( READ_ONCE(q->data[q->local_head]) ) {
-		return BUFFER_FULL;
+	else {
+		if ( q->local_head == HEAD_INDEX(LOAD_RELAXED(q->info.head)) )
+			enqueue_reserve(q);
+		if ( LOAD_ACQUIRE(q->data[q->local_head]) )
+			return -1;
 	}
-#endif
 
 	uint32_t lhead_t = q->local_head;
-	uint64_t qsize_t = READ_ONCE(q->info.queue_size);
+	uint64_t qsize_t = LOAD_RELAXED(q->info.queue_size);
 	q->local_head ++;
 	if ( q->local_head >= qsize_t ) {
 		long traffic_tmp = 
-			READ_ONCE(q->traffic_full) - READ_ONCE(q->traffic_empty);
-		if (traffic_tmp >= ENLARGE_THRESHOLD) {
+			LOAD_RELAXED(q->traffic_full) - LOAD_RELAXED(q->traffic_empty);
+		/* Lossy queues keep their size: drops are not counted as
+		 * full traffic, so it would only ever shrink. */
+		if (q->policy == OVERFLOW_BLOCK && traffic_tmp >= ENLARGE_THRESHOLD) {
 			if ((qsize_t << 1) > MAX_QUEUE_SIZE) {
 				q->local_head = 0;
 				printf("(FAILURE: Queue %ld) Enlarging queue size failed \
 					(reaching maximum queue size. Current value: %u)\n",
-					(q - queues), q->info.queue_size);
+					(q - queues), LOAD_RELAXED(q->info.queue_size));
 			}
-			else {
-				WRITE_ONCE(q->info.queue_size, qsize_t << 1);
-				WRITE_ONCE(q->traffic_full, 0);
-				WRITE_ONCE(q->traffic_empty, 0);
+			else if (queue_enlarge(q, qsize_t)) {
+				q->enlarges ++;
+				STORE_RELAXED(q->traffic_full, 0);
+				STORE_RELAXED(q->traffic_empty, 0);
 				printf("(SUCCESS: Qeueue %ld) Enlarge queue size to %d\n",
-						(q - queues), q->info.queue_size);
+						(q - queues), LOAD_RELAXED(q->info.queue_size));
 			}
+			else
+				q->local_head = 0;	/* shrunk meanwhile */
 		}
 		else
 			q->local_head = 0;
+		if (q->local_head == 0)
+			head_unlap(q);
+	}
+
+	return lhead_t;
+}
+
+/* Body of every enqueue variant.  `batching' is a constant at each
+ * call site, so each variant is compiled without the other's branch. */
+static inline __attribute__((always_inline))
+int __enqueue(struct queue_t * q, ELEMENT_TYPE value, const int batching)
+{
+	int64_t slot;
+
+	if ( unlikely(q->policy == OVERFLOW_OVERWRITE_OLDEST) )
+		return enqueue_overwrite(q, value);
+
+	if ( unlikely(q->spill != NULL) && q->spill->spilling ) {
+		/* Keep order: stay on the spill file until it is drained. */
+		if ( LOAD_ACQUIRE(q->spill->tail) != q->spill->head )
+			return spill_enqueue(q, value);
+		q->spill->spilling = 0;
+	}
+
+	slot = enqueue_claim(q, batching);
+	if ( slot < 0 )
+		return enqueue_full(q, value);
+	STORE_RELEASE(q->data[slot], value);
+
+	return SUCCESS;
+}
+
+int enqueue_batching(struct queue_t * q, ELEMENT_TYPE value)
+{
+	return __enqueue(q, value, 1);
+}
+
+int enqueue_nobatching(struct queue_t * q, ELEMENT_TYPE value)
+{
+	return __enqueue(q, value, 0);
+}
+
+/* The variant selected at build time by -DBATCHING. */
+int enqueue(struct queue_t * q, ELEMENT_TYPE value)
+{
+#if defined(BATCHING)
+	return __enqueue(q, value, 1);
+#else
+	return __enqueue(q, value, 0);
+#endif
+}
+
+/*************************************************/
+/********** Group enqueue ************************/
+/*************************************************/
+
+/* Enqueue values[0..n) so that the consumer sees all of them or none.
+ * The group takes n + 1 slots: the header and the elements, which must
+ * be non-zero as with enqueue().  The header slot is claimed first but
+ * written last; until then it reads as empty and the consumer stops in
+ * front of the group.  Returns BUFFER_FULL, having enqueued nothing, if
+ * the slots are not free (a lossy queue drops the whole group instead),
+ * and GROUP_INVALID for n outside [1, MAX_GROUP], a zero element or an
+ * OVERFLOW_OVERWRITE_OLDEST queue.  Groups never go to the spill file.
+ *
+ * Once the first slot is claimed the group is committed: if a claim
+ * fails later on (the batching probe wants BATCH_SLICE free slots) the
+ * producer waits.  The consumer can still drain everything in front of
+ * the header, and the probe never reaches the group's own slots since
+ * MAX_GROUP + 1 + BATCH_SLICE < MIN_QUEUE_SIZE, so the wait ends. */
+int enqueue_group(struct queue_t * q, const ELEMENT_TYPE * values, uint32_t n)
+{
+	int64_t slots[MAX_GROUP + 1];
+	struct wait_state ws;
+	uint32_t qsize, k;
+
+	if (n == 0 || n > MAX_GROUP || q->policy == OVERFLOW_OVERWRITE_OLDEST)
+		return GROUP_INVALID;
+	/* A zero would read as an empty slot and never be dequeued. */
+	for (k = 0; k < n; k++)
+		if (values[k] == ELEMENT_ZERO)
+			return GROUP_INVALID;
+
+	if ( unlikely(q->spill != NULL) && q->spill->spilling ) {
+		if ( LOAD_ACQUIRE(q->spill->tail) != q->spill->head )
+			return BUFFER_FULL;
+		q->spill->spilling = 0;
+	}
+
+	/* Filled slots end at local_head, so if the group's last slot is
+	 * free, so are the ones before it. */
+	qsize = LOAD_RELAXED(q->info.queue_size);
+	if ( LOAD_ACQUIRE(q->data[(q->local_head + n) % qsize]) ) {
+		if (q->policy == OVERFLOW_DROP_NEWEST) {
+			STORE_RELAXED(q->dropped, q->dropped + n);
+			return SUCCESS;
+		}
+		return BUFFER_FULL;
+	}
+
+	wait_init(&ws, q->wait);
+	for (k = 0; k <= n; k++) {
+#if defined(BATCHING)
+		while ((slots[k] = enqueue_claim(q, 1)) < 0) {
+#else
+		while ((slots[k] = enqueue_claim(q, 0)) < 0) {
+#endif
+			/* Counted as callers of enqueue() count BUFFER_FULL,
+			 * so that the queue still grows. */
+			uint64_t wait_start = rdtsc_bare();
+
+			INC_RELAXED(q->full_counter);
+			INC_RELAXED(q->traffic_full);
+			wait_for(&ws, q->penalty);
+			q->full_cycles += rdtsc_bare() - wait_start;
+		}
 	}
+	for (k = 1; k <= n; k++)
+		STORE_RELAXED(q->data[slots[k]], values[k - 1]);
+	/* The release store of the header publishes the elements. */
+	STORE_RELEASE(q->data[slots[0]], GROUP_TAG | n);
 
-	WRITE_ONCE(q->data[lhead_t], value);
+	return SUCCESS;
+}
+
+/* Consumer side of enqueue_group().  On SUCCESS values[0..*n) holds a
+ * whole group, or a single element sent with enqueue() (*n = 1), which
+ * must then have GROUP_TAG clear.  values must have room for MAX_GROUP
+ * elements. */
+int dequeue_group(struct queue_t * q, ELEMENT_TYPE * values, uint32_t * n)
+{
+	ELEMENT_TYPE v;
+	struct wait_state ws;
+	uint32_t k, len;
+	int ret = dequeue(q, &v);
 
+	if (ret != SUCCESS)
+		return ret;
+	if ( !(v & GROUP_TAG) ) {
+		values[0] = v;
+		*n = 1;
+		return SUCCESS;
+	}
+	/* The elements were all written before the header, so the first
+	 * dequeue of each succeeds; only a producer that broke the protocol
+	 * makes us wait here. */
+	len = v & ~GROUP_TAG;
+	wait_init(&ws, q->wait);
+	for (k = 0; k < len; k++)
+		while (dequeue(q, &values[k]) != SUCCESS)
+			wait_for(&ws, q->penalty);
+	*n = len;
 	return SUCCESS;
 }
 
 int dequeue(struct queue_t * q, ELEMENT_TYPE * value)
 {
-	if ( !READ_ONCE(q->data[q->tail]) ) {
+	if ( unlikely(q->policy == OVERFLOW_OVERWRITE_OLDEST) )
+		return dequeue_overwrite(q, value);
+
+	if ( !LOAD_ACQUIRE(q->data[q->tail]) ) {
+		if ( unlikely(q->spill != NULL) )
+			return spill_dequeue(q, value);
 		return BUFFER_EMPTY;
 	}
 
-	uint32_t ltail_t = READ_ONCE(q->tail);
-	WRITE_ONCE(q->tail, ltail_t + 1);
-	if ( (ltail_t+1) >= READ_ONCE(q->info.queue_size) ) {
-		long traffic_tmp = READ_ONCE(q->traffic_empty)
-					- READ_ONCE(q->traffic_full);
-		if (traffic_tmp >= SHRINK_THRESHOLD) { 
-			struct info_t tmp;
-			struct info_t tmp2;
-			tmp2 = tmp = READ_ONCE(q->info);
-			if (tmp.queue_size <= MIN_QUEUE_SIZE) {
+	uint32_t ltail_t = LOAD_RELAXED(q->tail);
+	uint32_t shrunk = 0;
+	STORE_RELAXED(q->tail, ltail_t + 1);
+	if ( (ltail_t+1) >= LOAD_RELAXED(q->info.queue_size) ) {
+		long traffic_tmp = LOAD_RELAXED(q->traffic_empty)
+					- LOAD_RELAXED(q->traffic_full);
+		if (q->policy == OVERFLOW_BLOCK && traffic_tmp >= SHRINK_THRESHOLD) {
+			uint32_t qsize_t = LOAD_RELAXED(q->info.queue_size);
+			if (qsize_t <= MIN_QUEUE_SIZE) {
 				printf("(Queue %ld) Failed to shrink queue size \
 						(queue size too small : %u)\n",
-						(q-queues), q->info.queue_size);
+						(q-queues), qsize_t);
 			}
 			else {
-				if (tmp.head < (tmp.queue_size >> 1)) {
-					tmp2.queue_size = tmp2.queue_size >> 1;
-					if (__sync_bool_compare_and_swap((uint64_t *)&(q->info),
-								*(uint64_t *)&tmp, *(uint64_t *)&tmp2)) {
-						WRITE_ONCE(q->traffic_empty, 0);
-						WRITE_ONCE(q->traffic_full, 0);
-						printf("(SUCCESS: Queue %ld) Shrink queue size to %d\n",
-								(q-queues), q->info.queue_size);
-					} else {
-						printf("(FAILURE: Queue %ld) CAS failed in dequeue\n", (q-queues));
-					}
+				q->shrink_attempts ++;
+				if (queue_shrink(q, qsize_t)) {
+					STORE_RELAXED(q->traffic_empty, 0);
+					STORE_RELAXED(q->traffic_full, 0);
+					q->shrink_success ++;
+					shrunk = qsize_t;
+					printf("(SUCCESS: Queue %ld) Shrink queue size to %d\n",
+							(q-queues), qsize_t >> 1);
 				}
 			}
 		}
-		q->tail = 0;
+		STORE_RELAXED(q->tail, 0);
 	}
-	*value = READ_ONCE(q->data[ltail_t]);
-	WRITE_ONCE(q->data[ltail_t], ELEMENT_ZERO);
+	*value = LOAD_RELAXED(q->data[ltail_t]);
+	STORE_RELEASE(q->data[ltail_t], ELEMENT_ZERO);
+	/* Only now is the last slot of the old ring empty. */
+	if ( shrunk )
+		queue_reclaim(q, shrunk >> 1, shrunk);
 
 	return SUCCESS;
 }
@@ -30,11 +30,19 @@
 #include <string.h>
 #include <stdint.h>
 #include <stdlib.h>
+#ifndef __cplusplus
+/* api.h uses C-only constructs (e.g. "new" as an identifier). */
 #include "api.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /* Reading/Writing aligned 64-bit memory is atomic on x64 servers. *
  * This argument must be changed to uint32_t when the FIFO is      *
- * used on 32-bit servers. */
+ * used on 32-bit servers.  cqueue.h keeps small elements in 16 or *
+ * 32-bit slots. */
 #define ELEMENT_TYPE uint64_t
 
 /* Return values of deq() and enq() */
@@ -55,44 +63,122 @@
 
 #define DEFAULT_PENALTY (1000) /* cycles */
 
+/* What enqueue() does when the queue is full (see queue_init()). */
+#define OVERFLOW_BLOCK 0	/* return BUFFER_FULL; the caller retries */
+#define OVERFLOW_DROP_NEWEST 1	/* discard the new element */
+#define OVERFLOW_OVERWRITE_OLDEST 2	/* discard the oldest element */
+
+/* Group enqueue: at most MAX_GROUP elements, sent as a header slot
+ * (GROUP_TAG | n) followed by the n elements.  MAX_GROUP + 1 plus
+ * BATCH_SLICE must stay below MIN_QUEUE_SIZE, see enqueue_group(). */
+#define MAX_GROUP 64
+#define GROUP_TAG (1UL << 63)
+#define GROUP_INVALID -3
+
+/* Spill file reserved by default: 1 GB of address space. */
+#define DEFAULT_SPILL_SIZE (1UL << 30)
+/* The spill file is grown in chunks of this size. */
+#define SPILL_CHUNK (64UL << 20)
+
+/* Overflow area used once the ring has reached MAX_QUEUE_SIZE and is
+ * full.  It is a circular, memory-mapped file: the producer appends at
+ * head, the consumer drains at tail after the ring is empty.  head and
+ * tail count elements and never wrap; the file offset is taken modulo
+ * map_items. */
+struct spill_t {
+	/* Mostly accessed by producer. */
+	uint64_t head __attribute__ ((aligned(128)));
+	uint64_t file_items;		/* elements the file can hold now */
+	uint64_t spilled_bytes;		/* total bytes written to the file */
+	uint64_t spill_events;		/* times the producer started spilling */
+	uint64_t max_lag;		/* largest head - tail seen (elements) */
+	int spilling;
+
+	/* Mostly accessed by consumer. */
+	uint64_t tail __attribute__ ((aligned(128)));
+	uint64_t drained_bytes;
+
+	/* readonly data */
+	ELEMENT_TYPE * map __attribute__ ((aligned(128)));
+	uint64_t map_items;
+	int fd;
+	char path[256];
+};
+
+/* Accessed as one 64-bit word by the CASes of fifo.c: head in the low
+ * 32 bits, queue_size in the high 32 bits.  head is the producer's
+ * frontier; HEAD_LAPPED in it means the frontier has wrapped behind
+ * local_head, i.e. slots at both ends of the ring may be occupied. */
 struct info_t {
 	uint32_t head;
 	uint32_t queue_size;
 };
 
+#define HEAD_LAPPED (1U << 31)	/* above MAX_QUEUE_SIZE */
+#define HEAD_INDEX(h) ((h) & ~HEAD_LAPPED)
+
 struct queue_t {
 	/* Mostly accessed by producer. */
 	uint32_t full_counter __attribute__ ((aligned(128)));
 	long traffic_full;
 	struct info_t info;
-#if defined(BATCHING)
 	uint32_t  local_head;
-#endif
+	struct spill_t * spill;		/* NULL unless queue_spill_init() */
+	uint32_t policy;		/* OVERFLOW_* */
+	uint64_t dropped;		/* elements discarded by the policy */
+	uint64_t enlarges;		/* successful queue_enlarge() calls */
+	/* Wait accounting, in cycles: enqueue_batching_detect() finding
+	 * the probed slot still full, and retries on BUFFER_FULL. */
+	uint64_t detect_cycles;
+	uint64_t detect_waits;
+	uint64_t full_cycles;
 
 	/* Mostly accessed by consumer. */
 	uint32_t empty_counter __attribute__ ((aligned(128)));
 	uint32_t tail;
 	long traffic_empty;
+	/* OVERFLOW_OVERWRITE_OLDEST only: tail index in the low 32 bits,
+	 * lap count in the high 32 bits.  CASed by both sides. */
+	uint64_t ow_tail;
+	/* Shrink statistics, see queue_shrink(). */
+	uint64_t shrink_attempts;
+	uint64_t shrink_success;
+	uint64_t reclaimed_bytes;	/* ring memory returned to the OS */
+	uint64_t empty_cycles;		/* retries on BUFFER_EMPTY */
 
 	/* readonly data */
 	uint64_t start_c __attribute__ ((aligned(128)));
 	uint64_t stop_c;
 	uint64_t penalty;
+	uint32_t wait;			/* WAIT_* strategy, see wait.h */
 
 	/* accessed by both producer and comsumer */
 	ELEMENT_TYPE * data __attribute__ ((aligned(128)));
 
 };
 
-void queue_init(struct queue_t *, uint64_t, uint64_t);
+void queue_init(struct queue_t *, uint64_t, uint64_t, uint32_t);
+void queue_destroy(struct queue_t *);
+int queue_spill_init(struct queue_t *, const char *, uint64_t);
+void queue_spill_destroy(struct queue_t *);
+uint64_t queue_dropped(struct queue_t *);
+uint64_t queue_gap(struct queue_t *, uint64_t *);
+uint64_t queue_occupancy(struct queue_t *);
 int enqueue(struct queue_t *, ELEMENT_TYPE);
+int enqueue_batching(struct queue_t *, ELEMENT_TYPE);
+int enqueue_nobatching(struct queue_t *, ELEMENT_TYPE);
 int dequeue(struct queue_t *, ELEMENT_TYPE *);
-uint32_t distance(struct queue_t *);
+int enqueue_group(struct queue_t *, const ELEMENT_TYPE *, uint32_t);
+int dequeue_group(struct queue_t *, ELEMENT_TYPE *, uint32_t *);
 
 uint64_t rdtsc_bare(void);
 uint64_t rdtscp(void);
 uint64_t rdtsc_barrier(void);
 void wait_ticks(uint64_t);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif
 
@@ -0,0 +1,254 @@
+/*
+ *  fifo_coro.hpp: C++20 coroutine front end of EQueue.
+ *
+ *  co_await q.push(v) and co_await q.pop() are thin awaitables on top of
+ *  enqueue()/dequeue().  A coroutine that finds the queue full (or empty)
+ *  parks itself on the executor of the calling thread, which keeps
+ *  polling the queue on its behalf and resumes the coroutine as soon as
+ *  the counterpart has made progress.  Nothing ever sleeps in the kernel.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_CORO_HPP_
+#define _FIFO_CORO_HPP_
+
+#include <atomic>
+#include <coroutine>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <new>
+#include <stdexcept>
+#include <vector>
+#include "fifo.h"
+
+namespace equeue {
+
+class executor;
+
+/* INC_RELAXED of atomics.h: a counter with a single writer that the
+ * other side of the queue reads. */
+template <typename T>
+static inline void inc_relaxed(T &x)
+{
+	std::atomic_ref<T> a(x);
+	a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+/* Fire-and-forget coroutine type.  The coroutine starts suspended and is
+ * owned by the executor it is spawned on. */
+class task {
+public:
+	struct promise_type {
+		task get_return_object()
+		{
+			return task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+
+	task(task &&o) noexcept : h(o.h) { o.h = nullptr; }
+	~task() { if (h) h.destroy(); }
+
+	task(const task &) = delete;
+	task &operator=(const task &) = delete;
+
+private:
+	explicit task(std::coroutine_handle<promise_type> handle) : h(handle) {}
+	std::coroutine_handle<promise_type> h;
+	friend class executor;
+
+/* INC_RELAXED of atomics.h: a counter with a single writer that the
+ * other side of the queue reads. */
+template <typename T>
+static inline void inc_relaxed(T &x)
+{
+	std::atomic_ref<T> a(x);
+	a.store(a.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+};
+
+/* A coroutine waiting for a queue operation to become possible. */
+struct waiter {
+	enum kind_t { PUSH, POP } kind;
+	struct queue_t *q;
+	ELEMENT_TYPE value;
+	std::coroutine_handle<> h;
+
+	/* Retry the operation; true once it has been carried out. */
+	bool try_complete()
+	{
+		if (kind == PUSH)
+			return enqueue(q, value) == SUCCESS;
+		return dequeue(q, &value) == SUCCESS;
+	}
+};
+
+/* Per-thread run loop.  Runnable coroutines are resumed in FIFO order;
+ * when none is runnable, the parked waiters are polled. */
+class executor {
+public:
+	executor() : prev(tls_current()) { tls_current() = this; }
+	~executor()
+	{
+		tls_current() = prev;
+		for (auto h : owned)
+			h.destroy();
+	}
+
+	executor(const executor &) = delete;
+	executor &operator=(const executor &) = delete;
+
+	static executor *current() { return tls_current(); }
+
+	void spawn(task t)
+	{
+		owned.push_back(t.h);
+		ready.push_back(t.h);
+		t.h = nullptr;
+	}
+
+	void park(waiter *w) { parked.push_back(w); }
+
+	/* Run until every spawned coroutine has finished. */
+	void run()
+	{
+		for (;;) {
+			while (!ready.empty()) {
+				std::coroutine_handle<> h = ready.front();
+				ready.pop_front();
+				h.resume();
+			}
+			if (parked.empty())
+				break;
+			poll_parked();
+		}
+	}
+
+	uint64_t polls = 0;
+	uint64_t wakeups = 0;
+
+private:
+	void poll_parked()
+	{
+		size_t i, j;
+		for (i = j = 0; i < parked.size(); i++) {
+			waiter *w = parked[i];
+			if (w->try_complete()) {
+				ready.push_back(w->h);
+				wakeups++;
+			} else {
+				parked[j++] = w;
+			}
+		}
+		parked.resize(j);
+		polls++;
+		if (ready.empty())
+			__builtin_ia32_pause();
+	}
+
+	static executor *&tls_current()
+	{
+		static thread_local executor *cur = nullptr;
+		return cur;
+	}
+
+	executor *prev;
+	std::deque<std::coroutine_handle<>> ready;
+	std::vector<waiter *> parked;
+	std::vector<std::coroutine_handle<>> owned;
+};
+
+/* Awaitable returned by queue::push() and queue::pop(). */
+class queue_op {
+public:
+	queue_op(waiter::kind_t kind, struct queue_t *q, ELEMENT_TYPE value)
+	{
+		w.kind = kind;
+		w.q = q;
+		w.value = value;
+	}
+
+	bool await_ready() { return w.try_complete(); }
+
+	void await_suspend(std::coroutine_handle<> h)
+	{
+		executor *ex = executor::current();
+
+		if (ex == nullptr)
+			throw std::logic_error("queue operation awaited outside an executor");
+		/* Same bookkeeping as producer()/consumer() in main.c; the
+		 * traffic counters drive the adaptive queue size. */
+		if (w.kind == waiter::PUSH) {
+			inc_relaxed(w.q->full_counter);
+			inc_relaxed(w.q->traffic_full);
+		} else {
+			w.q->empty_counter ++;
+			inc_relaxed(w.q->traffic_empty);
+		}
+		w.h = h;
+		ex->park(&w);
+	}
+
+	ELEMENT_TYPE await_resume() { return w.value; }
+
+private:
+	waiter w;
+};
+
+/* Owning wrapper of one single-producer/single-consumer EQueue.
+ * Elements must be non-zero, as with enqueue(). */
+class queue {
+public:
+	explicit queue(uint64_t queue_size = DEFAULT_QUEUE_SIZE,
+			uint64_t penalty = DEFAULT_PENALTY,
+			uint32_t policy = OVERFLOW_BLOCK)
+	{
+		q = static_cast<struct queue_t *>(
+				std::aligned_alloc(128, sizeof(struct queue_t)));
+		if (q == nullptr)
+			throw std::bad_alloc();
+		queue_init(q, queue_size, penalty, policy);
+	}
+	~queue()
+	{
+		queue_destroy(q);
+		std::free(q);
+	}
+
+	queue(const queue &) = delete;
+	queue &operator=(const queue &) = delete;
+
+	queue_op push(ELEMENT_TYPE v) { return queue_op(waiter::PUSH, q, v); }
+	queue_op pop() { return queue_op(waiter::POP, q, 0); }
+
+	bool try_push(ELEMENT_TYPE v) { return enqueue(q, v) == SUCCESS; }
+	bool try_pop(ELEMENT_TYPE &v) { return dequeue(q, &v) == SUCCESS; }
+
+	struct queue_t *raw() { return q; }
+
+private:
+	struct queue_t *q;
+};
+
+} /* namespace equeue */
+
+#endif
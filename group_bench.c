@@ -0,0 +1,221 @@
+/*
+ *  group_bench.c: Cost of all-or-nothing group enqueue (enqueue_group())
+ *  against sending the same elements one by one, for groups of 2-64
+ *  elements.
+ *
+ *  The elements are a running counter.  With groups the consumer checks
+ *  that every dequeue_group() returns a whole group in order; a torn
+ *  group would show up in the "torn" column.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "fifo.h"
+#include "tsc.h"
+#include "wait.h"
+
+#define DEFAULT_TEST_SIZE 10000000
+#define MAX_SIZES 16
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static int producer_core = 0;
+static int consumer_core = 1;
+
+static struct queue_t q __attribute__ ((aligned(128)));
+static uint32_t group;		/* elements per message */
+static int grouped;
+static uint64_t torn, order_errors;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static void *consumer(void *arg)
+{
+	ELEMENT_TYPE values[MAX_GROUP], expected = 1;
+	struct wait_state ws;
+	uint64_t got = 0;
+	uint32_t n, k;
+	int ret, flag;
+
+	pin(consumer_core);
+	wait_init(&ws, q.wait);
+	while (got < test_size) {
+		flag = 0;
+		for (;;) {
+			if (grouped)
+				ret = dequeue_group(&q, values, &n);
+			else {
+				ret = dequeue(&q, &values[0]);
+				n = 1;
+			}
+			if (ret == SUCCESS)
+				break;
+			if (flag == 0) {
+				q.empty_counter ++;
+				q.traffic_empty ++;
+				flag = 1;
+			}
+			wait_for(&ws, DEFAULT_PENALTY);
+		}
+		if (flag)
+			wait_reset(&ws);
+		if (grouped && n != group)
+			torn ++;
+		for (k = 0; k < n; k++) {
+			if (values[k] != expected)
+				order_errors ++;
+			expected = values[k] + 1;
+		}
+		got += n;
+	}
+	return NULL;
+}
+
+/* Returns producer cycles per element. */
+static double run(uint32_t g, int as_group)
+{
+	ELEMENT_TYPE values[MAX_GROUP];
+	struct wait_state ws;
+	pthread_t cons;
+	uint64_t i, start;
+	uint32_t k;
+
+	group = g;
+	grouped = as_group;
+	torn = order_errors = 0;
+	queue_init(&q, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY, OVERFLOW_BLOCK);
+	pthread_create(&cons, NULL, consumer, NULL);
+
+	wait_init(&ws, q.wait);
+	start = rdtsc_bare();
+	for (i = 1; i <= test_size; i += g) {
+		for (k = 0; k < g; k++)
+			values[k] = i + k;
+		if (as_group) {
+			while (enqueue_group(&q, values, g) != SUCCESS) {
+				q.full_counter ++;
+				q.traffic_full ++;
+				wait_for(&ws, q.penalty);
+			}
+			continue;
+		}
+		for (k = 0; k < g; k++) {
+			while (enqueue(&q, values[k]) != SUCCESS) {
+				q.full_counter ++;
+				q.traffic_full ++;
+				wait_for(&ws, q.penalty);
+			}
+		}
+	}
+	start = rdtsc_bare() - start;
+	pthread_join(cons, NULL);
+	queue_destroy(&q);
+	return (double)start / test_size;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t sizes[MAX_SIZES] = { 2, 4, 8, 16, 32, 64 };
+	int nr_sizes = 6, opt, k;
+	uint64_t t_single, t_group;
+	double single, grp;
+
+	char * usage =
+		"Usage: group_bench [-t test_size (default: 10,000,000)]\n\
+		[-g group sizes (default: 2,4,8,16,32,64)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:g:a:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'g':
+				nr_sizes = parse_list(optarg, sizes, MAX_SIZES);
+				break;
+			case 'a':
+				producer_core = atoi(optarg);
+				break;
+			case 'b':
+				consumer_core = atoi(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	for (k = 0; k < nr_sizes; k++) {
+		if (sizes[k] < 1 || sizes[k] > MAX_GROUP) {
+			printf("Group sizes must be in [1, %d].\n", MAX_GROUP);
+			exit(-1);
+		}
+	}
+
+	tsc_init();
+	pin(producer_core);
+	printf("%-6s %14s %14s %8s %8s %8s\n", "group", "single/elem",
+			"group/elem", "ratio", "torn", "errors");
+	for (k = 0; k < nr_sizes; k++) {
+		/* Whole groups only. */
+		test_size -= test_size % sizes[k];
+		single = run(sizes[k], 0);
+		t_single = order_errors;
+		grp = run(sizes[k], 1);
+		t_group = order_errors;
+		printf("%-6lu %14.1f %14.1f %7.2fx %8lu %8lu\n", sizes[k],
+				tsc_out(single), tsc_out(grp),
+				grp > 0 ? single / grp : 0.0, torn, t_single + t_group);
+	}
+	printf("Producer time per element in %s.\n", tsc_unit());
+	return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ *  jsq_bench.c: Join-shortest-queue against round-robin dispatch from
+ *  one producer to consumers of unequal speed.
+ *
+ *  A two-stage pipeline: the source stamps every element with the TSC
+ *  and dispatches it to one of N consumers, consumer i spending
+ *  workload[i] cycles per element.  Each policy is run in turn and the
+ *  throughput, the share of elements every consumer took and the
+ *  dispatch-to-completion latency are reported.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pipeline.h"
+#include "latency.h"
+#include "tsc.h"
+
+#define DEFAULT_TEST_SIZE 2000000
+
+struct consumer_arg {
+	uint64_t workload;
+	struct latency_hist lat;
+} __attribute__ ((aligned(128)));
+
+static struct consumer_arg consumers[MAX_STAGE_WORKERS];
+
+static ELEMENT_TYPE source_fn(ELEMENT_TYPE seq, void *arg)
+{
+	return rdtsc_bare();
+}
+
+static ELEMENT_TYPE consumer_fn(ELEMENT_TYPE v, void *arg)
+{
+	struct consumer_arg *c = (struct consumer_arg *)arg;
+
+	if (c->workload)
+		wait_ticks(c->workload);
+	latency_record(&c->lat, tsc_sub_overhead(rdtsc_bare() - v));
+	return 0;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+static int run_one(uint32_t dispatch, uint32_t nr, uint64_t *cores,
+		int nr_cores, uint64_t test_size, uint64_t queue_size)
+{
+	struct stage_desc stages[2];
+	struct latency_hist all;
+	struct pipeline_t *p;
+	uint32_t i, k;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	memset(stages, 0, sizeof(stages));
+	stages[0].name = "source";
+	stages[0].fn = source_fn;
+	stages[0].parallelism = 1;
+	stages[0].dispatch = dispatch;
+	stages[0].cores[0] = nr_cores ? (int)cores[0] : 0;
+	stages[1].name = "consumers";
+	stages[1].fn = consumer_fn;
+	stages[1].parallelism = nr;
+	for (i = 0; i < nr; i++) {
+		memset(&consumers[i].lat, 0, sizeof(consumers[i].lat));
+		stages[1].worker_arg[i] = &consumers[i];
+		stages[1].cores[i] = nr_cores ?
+			(int)cores[(i + 1) % nr_cores] : (i + 1) % ncpu;
+	}
+
+	p = pipeline_create(stages, 2, queue_size, DEFAULT_PENALTY);
+	if (p == NULL)
+		return -1;
+	if (pipeline_run(p, test_size) != 0) {
+		pipeline_destroy(p);
+		return -1;
+	}
+
+	memset(&all, 0, sizeof(all));
+	printf("%-4s %8.3f Mitems/s ", dispatch == PIPE_DISPATCH_JSQ ? "jsq" : "rr",
+			p->run_ns ? test_size * 1e3 / p->run_ns : 0.0);
+	printf("share:");
+	for (i = 0; i < nr; i++) {
+		struct latency_hist *l = &consumers[i].lat;
+
+		printf(" %5.1f%%", 100.0 * p->workers[1][i].items_in / test_size);
+		all.count += l->count;
+		all.sum += l->sum;
+		if (l->max > all.max)
+			all.max = l->max;
+		for (k = 0; k < sizeof(all.hist) / sizeof(all.hist[0]); k++)
+			all.hist[k] += l->hist[k];
+	}
+	printf("  latency avg %.0f p99 %.0f max %.0f %s\n",
+			tsc_out(latency_avg(&all)),
+			tsc_out(latency_percentile(&all, 99)),
+			tsc_out(all.max), tsc_unit());
+
+	pipeline_destroy(p);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t test_size = DEFAULT_TEST_SIZE;
+	uint64_t queue_size = DEFAULT_QUEUE_SIZE;
+	uint64_t work[MAX_STAGE_WORKERS], cores[MAX_STAGE_WORKERS + 1];
+	int nr_work = 0, nr_cores = 0, opt, k;
+	uint32_t i, policies[2] = { PIPE_DISPATCH_RR, PIPE_DISPATCH_JSQ };
+	uint32_t nr_policies = 2;
+
+	char * usage =
+		"Usage: jsq_bench [-t test_size (default: 2,000,000)]\n\
+		[-w workload per consumer, e.g. 100,100,400,800 (default: 100,400)]\n\
+		[-D policy: rr, jsq (default: both)]\n\
+		[-C cores, producer first, e.g. 0,2,4,6 (default: spread over online CPUs)]\n\
+		[-q queue_size  (default: 1024*2 )]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:w:D:C:q:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'w':
+				nr_work = parse_list(optarg, work, MAX_STAGE_WORKERS);
+				break;
+			case 'D':
+				nr_policies = 1;
+				if (strcmp(optarg, "rr") == 0)
+					policies[0] = PIPE_DISPATCH_RR;
+				else if (strcmp(optarg, "jsq") == 0)
+					policies[0] = PIPE_DISPATCH_JSQ;
+				else {
+					printf("Error: unknown dispatch policy \"%s\".\n", optarg);
+					exit(-1);
+				}
+				break;
+			case 'C':
+				nr_cores = parse_list(optarg, cores, MAX_STAGE_WORKERS + 1);
+				break;
+			case 'q':
+				queue_size = atoll(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (nr_work == 0) {
+		work[0] = 100;
+		work[1] = 400;
+		nr_work = 2;
+	}
+
+	tsc_init();
+	printf("===== %d consumers, workload:", nr_work);
+	for (k = 0; k < nr_work; k++) {
+		consumers[k].workload = work[k];
+		printf(" %lu", work[k]);
+	}
+	printf(" cycles, %lu items =====\n", test_size);
+
+	for (i = 0; i < nr_policies; i++)
+		if (run_one(policies[i], nr_work, cores, nr_cores,
+					test_size, queue_size) != 0)
+			return -1;
+	return 0;
+}
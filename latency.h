@@ -0,0 +1,63 @@
+/*
+ *  latency.h: Log2-bucketed latency histogram used by the benchmarks.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_LATENCY_H_
+#define _FIFO_LATENCY_H_
+
+#include <stdint.h>
+
+struct latency_hist {
+	uint64_t count;
+	uint64_t sum;
+	uint64_t max;
+	uint64_t hist[65];	/* hist[k]: latency in [2^(k-1), 2^k) */
+};
+
+static inline void latency_record(struct latency_hist *l, uint64_t cycles)
+{
+	l->count ++;
+	l->sum += cycles;
+	if (cycles > l->max)
+		l->max = cycles;
+	l->hist[cycles ? 64 - __builtin_clzl(cycles) : 0] ++;
+}
+
+/* Upper bound of the bucket holding the given percentile. */
+static inline uint64_t latency_percentile(struct latency_hist *l, double pct)
+{
+	uint64_t seen = 0, target = (uint64_t)(l->count * pct / 100.0);
+	int k;
+
+	for (k = 0; k < 64; k++) {
+		seen += l->hist[k];
+		if (seen > target) {
+			uint64_t bound = k ? (1UL << k) - 1 : 0;
+			return bound < l->max ? bound : l->max;
+		}
+	}
+	return l->max;
+}
+
+static inline uint64_t latency_avg(struct latency_hist *l)
+{
+	return l->count ? l->sum / l->count : 0;
+}
+
+#endif
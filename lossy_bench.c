@@ -0,0 +1,231 @@
+/*
+ *  lossy_bench.c: Producer cost of the three overflow policies against
+ *  consumers of increasing slowness.
+ *
+ *  The producer enqueues sequence numbers as fast as it can.  The
+ *  consumer spends `workload' cycles per element and checks the
+ *  sequence: a jump is a gap, a step back is an ordering error.  At the
+ *  end the gaps seen by the consumer must equal queue_dropped().
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "fifo.h"
+#include "latency.h"
+#include "tsc.h"
+
+#define DEFAULT_TEST_SIZE 2000000
+
+static const char *policy_name[] = { "block", "drop-newest", "overwrite-oldest" };
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t queue_size = DEFAULT_QUEUE_SIZE;
+static uint64_t workload;
+static uint64_t burst;		/* 0: continuous */
+static int producer_core = 0;
+static int consumer_core = 1;
+
+static struct queue_t q __attribute__ ((aligned(128)));
+static volatile int producer_done;
+static struct latency_hist lat;
+static uint64_t producer_cycles;
+static uint64_t consumed, gaps, gap_events, errors;
+static int resized;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static void *consumer(void *arg)
+{
+	ELEMENT_TYPE value, expected = 1;
+	uint64_t seen = 0;
+	int flag = 0;
+
+	pin(consumer_core);
+	for (;;) {
+		if (dequeue(&q, &value) != SUCCESS) {
+			/* Check done first: an element may land in between. */
+			if (producer_done) {
+				if (dequeue(&q, &value) != SUCCESS)
+					break;
+				goto got;
+			}
+			if (flag == 0) {
+				q.empty_counter ++;
+				q.traffic_empty ++;
+				flag = 1;
+			}
+			continue;
+		}
+got:
+		flag = 0;
+		if (queue_gap(&q, &seen))
+			gap_events ++;
+		if (value < expected)
+			errors ++;
+		else
+			gaps += value - expected;
+		expected = value + 1;
+		consumed ++;
+		if (workload)
+			wait_ticks(workload);
+	}
+	gaps += test_size + 1 - expected;	/* dropped at the very end */
+	return NULL;
+}
+
+static void *producer(void *arg)
+{
+	uint64_t i, start, t;
+	int flag;
+
+	pin(producer_core);
+	start = rdtsc_bare();
+	for (i = 1; i <= test_size; i++) {
+		t = rdtsc_bare();
+		flag = 0;
+		while (enqueue(&q, (ELEMENT_TYPE)i) != SUCCESS) {
+			if (flag == 0) {
+				q.full_counter ++;
+				q.traffic_full ++;
+				flag = 1;
+			}
+			wait_ticks(q.penalty);
+		}
+		latency_record(&lat, tsc_sub_overhead(rdtsc_bare() - t));
+		/* Long enough a pause for the consumer to drain the burst. */
+		if (burst && (i % burst) == 0)
+			wait_ticks((workload + 20) * burst);
+	}
+	producer_cycles = rdtsc_bare() - start;
+	producer_done = 1;
+	return NULL;
+}
+
+static void run(uint32_t policy)
+{
+	pthread_t prod, cons;
+
+	memset(&lat, 0, sizeof(lat));
+	consumed = gaps = gap_events = errors = 0;
+	producer_done = 0;
+	queue_init(&q, queue_size, DEFAULT_PENALTY, policy);
+
+	pthread_create(&cons, NULL, consumer, NULL);
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	printf("%-17s %8lu %10.0f %8.0f %10.0f %10lu %10lu %10lu %10lu %6lu %7u\n",
+			policy_name[policy], workload,
+			tsc_out(producer_cycles / test_size),
+			tsc_out(latency_percentile(&lat, 99)), tsc_out(lat.max), consumed, queue_dropped(&q), gaps, gap_events,
+			errors, q.info.queue_size);
+	/* Lossy queues must keep their initial size. */
+	if (policy != OVERFLOW_BLOCK && q.info.queue_size != queue_size) {
+		printf("Error: %s queue resized from %lu to %u.\n",
+				policy_name[policy], queue_size, q.info.queue_size);
+		resized ++;
+	}
+
+	queue_destroy(&q);
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t workloads[] = { 0, 100, 400, 1600 };
+	uint64_t one_workload = 0;
+	int opt, only = -1, fixed = 0;
+	uint32_t p, w;
+
+	char * usage =
+		"Usage: lossy_bench [-t test_size (default: 2,000,000)]\n\
+		[-q queue_size  (default: 1024*2 )]\n\
+		[-w consumer workload (default: sweep 0, 100, 400, 1600 cycles)]\n\
+		[-r burst: pause after every burst items until it is drained (default: 0, no pause)]\n\
+		[-P policy (0: block, 1: drop-newest, 2: overwrite-oldest. default: all)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:q:w:r:P:a:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'q':
+				queue_size = atoll(optarg);
+				break;
+			case 'w':
+				one_workload = atoll(optarg);
+				fixed = 1;
+				break;
+			case 'r':
+				burst = atoll(optarg);
+				break;
+			case 'P':
+				only = atoi(optarg);
+				break;
+			case 'a':
+				producer_core = atoi(optarg);
+				break;
+			case 'b':
+				consumer_core = atoi(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+	tsc_init();
+	printf("Times in %s; workload in cycles.\n", tsc_unit());
+	printf("%-17s %8s %10s %8s %10s %10s %10s %10s %10s %6s %7s\n",
+			"policy", "workload", "per op", "p99", "max",
+			"consumed", "dropped", "gaps", "gap_events", "errors", "size");
+	for (p = OVERFLOW_BLOCK; p <= OVERFLOW_OVERWRITE_OLDEST; p++) {
+		if (only >= 0 && (uint32_t)only != p)
+			continue;
+		for (w = 0; w < sizeof(workloads) / sizeof(workloads[0]); w++) {
+			workload = fixed ? one_workload : workloads[w];
+			run(p);
+			if (fixed)
+				break;
+		}
+	}
+
+	return resized ? 1 : 0;
+}
@@ -0,0 +1,107 @@
+/*
+ *  lt_cas.h: Less-Than Compare-And-Swap (LT-CAS) on 16, 32 and 64-bit
+ *  words.
+ *
+ *  lt_casN(ptr, shift, old, new) compares and swaps only the bits of
+ *  *ptr at and above bit `shift'.  The bits below `shift' are neither
+ *  compared nor modified, so another thread may keep changing them.
+ *  When those low bits hold a counter, requiring the high part of the
+ *  counter to be zero turns the comparison into "counter < 2^shift":
+ *
+ *      word = queue_size << 32 | head
+ *      lt_cas64(&word, k, qs << 32, (qs >> 1) << 32)
+ *
+ *  halves queue_size if it is still qs and head < 2^k, whatever head
+ *  actually is.
+ *
+ *  If the high part is a whole naturally aligned byte, half-word or
+ *  word, LT-CAS is a single hardware CAS on that sub-word (the trick in
+ *  CAS_range.c).  Otherwise it is a CAS loop on the full word that only
+ *  retries when the low bits moved in between.
+ *
+ *  Memory ordering: acquire-release on success, acquire on failure.
+ *  Returns 1 on success, 0 on failure.  Little-endian only.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _LT_CAS_H_
+#define _LT_CAS_H_
+
+#include <stdint.h>
+
+#if __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "lt_cas.h assumes a little-endian machine"
+#endif
+
+/* Sub-words of a word are accessed through these. */
+typedef uint8_t __attribute__ ((may_alias)) lt_u8;
+typedef uint16_t __attribute__ ((may_alias)) lt_u16;
+typedef uint32_t __attribute__ ((may_alias)) lt_u32;
+
+#define LT_CAS_ORDER __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE
+
+/* Hardware CAS on the high (bits - shift) bits, which start at byte
+ * shift / 8. */
+#define LT_CAS_SUBWORD(type, ptr, shift, oldv, newv) ({			\
+	type *__p = (type *)((char *)(ptr) + (shift) / 8);		\
+	type __o = (type)((oldv) >> (shift));				\
+	__atomic_compare_exchange_n(__p, &__o, (type)((newv) >> (shift)),	\
+			0, LT_CAS_ORDER);					\
+})
+
+#define LT_CAS_DEFINE(bits)						\
+static inline int lt_cas##bits(uint##bits##_t *ptr, unsigned shift,	\
+		uint##bits##_t oldv, uint##bits##_t newv)		\
+{									\
+	uint##bits##_t cur, low;					\
+	unsigned width = bits - shift;					\
+									\
+	if (shift == 0)							\
+		return __atomic_compare_exchange_n(ptr, &oldv, newv,	\
+				0, LT_CAS_ORDER);			\
+	if (shift >= bits)						\
+		return 0;						\
+	if (width == 8)							\
+		return LT_CAS_SUBWORD(lt_u8, ptr, shift, oldv, newv);	\
+	if (width == 16 && bits > 16)					\
+		return LT_CAS_SUBWORD(lt_u16, ptr, shift, oldv, newv);	\
+	if (width == 32 && bits > 32)					\
+		return LT_CAS_SUBWORD(lt_u32, ptr, shift, oldv, newv);	\
+									\
+	low = ((uint##bits##_t)1 << shift) - 1;				\
+	cur = __atomic_load_n(ptr, __ATOMIC_ACQUIRE);			\
+	do {								\
+		if ((cur & ~low) != (oldv & ~low))			\
+			return 0;					\
+	} while (!__atomic_compare_exchange_n(ptr, &cur,		\
+				(newv & ~low) | (cur & low), 0, LT_CAS_ORDER));	\
+	return 1;							\
+}
+
+LT_CAS_DEFINE(16)
+LT_CAS_DEFINE(32)
+LT_CAS_DEFINE(64)
+
+/* Largest k such that 2^k <= bound, i.e. "x < 2^k" implies
+ * "x < bound".  bound must be nonzero. */
+static inline unsigned lt_cas_shift(uint64_t bound)
+{
+	return 63 - __builtin_clzl(bound);
+}
+
+#endif
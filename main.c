@@ -26,10 +26,19 @@
 #include <sched.h>
 #include <string.h>
 #include <poll.h>
+#include <signal.h>
+#include <time.h>
 #include "fifo.h"
-
-#if defined(FIFO_DEBUG)
-#include <assert.h>
+#include "perf.h"
+#include "tsc.h"
+#include "wait.h"
+#include "noise.h"
+#include "work.h"
+#include "stats.h"
+#include "latency.h"
+#include "atomics.h"
+#if defined(PRIO_LANES)
+#include "pqueue.h"
 #endif
 
 #define DEFAULT_TEST_SIZE 20000000
@@ -41,6 +50,28 @@ extern struct queue_t queues[];
 static uint64_t test_size;
 uint64_t workload = 170;
 uint64_t burst = 1024UL;
+/* -K: the consumer's per-item work; WORK_SPIN is wait_ticks(workload). */
+static uint32_t work_kind = WORK_SPIN;
+static uint64_t work_size = DEFAULT_WORK_SIZE;
+static struct work_state work[MAX_CORE_NUM];
+/* Per-thread accounting of the current run, for the efficiency report
+ * at its end and, on SIGUSR1, while it runs. */
+struct thread_acct {
+	uint64_t start_c __attribute__ ((aligned(128)));	/* producer only */
+	uint64_t cycles;		/* of the measured loop */
+	uint64_t cpu_ns;		/* thread CPU time of the loop, once done */
+	uint64_t cpu_start_ns;
+	clockid_t clock;
+	uint64_t progress;		/* items so far; consumer only */
+	volatile int done;
+};
+static struct thread_acct acct_p[MAX_CORE_NUM], acct_c[MAX_CORE_NUM];
+#define PROGRESS_STEP 4096
+/* Queues of the run in progress; 0 between runs. */
+static volatile int run_queues;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+/* -e: collect hardware performance counters around the measured loops. */
+static int perf_enabled;
 
 struct init_info {
 	uint32_t cpu_id;
@@ -50,7 +81,54 @@ struct init_info {
 struct init_info info_producer[MAX_CORE_NUM];
 struct init_info info_consumer[MAX_CORE_NUM];
 
+#if defined(PRIO_LANES)
+struct pqueue_t pqueues[MAX_CORE_NUM];
+static uint32_t nr_lanes = 2;
+static uint32_t drain_mode = PQ_STRICT;
+/* Every ctrl_rate-th item is a control message sent on lane 0. */
+static uint64_t ctrl_rate = 1024UL;
+
+/* Per-lane end-to-end latency (e2e variants).  Items carry their
+ * enqueue TSC. */
+struct latency_hist lane_lat[MAX_CORE_NUM][MAX_LANES];
+#endif
+
+/* Behavior variants, formerly the -D flags named in brackets.  Each of
+ * the NR_VARIANTS combinations is compiled into its own copy of the
+ * producer and consumer loops (see VARIANT() below), so the hot loops
+ * carry no tests of the flags.  -V picks one or more at run time. */
+#define V_BATCHING 0x1	/* BATCHING: enqueue_batching() */
+#define V_BURST 0x2	/* SIMULATE_BURST: bursty producer, consumer workload */
+#define V_E2E 0x4	/* E2ELATENCY: end-to-end latency samples */
+#define V_DEBUG 0x8	/* FIFO_DEBUG: check the order of dequeued items */
+#define NR_VARIANTS 16
+
+static const char *variant_flag_name[] = { "batching", "burst", "e2e", "debug" };
+
+/* The variant run when -V is not given follows the Makefile flags. */
+static const uint32_t default_variant = 0
+#if defined(BATCHING)
+	| V_BATCHING
+#endif
+#if defined(SIMULATE_BURST)
+	| V_BURST
+#endif
 #if defined(E2ELATENCY)
+	| V_E2E
+#endif
+#if defined(FIFO_DEBUG)
+	| V_DEBUG
+#endif
+	;
+
+/* -R: run producers and consumers with SCHED_FIFO (RT_SCHEDULE). */
+#if defined(RT_SCHEDULE)
+static int rt_schedule = 1;
+#else
+static int rt_schedule = 0;
+#endif
+
+#if !defined(PRIO_LANES)
 struct e2e_info {
 	uint64_t tsc;
 	uint32_t distance;
@@ -62,19 +140,6 @@ static uint64_t e2e_sample_rate = 10000000UL;
 static uint64_t e2e_sample_set_size;
 static uint32_t e2e_sample_power_2;
 
-uint32_t distance(struct queue_t * q)
-{
-	uint32_t head = READ_ONCE(q->info.head);
-	uint32_t tail = READ_ONCE(q->tail);
-	uint32_t qsize = READ_ONCE(q->info.queue_size);
-
-	uint32_t rst = head >= tail? (head - tail) : (head + qsize - tail);
-	if (rst != 0)
-		printf("distance: %d. head: %d, tail: %ld\n",
-				rst, q->info.head, q->tail);
-	return rst;
-}
-
 #endif
 
 inline uint64_t max(uint64_t a, uint64_t b)
@@ -82,56 +147,77 @@ inline uint64_t max(uint64_t a, uint64_t b)
 	return (a > b) ? a : b;
 }
 
-void * consumer(void *arg)
+static int set_rt_schedule(void)
 {
-	uint32_t     cpu_id;
-	ELEMENT_TYPE value;
-	cpu_set_t    cur_mask;
-	uint64_t     i;
-
-#if defined(FIFO_DEBUG)
-	ELEMENT_TYPE	old_value = 0; 
-#endif
-
-	struct init_info * init = (struct init_info *) arg;
-	cpu_id = init->cpu_id;
-	pthread_barrier_t *barrier = init->barrier;
-
-	CPU_ZERO(&cur_mask);
-	CPU_SET(consumerAffinity[cpu_id], &cur_mask);
-	printf("consumer %d:  ---%d----\n", cpu_id, consumerAffinity[cpu_id]);
-	if (sched_setaffinity(0, sizeof(cur_mask), &cur_mask) < 0) {
-		printf("Error: sched_setaffinity for consumer %d\n", cpu_id);
-		return NULL;
-	}
-
-#if defined(RT_SCHEDULE)
 	struct sched_param param;
-	param.sched_priority = 99;
 	int err;
+
+	param.sched_priority = 99;
 	if ( (err = sched_setscheduler(0, SCHED_FIFO, &param)) != 0) {
 		printf("Error: sched_setscheduler. %d, %s\n", err, strerror(err));
-		return NULL;
+		return -1;
 	}
-#endif
+	return 0;
+}
 
-	printf("Consumer %d created...\n", cpu_id);
-	//pthread_barrier_wait(barrier);
+/* Measured loop of the consumer.  `v' is a constant in every
+ * instantiation, so the untaken variant branches are compiled out. */
+static inline __attribute__((always_inline))
+void consume_loop(uint32_t cpu_id, const uint32_t v)
+{
+	ELEMENT_TYPE value;
+	uint64_t     i;
+#if defined(PRIO_LANES)
+	uint32_t	lane;
+	ELEMENT_TYPE	old_lane_value[MAX_LANES] = { 0 };
+#else
+	ELEMENT_TYPE	old_value = 0;
+#endif
+	struct wait_state ws;
+	uint64_t	wait_start = 0;
 
+	wait_init(&ws, queues[cpu_id].wait);
 	queues[cpu_id].start_c = rdtsc_bare();
 
 	for (i = 1; i <= test_size; i++) {
 		int flag = 0;
+
+		/* For reports while running (SIGUSR1). */
+		if ((i & (PROGRESS_STEP - 1)) == 0)
+			STORE_RELAXED(acct_c[cpu_id].progress, i);
+#if defined(PRIO_LANES)
+		while( pqueue_dequeue(&pqueues[cpu_id], &value, &lane) != 0 ) {
+			if (flag == 0) {
+				queues[cpu_id].empty_counter ++;
+				pqueue_note_empty(&pqueues[cpu_id]);
+				wait_start = rdtsc_bare();
+				flag = 1;
+			}
+			wait_idle(&ws, NULL);
+		}
+		if (flag) {
+			wait_reset(&ws);
+			queues[cpu_id].empty_cycles += rdtsc_bare() - wait_start;
+		}
+		if (v & V_E2E)
+			latency_record(&lane_lat[cpu_id][lane],
+					tsc_sub_overhead(rdtsc_bare() - value));
+#else
 		while( dequeue(&queues[cpu_id], &value) != 0 ) {
 			if (flag == 0) {
 				queues[cpu_id].empty_counter ++;
-				queues[cpu_id].traffic_empty ++;
+				INC_RELAXED(queues[cpu_id].traffic_empty);
+				wait_start = rdtsc_bare();
 				flag = 1;
 			}
+			wait_idle(&ws, &queues[cpu_id].data[queues[cpu_id].tail]);
+		}
+		if (flag) {
+			wait_reset(&ws);
+			queues[cpu_id].empty_cycles += rdtsc_bare() - wait_start;
 		}
 
-#if defined(E2ELATENCY)
-		if (cpu_id == 0) {
+		if ((v & V_E2E) && cpu_id == 0) {
 			if ((i & (e2e_sample_rate - 1)) == 0) {
 				uint32_t pos = (i >> e2e_sample_power_2) - 1;
 				e2e_output_c[ pos ].tsc = rdtsc_bare();
@@ -141,76 +227,89 @@ void * consumer(void *arg)
 		}
 #endif
 
-#if defined(SIMULATE_BURST)
-		wait_ticks(workload);
-#endif
-
-#if defined(FIFO_DEBUG)
-		if((old_value + 1) != value) {
-			printf("!!!ERROR!!! in queue internal \
-					(old_value: %lu, value: %lu)\n",
-					old_value, value);
+		if (v & V_BURST) {
+			if (work_kind == WORK_SPIN)
+				wait_ticks(workload);
+			else
+				work_run(&work[cpu_id], value);
 		}
 
-		old_value = value;
+		if (v & V_DEBUG) {
+#if defined(PRIO_LANES)
+			/* Items carry their enqueue TSC; each lane must stay in order. */
+			if (old_lane_value[lane] > value) {
+				printf("!!!ERROR!!! in lane %u \
+						(old_value: %lu, value: %lu)\n",
+						lane, old_lane_value[lane], value);
+			}
+
+			old_lane_value[lane] = value;
+#else
+			if((old_value + 1) != value) {
+				printf("!!!ERROR!!! in queue internal \
+						(old_value: %lu, value: %lu)\n",
+						old_value, value);
+			}
+
+			old_value = value;
 #endif
+		}
 	}
 	queues[cpu_id].stop_c = rdtsc_bare();
-
-	printf("[Queue: %d: Buffer full: %u (ratio: %f).\
-			Buffer empty: %u (ration: %f)\n", 
-			cpu_id, queues[cpu_id].full_counter, 
-			(double)(queues[cpu_id].full_counter)/test_size, 
-			queues[cpu_id].empty_counter, 
-			(double)(queues[cpu_id].empty_counter)/test_size);
-
-	pthread_exit("consumer exit!");
 }
 
-void * producer(void *arg)
+/* Measured loop of the producer; returns the cycles it took. */
+static inline __attribute__((always_inline))
+uint64_t produce_loop(uint32_t cpu_id, const uint32_t v)
 {
 	uint64_t start_p;
-	uint64_t stop_p;
-	//pthread_barrier_t *barrier = (pthread_barrier_t *)arg;
 	uint64_t	i;
-	cpu_set_t	cur_mask;
-	struct init_info * init = (struct init_info *) arg;
-	uint32_t cpu_id = init->cpu_id;
-	pthread_barrier_t *barrier = init->barrier;
-
-	CPU_ZERO(&cur_mask);
-	CPU_SET(producerAffinity[cpu_id], &cur_mask);
-	printf("producer %d:  ---%d----\n", cpu_id, producerAffinity[cpu_id]);
-	if (sched_setaffinity(0, sizeof(cur_mask), &cur_mask) < 0) {
-		printf("Error: sched_setaffinity for producer %d\n", cpu_id);
-		return NULL;
-	}
-
-#if defined(RT_SCHEDULE)
-	struct sched_param param;
-	param.sched_priority = 99;
-	int err;
-	if ( (err = sched_setscheduler(0, SCHED_FIFO, &param)) != 0) {
-		printf("Error: sched_setscheduleri. %d, %s\n", err, strerror(err));
-		return ;
-	}
-#endif
-
-	printf("Producer %d created...\n", cpu_id);
-	//pthread_barrier_wait(barrier);
+	struct wait_state ws;
+	uint64_t	wait_start = 0, detect_start = 0;
 
+	wait_init(&ws, queues[cpu_id].wait);
 	start_p = rdtsc_bare();
+	acct_p[cpu_id].start_c = start_p;
 
 	for (i = 1; i <= test_size + BATCH_SLICE + 1; i++) {
 		int flag = 0;
-		while ( enqueue(&queues[cpu_id], (ELEMENT_TYPE)i) != 0) {
+#if defined(PRIO_LANES)
+		/* The lanes use enqueue(), i.e. the build-time batching mode. */
+		uint32_t lane = ((i & (ctrl_rate - 1)) == 0) ?
+			0 : 1 + (i % (nr_lanes - 1));
+		while ( pqueue_enqueue(&pqueues[cpu_id], lane, rdtsc_bare()) != 0) {
 			if (flag == 0) {
-				queues[cpu_id].full_counter ++;
-				queues[cpu_id].traffic_full ++;
+				INC_RELAXED(queues[cpu_id].full_counter);
+				pqueue_note_full(&pqueues[cpu_id], lane);
+				wait_start = rdtsc_bare();
 				flag = 1;
 			}
-			wait_ticks(queues[cpu_id].penalty);
+			wait_for(&ws, queues[cpu_id].penalty);
 		}
+		if (flag) {
+			wait_reset(&ws);
+			queues[cpu_id].full_cycles += rdtsc_bare() - wait_start;
+		}
+#else
+		while ( ((v & V_BATCHING) ?
+				enqueue_batching(&queues[cpu_id], (ELEMENT_TYPE)i) :
+				enqueue_nobatching(&queues[cpu_id], (ELEMENT_TYPE)i)) != 0) {
+			if (flag == 0) {
+				INC_RELAXED(queues[cpu_id].full_counter);
+				INC_RELAXED(queues[cpu_id].traffic_full);
+				wait_start = rdtsc_bare();
+				detect_start = queues[cpu_id].detect_cycles;
+				flag = 1;
+			}
+			wait_for(&ws, queues[cpu_id].penalty);
+		}
+		/* The retries' own detect waits are already accounted. */
+		if (flag) {
+			wait_reset(&ws);
+			queues[cpu_id].full_cycles += rdtsc_bare() - wait_start -
+				(queues[cpu_id].detect_cycles - detect_start);
+		}
+#endif
 
 #if defined(INSERT_BUG)
 		if(i==(test_size >> 1)) {
@@ -219,29 +318,302 @@ void * producer(void *arg)
 		}
 #endif
 
-#if defined(E2ELATENCY)
-		if( (i & (e2e_sample_rate - 1)) == 0) {
+#if !defined(PRIO_LANES)
+		if( (v & V_E2E) && (i & (e2e_sample_rate - 1)) == 0) {
 			uint32_t pos = (i >> e2e_sample_power_2) - 1;
-			e2e_output_p[ pos ].distance = distance(&queues[1]);
+			e2e_output_p[ pos ].distance = queue_occupancy(&queues[cpu_id]);
 			e2e_output_p[ pos ].tsc = rdtsc_bare();
 			//printf("iteration %ld, output_p[%u], tsc: %lu, distance: %u\n",
 			//		i, pos, e2e_output_p[pos].tsc, 
 			//		e2e_output_p[pos].distance);
 		}
 #endif
-#if defined(SIMULATE_BURST)
-		if ( (i & (burst - 1)) == 0)
+		if ( (v & V_BURST) && (i & (burst - 1)) == 0)
 			//wait_ticks(workload * burst * (num -1));
 			wait_ticks((workload + 20) * burst);
-#endif
 	}
 
-	stop_p = rdtsc_bare();
-#if defined(SIMULATE_BURST)
-	printf("producer %ld cycles/op\n", (stop_p - start_p) / ((test_size + 1)) - workload);
-#else
-	printf("producer %ld cycles/op\n", (stop_p - start_p) / ((test_size + 1)));
-#endif
+	return rdtsc_bare() - start_p;
+}
+
+struct variant {
+	void (*consume)(uint32_t);
+	uint64_t (*produce)(uint32_t);
+};
+
+#define VARIANT(v)							\
+static void consume_##v(uint32_t cpu_id) { consume_loop(cpu_id, v); }	\
+static uint64_t produce_##v(uint32_t cpu_id) { return produce_loop(cpu_id, v); }
+
+VARIANT(0) VARIANT(1) VARIANT(2) VARIANT(3)
+VARIANT(4) VARIANT(5) VARIANT(6) VARIANT(7)
+VARIANT(8) VARIANT(9) VARIANT(10) VARIANT(11)
+VARIANT(12) VARIANT(13) VARIANT(14) VARIANT(15)
+
+#define V(v) { consume_##v, produce_##v }
+static const struct variant variants[NR_VARIANTS] = {
+	V(0), V(1), V(2), V(3), V(4), V(5), V(6), V(7),
+	V(8), V(9), V(10), V(11), V(12), V(13), V(14), V(15),
+};
+
+/* Variant of the current run. */
+static uint32_t cur_variant;
+
+/* "batching+burst"; "plain" when no flag is set. */
+static const char *variant_name(uint32_t v, char *buf, size_t len)
+{
+	uint32_t k;
+
+	buf[0] = '\0';
+	for (k = 0; k < sizeof(variant_flag_name) / sizeof(variant_flag_name[0]); k++) {
+		if (!(v & (1U << k)))
+			continue;
+		if (buf[0])
+			strncat(buf, "+", len - strlen(buf) - 1);
+		strncat(buf, variant_flag_name[k], len - strlen(buf) - 1);
+	}
+	if (!buf[0])
+		snprintf(buf, len, "plain");
+	return buf;
+}
+
+/* Parse "batching+burst,plain,..." into list; returns the number of
+ * variants or -1 on an unknown name. */
+static int parse_variants(char *arg, uint32_t *list, int max)
+{
+	char *item, *flag, *save_item, *save_flag;
+	uint32_t v, k;
+	int n = 0;
+
+	for (item = strtok_r(arg, ",", &save_item); item && n < max;
+			item = strtok_r(NULL, ",", &save_item)) {
+		v = 0;
+		for (flag = strtok_r(item, "+", &save_flag); flag;
+				flag = strtok_r(NULL, "+", &save_flag)) {
+			if (strcmp(flag, "plain") == 0)
+				continue;
+			for (k = 0; k < sizeof(variant_flag_name) / sizeof(variant_flag_name[0]); k++)
+				if (strcmp(flag, variant_flag_name[k]) == 0)
+					break;
+			if (k == sizeof(variant_flag_name) / sizeof(variant_flag_name[0])) {
+				printf("Error: unknown variant flag \"%s\".\n", flag);
+				return -1;
+			}
+			v |= 1U << k;
+		}
+		list[n++] = v;
+	}
+	return n;
+}
+
+static uint64_t clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+
+	if (clock_gettime(clock, &ts) != 0)
+		return 0;
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static void acct_start(struct thread_acct *a)
+{
+	if (pthread_getcpuclockid(pthread_self(), &a->clock) != 0)
+		a->clock = CLOCK_THREAD_CPUTIME_ID;
+	a->cpu_start_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+static void acct_stop(struct thread_acct *a)
+{
+	a->cpu_ns = clock_ns(CLOCK_THREAD_CPUTIME_ID) - a->cpu_start_ns;
+	a->done = 1;
+}
+
+/* CPU time of a thread's loop so far; its final value once done. */
+static double acct_cpu_s(struct thread_acct *a)
+{
+	uint64_t now;
+
+	if (a->done)
+		return a->cpu_ns / 1e9;
+	now = clock_ns(a->clock);
+	return now > a->cpu_start_ns ? (now - a->cpu_start_ns) / 1e9 : 0;
+}
+
+static double share(uint64_t part, uint64_t whole)
+{
+	return whole ? 100.0 * part / whole : 0.0;
+}
+
+/* Where each thread's time went: the wait sites accounted in the queue,
+ * the rest (useful work, including the workload) and the CPU time it
+ * was charged, and items per CPU-second.  With live set the run is
+ * still going and the numbers are those so far. */
+static void report_efficiency(int nr, int live)
+{
+	uint64_t now = rdtsc_bare(), wall, waits, items;
+	struct queue_t *q;
+	double cpu;
+	int i;
+
+	for (i = 0; i < nr; i++) {
+		q = &queues[i];
+		items = live ? LOAD_RELAXED(acct_c[i].progress) : test_size;
+
+		/* A thread whose loop has not started (or, once the run is
+		 * over, never ran, e.g. it could not be pinned) has no
+		 * stamps to measure from. */
+		if (live ? acct_p[i].start_c == 0 : !acct_p[i].done)
+			printf("queue %d producer: n/a\n", i);
+		else {
+			wall = acct_p[i].done ? acct_p[i].cycles : now - acct_p[i].start_c;
+			waits = q->detect_cycles + q->full_cycles;
+			cpu = acct_cpu_s(&acct_p[i]);
+			printf("queue %d producer: CPU %.3f s (%.0f%% of %.3f s), detect %.1f%% "
+					"(%lu waits), full %.1f%%, useful %.1f%%, %.2f Mitems/CPU-s\n",
+					i, cpu, share(cpu * 1e9, tsc_to_ns(wall)), tsc_to_ns(wall) / 1e9,
+					share(q->detect_cycles, wall), q->detect_waits,
+					share(q->full_cycles, wall),
+					waits < wall ? share(wall - waits, wall) : 0.0,
+					cpu > 0 ? items / cpu / 1e6 : 0.0);
+		}
+
+		if (live ? q->start_c == 0 : !acct_c[i].done)
+			printf("queue %d consumer: n/a\n", i);
+		else {
+			wall = acct_c[i].done ? acct_c[i].cycles : now - q->start_c;
+			cpu = acct_cpu_s(&acct_c[i]);
+			printf("queue %d consumer: CPU %.3f s (%.0f%% of %.3f s), empty %.1f%%, "
+					"useful %.1f%%, %.2f Mitems/CPU-s\n",
+					i, cpu, share(cpu * 1e9, tsc_to_ns(wall)), tsc_to_ns(wall) / 1e9,
+					share(q->empty_cycles, wall),
+					q->empty_cycles < wall ? share(wall - q->empty_cycles, wall) : 0.0,
+					cpu > 0 ? items / cpu / 1e6 : 0.0);
+		}
+	}
+}
+
+/* Prints the efficiency of the run in progress on every SIGUSR1, and
+ * exits on SIGUSR2.  Both are blocked in every other thread. */
+static void *monitor(void *arg)
+{
+	sigset_t set;
+	int sig;
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2);
+	while (sigwait(&set, &sig) == 0 && sig == SIGUSR1) {
+		pthread_mutex_lock(&report_lock);
+		if (run_queues) {
+			printf("===== Efficiency so far =====\n");
+			report_efficiency(run_queues, 1);
+		}
+		pthread_mutex_unlock(&report_lock);
+	}
+	return NULL;
+}
+
+void * consumer(void *arg)
+{
+	uint32_t     cpu_id;
+	cpu_set_t    cur_mask;
+	struct perf_counters pc;
+	char         who[32];
+	uint32_t     full;
+
+	struct init_info * init = (struct init_info *) arg;
+	cpu_id = init->cpu_id;
+	pthread_barrier_t *barrier = init->barrier;
+
+	CPU_ZERO(&cur_mask);
+	CPU_SET(consumerAffinity[cpu_id], &cur_mask);
+	printf("consumer %d:  ---%d----\n", cpu_id, consumerAffinity[cpu_id]);
+	if (sched_setaffinity(0, sizeof(cur_mask), &cur_mask) < 0) {
+		printf("Error: sched_setaffinity for consumer %d\n", cpu_id);
+		return NULL;
+	}
+
+	if (rt_schedule && set_rt_schedule() != 0)
+		return NULL;
+
+	printf("Consumer %d created...\n", cpu_id);
+	//pthread_barrier_wait(barrier);
+
+	if (perf_enabled && perf_open(&pc) > 0)
+		perf_start(&pc);
+
+	acct_start(&acct_c[cpu_id]);
+	variants[cur_variant].consume(cpu_id);
+	acct_c[cpu_id].cycles = queues[cpu_id].stop_c - queues[cpu_id].start_c;
+	acct_stop(&acct_c[cpu_id]);
+
+	if (perf_enabled && pc.nr_open > 0)
+		perf_stop(&pc);
+
+	/* The producer may still be running its last few items. */
+	full = LOAD_RELAXED(queues[cpu_id].full_counter);
+	printf("[Queue: %d: Buffer full: %u (ratio: %f).\
+			Buffer empty: %u (ration: %f)\n", 
+			cpu_id, full, (double)full/test_size, 
+			queues[cpu_id].empty_counter, 
+			(double)(queues[cpu_id].empty_counter)/test_size);
+	if (perf_enabled && pc.nr_open > 0) {
+		snprintf(who, sizeof(who), "consumer %d", cpu_id);
+		perf_report(stdout, who, &pc, test_size);
+		perf_close(&pc);
+	}
+
+	pthread_exit("consumer exit!");
+}
+
+void * producer(void *arg)
+{
+	uint64_t cycles;
+	//pthread_barrier_t *barrier = (pthread_barrier_t *)arg;
+	cpu_set_t	cur_mask;
+	struct init_info * init = (struct init_info *) arg;
+	uint32_t cpu_id = init->cpu_id;
+	pthread_barrier_t *barrier = init->barrier;
+	struct perf_counters pc;
+	char who[32];
+
+	CPU_ZERO(&cur_mask);
+	CPU_SET(producerAffinity[cpu_id], &cur_mask);
+	printf("producer %d:  ---%d----\n", cpu_id, producerAffinity[cpu_id]);
+	if (sched_setaffinity(0, sizeof(cur_mask), &cur_mask) < 0) {
+		printf("Error: sched_setaffinity for producer %d\n", cpu_id);
+		return NULL;
+	}
+
+	if (rt_schedule && set_rt_schedule() != 0)
+		return NULL;
+
+	printf("Producer %d created...\n", cpu_id);
+	//pthread_barrier_wait(barrier);
+
+	if (perf_enabled && perf_open(&pc) > 0)
+		perf_start(&pc);
+
+	acct_start(&acct_p[cpu_id]);
+	cycles = variants[cur_variant].produce(cpu_id);
+	acct_p[cpu_id].cycles = cycles;
+	acct_stop(&acct_p[cpu_id]);
+
+	if (perf_enabled && pc.nr_open > 0)
+		perf_stop(&pc);
+	if (cur_variant & V_BURST)
+		printf("producer %.0f %s/op\n",
+				tsc_out_diff((int64_t)(cycles / (test_size + 1)) - (int64_t)workload),
+				tsc_unit());
+	else
+		printf("producer %.0f %s/op\n",
+				tsc_out(cycles / ((test_size + 1))), tsc_unit());
+	/* Counts include the burst pauses, like cycles/op above. */
+	if (perf_enabled && pc.nr_open > 0) {
+		snprintf(who, sizeof(who), "producer %d", cpu_id);
+		perf_report(stdout, who, &pc, test_size + 1);
+		perf_close(&pc);
+	}
 
 	pthread_exit("producer exit!");
 }
@@ -266,13 +638,208 @@ int processAffinity(FILE * fp)
 	return 0;
 }
 
-int main(int argc, char *argv[])
+/* Per-queue summary of one run under interference (-I): consumer
+ * throughput, how far adaptive sizing moved the ring, and the tail of
+ * the end-to-end samples. */
+static void report_scenario(int nr_queues, const uint32_t v)
+{
+	struct queue_t *q;
+	int i;
+
+	for (i = 0; i < nr_queues; i++) {
+		q = &queues[i];
+		printf("queue %d: %.2f Mitems/s, size %u, full %u, empty %u, "
+				"shrinks %lu/%lu\n", i,
+				test_size / tsc_to_ns(q->stop_c - q->start_c) * 1e3,
+				q->info.queue_size, q->full_counter, q->empty_counter,
+				q->shrink_success, q->shrink_attempts);
+	}
+#if !defined(PRIO_LANES)
+	if (v & V_E2E) {
+		struct latency_hist lat;
+		uint64_t k;
+
+		memset(&lat, 0, sizeof(lat));
+		for (k = 0; k < e2e_sample_set_size; k++)
+			latency_record(&lat, e2e_output_c[k].tsc - e2e_output_p[k].tsc);
+		printf("queue 0 e2e: p50 < %.0f, p99 < %.0f, max %.0f %s\n",
+				tsc_out(latency_percentile(&lat, 50)),
+				tsc_out(latency_percentile(&lat, 99)),
+				tsc_out(lat.max), tsc_unit());
+	}
+#endif
+}
+
+/* Adds the metrics of one measured run of queue 0 to sets.  The
+ * cycles/op are those printed by the threads, i.e. less the workload
+ * with burst, and may be negative. */
+static void record_run(struct sample_set *sets, int *nr, const char *scenario,
+		const char *variant, const uint32_t v)
+{
+	struct queue_t *q = &queues[0];
+	int64_t less = (v & V_BURST) ? workload : 0;
+	char name[STATS_NAME_LEN];
+
+	snprintf(name, sizeof(name), "%s%s/producer_%s_op", scenario, variant,
+			tsc_unit());
+	stats_add(sets, nr, MAX_METRICS, name, STATS_LOWER,
+			tsc_out_diff((int64_t)(acct_p[0].cycles / (test_size + 1)) - less));
+	snprintf(name, sizeof(name), "%s%s/consumer_%s_op", scenario, variant,
+			tsc_unit());
+	stats_add(sets, nr, MAX_METRICS, name, STATS_LOWER,
+			tsc_out_diff((int64_t)((q->stop_c - q->start_c) / (test_size + 1)) - less));
+	snprintf(name, sizeof(name), "%s%s/Mitems_s", scenario, variant);
+	stats_add(sets, nr, MAX_METRICS, name, STATS_HIGHER,
+			test_size / tsc_to_ns(q->stop_c - q->start_c) * 1e3);
+	snprintf(name, sizeof(name), "%s%s/producer_cpu_MHz", scenario, variant);
+	stats_add(sets, nr, MAX_METRICS, name, STATS_INFO,
+			stats_cpu_mhz(producerAffinity[0]));
+}
+
+/* One run of the current variant: max_th queue pairs under the given
+ * interference, and its reports.  The queues are left for the caller
+ * to report on and destroy.  Returns 0, or what main() should return. */
+static int run_once(int max_th, uint64_t queue_size, uint64_t penalty,
+		struct noise_scenario *scenario, FILE *output)
 {
 	pthread_t	producer_thread[MAX_CORE_NUM], consumer_thread[MAX_CORE_NUM];
 	void * thread_result[MAX_CORE_NUM];
 	pthread_barrier_t barrier;
-	int		error, opt, i, max_th;
+	int		error, i;
+
+	for (i=0; i<max_th; i++) {
+		queue_init(&queues[i], queue_size, penalty, OVERFLOW_BLOCK);
+#if defined(PRIO_LANES)
+		pqueue_init(&pqueues[i], nr_lanes, queue_size, penalty, drain_mode, NULL);
+		memset(lane_lat[i], 0, sizeof(lane_lat[i]));
+#endif
+	}
+	memset(acct_p, 0, sizeof(acct_p));
+	memset(acct_c, 0, sizeof(acct_c));
+	pthread_mutex_lock(&report_lock);
+	run_queues = max_th;
+	pthread_mutex_unlock(&report_lock);
+
+	error = pthread_barrier_init(&barrier, NULL, max_th * 2);
+	if (error != 0) {
+		perror("BW");
+		return 1;
+	}
+	if (noise_start(scenario) != 0)
+		return 1;
+
+	for (i=0; i<max_th; i++) {
+		info_consumer[i].cpu_id = i;
+		info_consumer[i].barrier = &barrier;
+		error = pthread_create(&consumer_thread[i], NULL, 
+				consumer, &info_consumer[i]);
+	}
+	if (error != 0) {
+		perror("cannot create thread for consumer");
+		return 1;
+	}
+
+	for (i=0; i < max_th; i++) {
+		info_producer[i].cpu_id = i;
+		info_producer[i].barrier = &barrier;
+		error = pthread_create(&producer_thread[i], NULL, 
+				producer, &info_producer[i]);
+		poll(NULL, 0, 1);	
+	}
+	if (error != 0) {
+		perror("cannot create thread for producer");
+		return 1;
+	}
+
+	/* Producers are joined too, so that the next variant starts
+	 * from a quiet machine. */
+	for (i = 0; i < max_th; i++) {
+		error = pthread_join(consumer_thread[i], &thread_result[i]);
+		if (error == 0)
+			error = pthread_join(producer_thread[i], NULL);
+		if (error !=0) {
+			perror("Thread join failed");
+			return -1;
+		}
+	}
+	pthread_barrier_destroy(&barrier);
+	noise_stop(scenario);
+	pthread_mutex_lock(&report_lock);
+	run_queues = 0;
+	pthread_mutex_unlock(&report_lock);
+
+#if defined(PRIO_LANES)
+	if (cur_variant & V_E2E) {
+		for (i = 0; i < max_th; i++) {
+			uint32_t l;
+			for (l = 0; l < nr_lanes; l++) {
+				struct latency_hist *ll = &lane_lat[i][l];
+				if (ll->count == 0)
+					continue;
+				fprintf(output ? output : stdout,
+						"queue %d lane %u: items %lu, avg %.0f, p50 < %.0f, p99 < %.0f, max %.0f %s\n",
+						i, l, ll->count, tsc_out(latency_avg(ll)),
+						tsc_out(latency_percentile(ll, 50)),
+						tsc_out(latency_percentile(ll, 99)),
+						tsc_out(ll->max), tsc_unit());
+			}
+		}
+	}
+#else
+	if (cur_variant & V_E2E) {
+		if (output != NULL) {
+			fprintf(output, "tsc_p\t\t tsc_c\t\t diff(%s)    distance_p_c      \n", tsc_unit()); 
+
+			for (i=0; i<e2e_sample_set_size; i++) {
+				fprintf(output, "%ld    %ld   %8.0f   %6d \n", 
+						e2e_output_p[i].tsc, e2e_output_c[i].tsc, 
+						tsc_out(e2e_output_c[i].tsc - e2e_output_p[i].tsc),
+						e2e_output_p[i].distance);
+			}
+		}
+		else {
+			for (i=0; i<e2e_sample_set_size; i++) {
+				printf(" %ld  %ld, diff: %.0f %s, Queue distance: %d \n", 
+						e2e_output_p[i].tsc, e2e_output_c[i].tsc, 
+						tsc_out(e2e_output_c[i].tsc - e2e_output_p[i].tsc), tsc_unit(),
+						e2e_output_p[i].distance);
+			}
+		}
+	}
+#endif
+
+	for (i=1; i<max_th; i++) {
+		if (cur_variant & V_BURST)
+			printf("consumer: %.0f %s/op\n", 
+					tsc_out_diff((int64_t)((queues[i].stop_c - queues[i].start_c) / (test_size + 1))
+						- (int64_t)workload),
+					tsc_unit());
+		else
+			printf("consumer: %.0f %s/op\n", 
+					tsc_out((queues[i].stop_c - queues[i].start_c) / (test_size + 1)),
+					tsc_unit());
+	}
+
+	report_efficiency(max_th, 0);
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t	monitor_thread;
+	sigset_t	sigs;
+	int		error, opt, i, max_th, strategy;
 	uint64_t queue_size, penalty;
+	uint32_t	run_list[NR_VARIANTS], all_variants = 0;
+	int		nr_runs = 0, r;
+	static struct noise_scenario scenarios[MAX_SCENARIOS];
+	int		nr_scenarios = 0, interference = 0, sc;
+	static struct sample_set metrics[MAX_METRICS], baseline[MAX_METRICS];
+	int		reps = 1, warmup = -1, rep, nr_metrics = 0, nr_base;
+	char		env[STATS_ENV_LEN], base_env[STATS_ENV_LEN], prefix[64];
+	const char	*save_path = NULL, *base_path = NULL;
+	char		name[64];
 
 	queue_size = DEFAULT_QUEUE_SIZE;
 	test_size = DEFAULT_TEST_SIZE;
@@ -289,11 +856,28 @@ int main(int argc, char *argv[])
 		[-p penalty     (default: 1000 cycles)]\n\
 		[-o output      (default: terminal)]\n\
 		[-w workload    (default: 170)]\n\
+		[-K consumer work kernel[:working set], e.g. chase:8M, taking about -w cycles per item\n\
+		    kernels: spin, hash, memcpy, chase, checksum (default: spin, i.e. wait_ticks())]\n\
 		[-r burst rate  (default: 1024)]\n\
 		[-a affinity conf. (default: affinity.tree.conf)]\n\
+		[-l lanes       (default: 2. PRIO_LANES only)]\n\
+		[-d drain order (0: strict, 1: weighted. default: 0)]\n\
+		[-k control msg rate (default: 1024)]\n\
+		[-e collect hardware performance counters (default: off)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-V variants to run in order, e.g. batching+burst,burst,plain\n\
+		    flags: batching, burst, e2e, debug (default: the Makefile flags)]\n\
+		[-W wait strategy on full/empty: spin, pause, backoff, yield, umwait (default: pause)]\n\
+		[-R real-time scheduling (SCHED_FIFO)]\n\
+		[-n repetitions of every run, reported as median and 95% CI (default: 1)]\n\
+		[-u warm-up runs before the repetitions (default: 1 with -n, else 0)]\n\
+		[-S save the repetitions as a baseline file]\n\
+		[-B compare the repetitions with a baseline file]\n\
+		[-I interference scenarios to run in order, e.g. none,llc@5,membw@5+spin@3\n\
+		    generators: llc, membw, spin, syscall, each optionally @core]\n\
 		[-h help ]";
 
-	while ((opt = getopt(argc, argv, "hc:t:s:q:p:o:w:r:a:")) != -1) {
+	while ((opt = getopt(argc, argv, "heNRW:c:t:s:q:p:o:w:K:r:a:l:d:k:V:I:n:u:S:B:")) != -1) {
 		switch (opt) {
 			case 'c':
 				max_th = atoi(optarg);
@@ -303,10 +887,10 @@ int main(int argc, char *argv[])
 				printf("===== Number of items to produce: %ld. =====\n", test_size);
 				break;
 			case 's':
-#if defined(E2ELATENCY)
+#if !defined(PRIO_LANES)
 				e2e_sample_rate = atoll(optarg); 
 #else
-				printf("===== E2ELATENCY is not specified. Argument -s is not usable. =====\n");
+				printf("===== PRIO_LANES is specified. Argument -s is not usable. =====\n");
 #endif
 				break;
 			case 'q':
@@ -317,6 +901,12 @@ int main(int argc, char *argv[])
 				workload = atoll(optarg);
 				printf("===== workload for consumer: %ld. =====\n", workload);
 				break;
+			case 'K':
+				if (work_parse(optarg, &work_kind, &work_size) != 0) {
+					printf("%s\n", usage);
+					exit(-1);
+				}
+				break;
 			case 'r':
 				burst = atoll(optarg);
 				printf("===== burst rate for producer: %ld. =====\n", burst);
@@ -335,6 +925,55 @@ int main(int argc, char *argv[])
 			case 'h':
 				printf("%s\n", usage);
 				exit(0);
+			case 'V':
+				nr_runs = parse_variants(optarg, run_list, NR_VARIANTS);
+				if (nr_runs <= 0) {
+					printf("%s\n", usage);
+					exit(-1);
+				}
+				break;
+			case 'R':
+				rt_schedule = 1;
+				break;
+			case 'n':
+				reps = atoi(optarg);
+				if (reps < 1 || reps > MAX_REPS) {
+					printf("Error: repetitions must be in [1, %d].\n", MAX_REPS);
+					exit(-1);
+				}
+				break;
+			case 'u':
+				warmup = atoi(optarg);
+				break;
+			case 'S':
+				save_path = optarg;
+				break;
+			case 'B':
+				base_path = optarg;
+				break;
+			case 'I':
+				nr_scenarios = noise_parse(optarg, scenarios, MAX_SCENARIOS);
+				if (nr_scenarios <= 0) {
+					printf("%s\n", usage);
+					exit(-1);
+				}
+				interference = 1;
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'W':
+				strategy = wait_parse(optarg);
+				if (strategy < 0) {
+					printf("%s\n", usage);
+					exit(-1);
+				}
+				wait_default = strategy;
+				break;
+			case 'e':
+				perf_enabled = 1;
+				printf("===== Hardware performance counters enabled. =====\n");
+				break;
 			case 'a':
 				printf("affinity file: %s\n", optarg);
 				affinity_fp = fopen(optarg, "r");
@@ -348,26 +987,65 @@ int main(int argc, char *argv[])
 					return -1;
 				}
 				break;
+#if defined(PRIO_LANES)
+			case 'l':
+				nr_lanes = atoi(optarg);
+				printf("===== Number of lanes: %u. =====\n", nr_lanes);
+				break;
+			case 'd':
+				drain_mode = atoi(optarg) ? PQ_WEIGHTED : PQ_STRICT;
+				printf("===== Drain order: %s. =====\n",
+						drain_mode == PQ_STRICT ? "strict" : "weighted");
+				break;
+			case 'k':
+				ctrl_rate = atoll(optarg);
+				printf("===== Control message rate: %ld. =====\n", ctrl_rate);
+				break;
+#else
+			case 'l':
+			case 'd':
+			case 'k':
+				printf("===== PRIO_LANES is not specified. Arguments -l, -d and -k are not usable. =====\n");
+				break;
+#endif
 			default:
 				printf("%s\n", usage);
 				exit(-1);
 		}
 	}
 
-#if defined(E2ELATENCY)
-	e2e_sample_set_size = (uint64_t) test_size / e2e_sample_rate;
-	uint64_t sample_rate_t = e2e_sample_rate;
-	uint64_t power_t;
-	for (power_t = 0; sample_rate_t > 1; power_t++) {
-		sample_rate_t /= 2;
+#if defined(PRIO_LANES)
+	if (nr_lanes < 2 || nr_lanes > MAX_LANES) {
+		printf("Error: number of lanes must be in [2, %d].\n", MAX_LANES);
+		exit(-1);
+	}
+	if (ctrl_rate == 0 || (ctrl_rate & (ctrl_rate - 1)) != 0) {
+		printf("Error: control message rate must be a power of two.\n");
+		exit(-1);
 	}
-	e2e_sample_power_2 = power_t;
+#endif
 
-	printf("===== End-to-end latency sample rate: %ld (2^%d). Set size: %ld =====\n", e2e_sample_rate, e2e_sample_power_2, e2e_sample_set_size);
+	if (nr_runs == 0)
+		run_list[nr_runs++] = default_variant;
+	for (r = 0; r < nr_runs; r++)
+		all_variants |= run_list[r];
+
+#if !defined(PRIO_LANES)
+	if (all_variants & V_E2E) {
+		e2e_sample_set_size = (uint64_t) test_size / e2e_sample_rate;
+		uint64_t sample_rate_t = e2e_sample_rate;
+		uint64_t power_t;
+		for (power_t = 0; sample_rate_t > 1; power_t++) {
+			sample_rate_t /= 2;
+		}
+		e2e_sample_power_2 = power_t;
 
-	if (e2e_sample_set_size < 1) {
-		printf("Error: The result of test_size/sample_rate must be larger than 1.\n");
-		exit(-1);
+		printf("===== End-to-end latency sample rate: %ld (2^%d). Set size: %ld =====\n", e2e_sample_rate, e2e_sample_power_2, e2e_sample_set_size);
+
+		if (e2e_sample_set_size < 1) {
+			printf("Error: The result of test_size/sample_rate must be larger than 1.\n");
+			exit(-1);
+		}
 	}
 #endif
 
@@ -396,91 +1074,122 @@ int main(int argc, char *argv[])
 		printf("Maximum core number is %d\n", max_th);
 	}
 
-	printf("Test ready to run. Parameters: penalty: %ld, workload: %ld, burst rate: %ld\n",
-			penalty, workload, burst);
+	printf("Test ready to run. Parameters: penalty: %ld, workload: %ld, burst rate: %ld, wait: %s\n",
+			penalty, workload, burst,
+			wait_name(wait_supported(wait_default)));
 
-#if defined(E2ELATENCY)
-	e2e_output_c = (struct e2e_info *) calloc(e2e_sample_set_size , sizeof(struct e2e_info));
-	e2e_output_p = (struct e2e_info *) calloc(e2e_sample_set_size , sizeof(struct e2e_info));
+#if !defined(PRIO_LANES)
+	if (all_variants & V_E2E) {
+		e2e_output_c = (struct e2e_info *) calloc(e2e_sample_set_size , sizeof(struct e2e_info));
+		e2e_output_p = (struct e2e_info *) calloc(e2e_sample_set_size , sizeof(struct e2e_info));
+	}
 #endif
 
+	tsc_init();
 	srand((unsigned int)rdtsc_bare());
 
-	for (i=0; i<max_th; i++) {
-		queue_init(&queues[i], queue_size, penalty);
-	}
-
-	error = pthread_barrier_init(&barrier, NULL, max_th * 2);
-	if (error != 0) {
-		perror("BW");
-		return 1;
+	/* One working set per consumer; the cost of a unit is measured
+	 * once, here, and shared. */
+	if (work_kind != WORK_SPIN) {
+		for (i = 0; i < max_th; i++) {
+			if (work_init(&work[i], work_kind, work_size) != 0)
+				return -1;
+		}
+		work_calibrate(&work[0], workload);
+		for (i = 1; i < max_th; i++)
+			work[i].reps = work[0].reps;
+		printf("===== Work kernel: %s over %lu KB, %lu lines/item, %.0f %s/item =====\n",
+				work_name(work_kind), work[0].size >> 10, work[0].reps,
+				tsc_out(work[0].reps * work[0].unit_cycles), tsc_unit());
 	}
 
-	for (i=0; i<max_th; i++) {
-		info_consumer[i].cpu_id = i;
-		info_consumer[i].barrier = &barrier;
-		error = pthread_create(&consumer_thread[i], NULL, 
-				consumer, &info_consumer[i]);
-	}
-	if (error != 0) {
-		perror("cannot create thread for consumer");
-		return 1;
-	}
+	if (warmup < 0)
+		warmup = reps > 1 ? 1 : 0;
 
-	for (i=0; i < max_th; i++) {
-		info_producer[i].cpu_id = i;
-		info_producer[i].barrier = &barrier;
-		error = pthread_create(&producer_thread[i], NULL, 
-				producer, &info_producer[i]);
-		poll(NULL, 0, 1);	
-	}
-	if (error != 0) {
-		perror("cannot create thread for producer");
+	/* Every thread created from here on inherits the mask. */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGUSR1);
+	sigaddset(&sigs, SIGUSR2);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+	if (pthread_create(&monitor_thread, NULL, monitor, NULL) != 0) {
+		perror("cannot create monitor thread");
 		return 1;
 	}
+	printf("===== kill -USR1 %d for an efficiency report while running =====\n",
+			getpid());
+	stats_env(env, sizeof(env));
+
+	if (nr_scenarios == 0)
+		nr_scenarios = 1;	/* no generators */
+	for (sc = 0; sc < nr_scenarios; sc++) {
+		if (interference)
+			printf("===== Interference: %s =====\n",
+					noise_name(&scenarios[sc], name, sizeof(name)));
+		for (r = 0; r < nr_runs; r++) {
+			cur_variant = run_list[r];
+			printf("===== Variant: %s =====\n",
+					variant_name(cur_variant, name, sizeof(name)));
+			for (rep = 0; rep < warmup + reps; rep++) {
+				if (warmup + reps > 1)
+					printf("===== %s %d =====\n",
+							rep < warmup ? "Warm-up run" : "Repetition",
+							rep < warmup ? rep + 1 : rep - warmup + 1);
+
+				error = run_once(max_th, queue_size, penalty, &scenarios[sc], output);
+				if (error != 0)
+					return error;
+
+				if (interference) {
+					noise_report(stdout, &scenarios[sc]);
+					report_scenario(max_th, cur_variant);
+				}
+				if (rep >= warmup) {
+					prefix[0] = '\0';
+					if (interference)
+						snprintf(prefix, sizeof(prefix), "%s/",
+								noise_name(&scenarios[sc], name, sizeof(name)));
+					record_run(metrics, &nr_metrics, prefix,
+							variant_name(cur_variant, name, sizeof(name)), cur_variant);
+				}
 
-	for (i = 0; i < max_th; i++) {
-		error = pthread_join(consumer_thread[i], &thread_result[i]);
-		if (error !=0) {
-			perror("Thread join failed");
-			return -1;
+				for (i=0; i<max_th; i++) {
+#if defined(PRIO_LANES)
+					pqueue_destroy(&pqueues[i]);
+#endif
+					queue_destroy(&queues[i]);
+				}
+			}
 		}
 	}
 
-#if defined(E2ELATENCY)
-	if (output != NULL) {
-		fprintf(output, "tsc_p\t\t tsc_c\t\t tsc_diff    distance_p_c      \n"); 
-
-		for (i=0; i<e2e_sample_set_size; i++) {
-			fprintf(output, "%ld    %ld   %8ld   %6d \n", 
-					e2e_output_p[i].tsc, e2e_output_c[i].tsc, 
-					e2e_output_c[i].tsc - e2e_output_p[i].tsc,
-					e2e_output_p[i].distance);
-		}
-	}
-	else {
-		for (i=0; i<e2e_sample_set_size; i++) {
-			printf(" %ld  %ld, diff: %ld, Queue distance: %d \n", 
-					e2e_output_p[i].tsc, e2e_output_c[i].tsc, 
-					e2e_output_c[i].tsc - e2e_output_p[i].tsc,
-					e2e_output_p[i].distance);
-		}
-	}
-#endif
+	for (i = 0; i < max_th; i++)
+		work_destroy(&work[i]);
+	pthread_kill(monitor_thread, SIGUSR2);
+	pthread_join(monitor_thread, NULL);
 
-	for (i=1; i<max_th; i++) {
-#if defined(SIMULATE_BURST)
-		printf("consumer: %ld cycles/op\n", 
-				((queues[i].stop_c - queues[i].start_c) / (test_size + 1)) - workload);
-#else
-		printf("consumer: %ld cycles/op\n", 
-				((queues[i].stop_c - queues[i].start_c) / (test_size + 1)));
-#endif
+	error = 0;
+	if (reps > 1 || save_path || base_path) {
+		printf("===== %d repetition(s), %d warm-up run(s), %s =====\n",
+				reps, warmup, env);
+		stats_report(stdout, metrics, nr_metrics);
+	}
+	if (save_path && stats_save(save_path, metrics, nr_metrics, env) == 0)
+		printf("===== Baseline saved to %s =====\n", save_path);
+	if (base_path) {
+		nr_base = stats_load(base_path, baseline, MAX_METRICS, base_env,
+				sizeof(base_env));
+		if (nr_base < 0)
+			return -1;
+		printf("===== Comparison with %s (%s) =====\n", base_path, base_env);
+		if (strcmp(env, base_env) != 0)
+			printf("Warning: the baseline was taken with %s.\n", base_env);
+		if (stats_compare(stdout, metrics, nr_metrics, baseline, nr_base) > 0)
+			error = 1;	/* regressions */
 	}
 
 	if (output != NULL)
 		fclose(output);
 
 
-	return 0;
+	return error;
 }
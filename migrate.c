@@ -0,0 +1,144 @@
+/*
+ *  migrate.c: Live migration of a queue's consumer (or producer) to
+ *  another core.
+ *
+ *  Placement is normally fixed once, when producer() and consumer() pin
+ *  themselves.  Here a requester posts the target core in a migrate_t
+ *  and the thread moves itself the next time it calls migrate_point(),
+ *  i.e. between two dequeues.  That is the consistent point: the queue
+ *  is frozen on that side while the thread re-pins, nothing is taken
+ *  out of it, and the elements the other side keeps adding wait in the
+ *  ring (or make enqueue() report BUFFER_FULL) until the thread resumes
+ *  on its new core.  No element is lost or reordered with
+ *  OVERFLOW_BLOCK queues; the lossy policies drop as they would for any
+ *  slow consumer.
+ *
+ *  With MIGRATE_MOVE_RING the thread also binds the ring's reservation
+ *  to the NUMA node of the new core with mbind(MPOL_MF_MOVE): resident
+ *  pages are migrated by the kernel (the other side simply faults on
+ *  them for the duration of the copy) and pages faulted in later, as
+ *  the queue grows again, come from that node too.  The spill file is
+ *  left where it is.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <sched.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "migrate.h"
+
+void migrate_init(struct migrate_t *m)
+{
+	memset(m, 0, sizeof(struct migrate_t));
+	m->current = -1;
+	m->node = -1;
+}
+
+/* Ask the thread polling m to move to core.  Returns -1 if a previous
+ * request is still pending. */
+int migrate_request(struct migrate_t *m, int core, uint32_t flags)
+{
+	if (READ_ONCE(m->pending))
+		return -1;
+	m->core = core;
+	m->flags = flags;
+	m->requested = rdtsc_bare();
+	/* Publishes core, flags and requested to migrate_point(). */
+	STORE_RELEASE(m->pending, 1);
+	return 0;
+}
+
+/* Wait until the thread has carried out the pending request; it must
+ * keep calling migrate_point().  Returns 0 or the errno it ran into. */
+int migrate_wait(struct migrate_t *m)
+{
+	while (LOAD_ACQUIRE(m->pending))
+		sched_yield();
+	return READ_ONCE(m->error);
+}
+
+/* NUMA node of cpu, read from sysfs; -1 if unknown. */
+int cpu_node(int cpu)
+{
+	char path[64];
+	struct dirent *d;
+	DIR *dir;
+	int node = -1;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+	if ((dir = opendir(path)) == NULL)
+		return -1;
+	while ((d = readdir(dir)) != NULL)
+		if (sscanf(d->d_name, "node%d", &node) == 1)
+			break;
+	closedir(dir);
+	return node;
+}
+
+static int ring_bind(struct queue_t *q, int node)
+{
+	unsigned long mask[16] = { 0 };
+
+	if (node >= (int)(sizeof(mask) * 8))
+		return EINVAL;
+	mask[node / 64] = 1UL << (node % 64);
+	if (syscall(SYS_mbind, q->data, MAX_QUEUE_SIZE * sizeof(ELEMENT_TYPE),
+				MPOL_BIND, mask, sizeof(mask) * 8, MPOL_MF_MOVE) != 0)
+		return errno;
+	return 0;
+}
+
+int migrate_run(struct migrate_t *m, struct queue_t *q)
+{
+	cpu_set_t mask;
+	int core = m->core, err = 0, node;
+
+	m->frozen = rdtsc_bare();
+	CPU_ZERO(&mask);
+	CPU_SET(core, &mask);
+	/* Returns once this thread runs on core. */
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0) {
+		err = errno;
+		printf("Error: sched_setaffinity to core %d\n", core);
+	} else
+		m->current = core;
+
+	if (err == 0 && (m->flags & MIGRATE_MOVE_RING) && q != NULL) {
+		node = cpu_node(core);
+		if (node >= 0 && node != m->node) {
+			err = ring_bind(q, node);
+			if (err == 0)
+				m->node = node;
+			else
+				printf("Error: cannot move the ring to node %d (%s)\n",
+						node, strerror(err));
+		}
+	}
+
+	m->resumed = rdtsc_bare();
+	m->pause = m->resumed - m->frozen;
+	m->latency = m->resumed - m->requested;
+	m->error = err;
+	WRITE_ONCE(m->done, m->done + 1);
+	/* Publishes the results above to migrate_wait(). */
+	STORE_RELEASE(m->pending, 0);
+	return 1;
+}
@@ -0,0 +1,72 @@
+/*
+ *  migrate.h: Live migration of a queue's consumer (or producer) to
+ *  another core, optionally moving the ring to that core's NUMA node.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_MIGRATE_H_
+#define _FIFO_MIGRATE_H_
+
+#include "fifo.h"
+#include "atomics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Request flags */
+#define MIGRATE_MOVE_RING 1	/* also move the ring to the new core's node */
+
+struct migrate_t {
+	/* Written by the requester. */
+	uint32_t pending __attribute__ ((aligned(128)));
+	int core;
+	uint32_t flags;
+	uint64_t requested;		/* TSC of the request */
+
+	/* Written by the migrating thread. */
+	uint32_t done __attribute__ ((aligned(128)));	/* migrations completed */
+	int current;			/* core the thread runs on, -1: unknown */
+	int node;			/* node the ring was moved to, -1: none */
+	int error;			/* last migration: 0 or an errno */
+	uint64_t frozen;		/* TSC when the thread stopped dequeuing */
+	uint64_t resumed;		/* TSC when it went back to the queue */
+	uint64_t pause;			/* resumed - frozen */
+	uint64_t latency;		/* resumed - requested */
+};
+
+void migrate_init(struct migrate_t *);
+int migrate_request(struct migrate_t *, int, uint32_t);
+int migrate_wait(struct migrate_t *);
+int migrate_run(struct migrate_t *, struct queue_t *);
+int cpu_node(int);
+
+/* Called by the thread that owns q's side, between two operations on
+ * q.  Returns 1 if it has just migrated. */
+static inline int migrate_point(struct migrate_t *m, struct queue_t *q)
+{
+	if ( unlikely(LOAD_ACQUIRE(m->pending)) )
+		return migrate_run(m, q);
+	return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
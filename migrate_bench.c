@@ -0,0 +1,292 @@
+/*
+ *  migrate_bench.c: Pause and throughput recovery when the consumer of
+ *  a running queue is moved to another core (migrate.c).
+ *
+ *  The producer streams a counter flat out.  The consumer counts the
+ *  elements it gets per time bucket and checks their order; the main
+ *  thread moves it back and forth between two cores at even intervals.
+ *  For every migration the benchmark reports how long the consumer was
+ *  frozen, the backlog it found when it resumed, and how long after
+ *  resuming its rate got back to 90% of the rate before the request.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <unistd.h>
+#include "migrate.h"
+#include "tsc.h"
+#include "wait.h"
+
+#define MAX_MIGRATIONS 64
+/* Buckets before the request that make up the baseline rate. */
+#define BASE_BUCKETS 20
+/* The rate has recovered once a bucket reaches this share of the
+ * baseline. */
+#define RECOVERED 0.9
+
+struct migration {
+	int from;
+	int to;
+	int error;
+	uint64_t requested;
+	uint64_t resumed;
+	uint64_t pause;
+	uint64_t latency;
+	uint64_t backlog;	/* occupancy when the consumer resumed */
+};
+
+static uint64_t duration_ms = 2000;
+static uint64_t bucket_us = 100;
+static uint64_t workload = 0;
+static uint32_t nr_migrations = 8;
+static uint32_t flags = 0;
+static uint64_t cores[3] = { 0, 1, 2 };
+
+static struct queue_t q __attribute__ ((aligned(128)));
+static struct migrate_t mig __attribute__ ((aligned(128)));
+static struct migration migrations[MAX_MIGRATIONS];
+static uint64_t *timeline;
+static uint64_t nr_buckets;
+static uint64_t bucket_ticks;
+static uint64_t t0;
+static volatile int stop;
+static volatile int producer_done;
+static uint64_t produced, consumed, order_errors;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static void *producer(void *arg)
+{
+	struct wait_state ws;
+	ELEMENT_TYPE i = 1;
+
+	pin(cores[0]);
+	wait_init(&ws, q.wait);
+	while (!stop) {
+		if (enqueue(&q, i) == SUCCESS) {
+			i ++;
+			continue;
+		}
+		q.full_counter ++;
+		q.traffic_full ++;
+		wait_for(&ws, q.penalty);
+	}
+	produced = i - 1;
+	producer_done = 1;
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	ELEMENT_TYPE value, expected = 1;
+	uint64_t b;
+
+	pin(cores[1]);
+	mig.current = cores[1];
+	for (;;) {
+		if (migrate_point(&mig, &q))
+			migrations[mig.done - 1].backlog = queue_occupancy(&q);
+		if (dequeue(&q, &value) != SUCCESS) {
+			if (producer_done && consumed == produced)
+				break;
+			continue;
+		}
+		if (value != expected)
+			order_errors ++;
+		expected = value + 1;
+		consumed ++;
+		b = (rdtsc_bare() - t0) / bucket_ticks;
+		if (b < nr_buckets)
+			timeline[b] ++;
+		if (workload)
+			wait_ticks(workload);
+	}
+	return NULL;
+}
+
+/* Microseconds from resuming until the rate is back to RECOVERED of
+ * the baseline, or -1 if it never is before the next migration. */
+static double recovery(struct migration *m, uint64_t end, double *base)
+{
+	uint64_t rb = (m->requested - t0) / bucket_ticks;
+	uint64_t sb = (m->resumed - t0) / bucket_ticks;
+	uint64_t b, sum = 0;
+
+	if (rb < BASE_BUCKETS)
+		return -1;
+	for (b = rb - BASE_BUCKETS; b < rb; b++)
+		sum += timeline[b];
+	*base = (double)sum / BASE_BUCKETS;
+	for (b = sb + 1; b < end && b < nr_buckets; b++)
+		if (timeline[b] >= *base * RECOVERED)
+			return (double)(b - sb) * bucket_us;
+	return -1;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t prod, cons;
+	uint64_t interval, next, end;
+	double rec, base;
+	uint32_t k;
+	int opt;
+
+	char * usage =
+		"Usage: migrate_bench [-t duration (default: 2000 ms)]\n\
+		[-m migrations (default: 8)]\n\
+		[-C producer core, consumer core, core to move to (default: 0,1,2)]\n\
+		[-R also move the ring to the NUMA node of the new core]\n\
+		[-w consumer workload (default: 0 cycles)]\n\
+		[-B rate bucket (default: 100 us)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNRt:m:C:w:B:")) != -1) {
+		switch (opt) {
+			case 't':
+				duration_ms = atoll(optarg);
+				break;
+			case 'm':
+				nr_migrations = atoi(optarg);
+				break;
+			case 'C':
+				if (parse_list(optarg, cores, 3) != 3) {
+					printf("%s\n", usage);
+					exit(-1);
+				}
+				break;
+			case 'R':
+				flags |= MIGRATE_MOVE_RING;
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'B':
+				bucket_us = atoll(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (nr_migrations > MAX_MIGRATIONS || bucket_us == 0 ||
+			duration_ms * 1000 < bucket_us * BASE_BUCKETS) {
+		printf("%s\n", usage);
+		exit(-1);
+	}
+
+	tsc_init();
+	bucket_ticks = (uint64_t)(bucket_us * 1e3 * tsc_clock.ticks_per_ns);
+	nr_buckets = duration_ms * 1000 / bucket_us + 1;
+	timeline = calloc(nr_buckets, sizeof(uint64_t));
+	if (timeline == NULL) {
+		printf("Error in allocating the timeline.\n");
+		exit(-1);
+	}
+	queue_init(&q, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY, OVERFLOW_BLOCK);
+	migrate_init(&mig);
+
+	t0 = rdtsc_bare();
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_create(&cons, NULL, consumer, NULL);
+
+	interval = (uint64_t)(duration_ms * 1e6 * tsc_clock.ticks_per_ns) /
+		(nr_migrations + 1);
+	for (k = 0; k < nr_migrations; k++) {
+		int to = cores[1 + (k + 1) % 2];
+
+		next = t0 + (k + 1) * interval;
+		while (rdtsc_bare() < next)
+			usleep(100);
+		migrations[k].from = READ_ONCE(mig.current);
+		migrations[k].to = to;
+		migrate_request(&mig, to, flags);
+		migrations[k].error = migrate_wait(&mig);
+		migrations[k].requested = mig.requested;
+		migrations[k].resumed = mig.resumed;
+		migrations[k].pause = mig.pause;
+		migrations[k].latency = mig.latency;
+	}
+	end = t0 + (uint64_t)(duration_ms * 1e6 * tsc_clock.ticks_per_ns);
+	while (rdtsc_bare() < end)
+		usleep(1000);
+	stop = 1;
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	printf("%-4s %5s %5s %12s %12s %10s %12s %12s\n", "#", "from", "to",
+			"pause", "req-resume", "backlog", "base Mit/s", "recover us");
+	for (k = 0; k < nr_migrations; k++) {
+		struct migration *m = &migrations[k];
+		uint64_t limit = k + 1 < nr_migrations ?
+			(migrations[k + 1].requested - t0) / bucket_ticks : nr_buckets;
+
+		base = 0;
+		rec = recovery(m, limit, &base);
+		printf("%-4u %5d %5d %12.0f %12.0f %10lu %12.2f ", k, m->from, m->to,
+				tsc_out(m->pause), tsc_out(m->latency), m->backlog,
+				base / bucket_us);
+		if (rec < 0)
+			printf("%12s", "-");
+		else
+			printf("%12.0f", rec);
+		if (m->error)
+			printf("  (%s)", strerror(m->error));
+		printf("\n");
+	}
+	printf("produced %lu, consumed %lu, order errors %lu; ring node %d; "
+			"pause in %s\n", produced, consumed, order_errors, mig.node,
+			tsc_unit());
+
+	free(timeline);
+	queue_destroy(&q);
+	return 0;
+}
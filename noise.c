@@ -0,0 +1,256 @@
+/*
+ *  noise.c: Interference generators.  Each generator is a thread,
+ *  optionally pinned, that runs one kind of load until its scenario is
+ *  stopped:
+ *
+ *    llc      random read-modify-writes of cache lines spread over a
+ *             buffer the size of the LLC, evicting the queue's lines
+ *    membw    memcpy between the halves of a buffer four times the LLC
+ *             (at least 64 MB), saturating memory bandwidth
+ *    spin     tight integer loop; pinned on the SMT sibling of a queue
+ *             thread it competes for the core's execution units
+ *    syscall  getppid() syscalls with a 1 us nanosleep() every 64, i.e.
+ *             kernel entries and timer interrupts on its core
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "noise.h"
+
+#define DEFAULT_LLC_BYTES (32UL << 20)
+#define MIN_MEMBW_BYTES (64UL << 20)
+#define MEMBW_CHUNK (1UL << 20)
+#define NOISE_CHUNK 1024	/* operations between two checks of stop */
+
+static const char *noise_names[NR_NOISE_KINDS] = { "llc", "membw", "spin",
+	"syscall" };
+static const char *noise_units[NR_NOISE_KINDS] = { "lines", "bytes", "loops",
+	"syscalls" };
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static uint64_t llc_bytes(void)
+{
+	long n = sysconf(_SC_LEVEL3_CACHE_SIZE);
+
+	return n > 0 ? (uint64_t)n : DEFAULT_LLC_BYTES;
+}
+
+static void *noise_llc(struct noise_gen *g)
+{
+	uint64_t size = llc_bytes(), lines = size / 64, x = (uintptr_t)g, k;
+	volatile uint64_t *buf = aligned_alloc(64, size);
+
+	if (buf == NULL) {
+		printf("Error: cannot allocate %lu bytes for llc noise.\n", size);
+		return NULL;
+	}
+	memset((void *)buf, 0, size);
+	while (!g->s->stop) {
+		for (k = 0; k < NOISE_CHUNK; k++) {
+			x = x * 6364136223846793005UL + 1442695040888963407UL;
+			buf[((x >> 33) % lines) * 8] ++;
+		}
+		g->ops += NOISE_CHUNK;
+	}
+	free((void *)buf);
+	return NULL;
+}
+
+static void *noise_membw(struct noise_gen *g)
+{
+	uint64_t size = 4 * llc_bytes(), half, off;
+	char *buf;
+
+	if (size < MIN_MEMBW_BYTES)
+		size = MIN_MEMBW_BYTES;
+	half = size / 2;
+	if ((buf = aligned_alloc(4096, size)) == NULL) {
+		printf("Error: cannot allocate %lu bytes for membw noise.\n", size);
+		return NULL;
+	}
+	memset(buf, 1, size);
+	/* Copied in 1 MB pieces so that stop is seen promptly. */
+	for (off = 0; !g->s->stop; off = (off + MEMBW_CHUNK) % half) {
+		memcpy(buf + half + off, buf + off, MEMBW_CHUNK);
+		g->ops += MEMBW_CHUNK;
+	}
+	free(buf);
+	return NULL;
+}
+
+static void *noise_spin(struct noise_gen *g)
+{
+	uint64_t x = 1, k;
+
+	while (!g->s->stop) {
+		for (k = 0; k < NOISE_CHUNK * 64; k++) {
+			x = x * 3 + k;
+			__asm__ __volatile__("" : "+r" (x));
+		}
+		g->ops += NOISE_CHUNK * 64;
+	}
+	return NULL;
+}
+
+static void *noise_syscall(struct noise_gen *g)
+{
+	struct timespec ts = { 0, 1000 };
+	uint64_t k;
+
+	while (!g->s->stop) {
+		for (k = 0; k < 64; k++)
+			syscall(SYS_getppid);
+		nanosleep(&ts, NULL);
+		g->ops += 64;
+	}
+	return NULL;
+}
+
+static void *noise_main(void *arg)
+{
+	struct noise_gen *g = (struct noise_gen *)arg;
+	cpu_set_t mask;
+
+	if (g->core >= 0) {
+		CPU_ZERO(&mask);
+		CPU_SET(g->core, &mask);
+		if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+			printf("Error: sched_setaffinity for %s noise\n",
+					noise_names[g->kind]);
+	}
+	switch (g->kind) {
+		case NOISE_LLC: return noise_llc(g);
+		case NOISE_MEMBW: return noise_membw(g);
+		case NOISE_SPIN: return noise_spin(g);
+		default: return noise_syscall(g);
+	}
+}
+
+int noise_parse(char *arg, struct noise_scenario *list, int max)
+{
+	char *item, *gen, *at, *save_item, *save_gen;
+	struct noise_scenario *s;
+	uint32_t k;
+	int n = 0;
+
+	for (item = strtok_r(arg, ",", &save_item); item && n < max;
+			item = strtok_r(NULL, ",", &save_item)) {
+		s = &list[n++];
+		memset(s, 0, sizeof(struct noise_scenario));
+		for (gen = strtok_r(item, "+", &save_gen); gen;
+				gen = strtok_r(NULL, "+", &save_gen)) {
+			if (strcmp(gen, "none") == 0)
+				continue;
+			if (s->nr == MAX_NOISE) {
+				printf("Error: at most %d generators per scenario.\n",
+						MAX_NOISE);
+				return -1;
+			}
+			s->gens[s->nr].core = -1;
+			if ((at = strchr(gen, '@')) != NULL) {
+				*at = '\0';
+				s->gens[s->nr].core = atoi(at + 1);
+			}
+			for (k = 0; k < NR_NOISE_KINDS; k++)
+				if (strcmp(gen, noise_names[k]) == 0)
+					break;
+			if (k == NR_NOISE_KINDS) {
+				printf("Error: unknown interference \"%s\".\n", gen);
+				return -1;
+			}
+			s->gens[s->nr].kind = k;
+			s->nr ++;
+		}
+	}
+	return n;
+}
+
+int noise_start(struct noise_scenario *s)
+{
+	uint32_t i;
+
+	s->stop = 0;
+	s->start_ns = now_ns();
+	for (i = 0; i < s->nr; i++) {
+		s->gens[i].s = s;
+		s->gens[i].ops = 0;
+		if (pthread_create(&s->gens[i].tid, NULL, noise_main,
+					&s->gens[i]) != 0) {
+			perror("cannot create interference thread");
+			s->nr = i;
+			noise_stop(s);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void noise_stop(struct noise_scenario *s)
+{
+	uint32_t i;
+
+	s->stop = 1;
+	for (i = 0; i < s->nr; i++)
+		pthread_join(s->gens[i].tid, NULL);
+	s->elapsed_ns = now_ns() - s->start_ns;
+}
+
+/* "llc@3+spin@43"; "none" without generators. */
+const char *noise_name(struct noise_scenario *s, char *buf, size_t len)
+{
+	char one[32];
+	uint32_t i;
+
+	buf[0] = '\0';
+	for (i = 0; i < s->nr; i++) {
+		if (s->gens[i].core >= 0)
+			snprintf(one, sizeof(one), "%s%s@%d", i ? "+" : "",
+					noise_names[s->gens[i].kind], s->gens[i].core);
+		else
+			snprintf(one, sizeof(one), "%s%s", i ? "+" : "",
+					noise_names[s->gens[i].kind]);
+		strncat(buf, one, len - strlen(buf) - 1);
+	}
+	if (!buf[0])
+		snprintf(buf, len, "none");
+	return buf;
+}
+
+void noise_report(FILE *out, struct noise_scenario *s)
+{
+	double sec = s->elapsed_ns / 1e9;
+	uint32_t i;
+
+	for (i = 0; i < s->nr; i++)
+		fprintf(out, "interference %s on core %d: %.3g %s/s\n",
+				noise_names[s->gens[i].kind], s->gens[i].core,
+				sec > 0 ? s->gens[i].ops / sec : 0.0,
+				noise_units[s->gens[i].kind]);
+}
@@ -0,0 +1,70 @@
+/*
+ *  noise.h: Interference generators ("noisy neighbours") for the
+ *  benchmarks: threads pinned to chosen cores that thrash the LLC, hog
+ *  memory bandwidth, spin on an SMT sibling or make syscalls and take
+ *  timer interrupts while a test runs.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _EQUEUE_NOISE_H_
+#define _EQUEUE_NOISE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+/* Generator kinds */
+#define NOISE_LLC 0		/* random read-modify-writes over an LLC-sized buffer */
+#define NOISE_MEMBW 1		/* memcpy over a buffer four times the LLC */
+#define NOISE_SPIN 2		/* integer loop, for the SMT sibling of a queue thread */
+#define NOISE_SYSCALL 3		/* getppid() syscalls and 1 us sleeps (timer IRQs) */
+#define NR_NOISE_KINDS 4
+
+#define MAX_NOISE 8		/* generators per scenario */
+#define MAX_SCENARIOS 16
+
+struct noise_scenario;
+
+struct noise_gen {
+	uint32_t kind;
+	int core;			/* -1: not pinned */
+	pthread_t tid;
+	uint64_t ops;			/* work done, in noise_unit() */
+	struct noise_scenario *s;
+};
+
+/* A set of generators running together. */
+struct noise_scenario {
+	struct noise_gen gens[MAX_NOISE];
+	uint32_t nr;
+	volatile int stop;
+	uint64_t start_ns;
+	uint64_t elapsed_ns;
+};
+
+/* Parse "none,llc@3,membw@5+spin@43,..." (one scenario per comma,
+ * generators joined by '+', "@core" pins) into list; returns the number
+ * of scenarios or -1. */
+int noise_parse(char *, struct noise_scenario *, int);
+int noise_start(struct noise_scenario *);
+void noise_stop(struct noise_scenario *);
+const char *noise_name(struct noise_scenario *, char *, size_t);
+/* Work rate of every generator of a stopped scenario. */
+void noise_report(FILE *, struct noise_scenario *);
+
+#endif
@@ -0,0 +1,350 @@
+/*
+ *  partq.c: Key-partitioned EQueue with per-key ordering and hot-key
+ *  rebalancing.
+ *
+ *  The producer buffers elements per partition and writes PARTQ_BATCH
+ *  of them to the partition's queue at a time.  A key is moved to
+ *  another partition with a drain-then-switch protocol: the producer
+ *  notes how many elements the old queue has received so far (the
+ *  fence), holds back the key's new elements, and releases them to the
+ *  new queue only once the old consumer has consumed up to the fence.
+ *  An element counts as consumed when its consumer asks for the next
+ *  one, so no two consumers ever work on the same key at once.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "partq.h"
+#include "wait.h"
+
+/* The finalizer of MurmurHash3. */
+static inline uint64_t partq_hash(uint64_t key)
+{
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdUL;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53UL;
+	key ^= key >> 33;
+	return key;
+}
+
+void partq_init(struct partq_t *p, uint32_t nr_parts, uint64_t queue_size,
+		uint64_t penalty)
+{
+	uint32_t i;
+
+	if (nr_parts < 1 || nr_parts > MAX_PARTS) {
+		printf("Error: number of partitions must be in [1, %d].\n", MAX_PARTS);
+		exit(-1);
+	}
+
+	memset(p, 0, sizeof(struct partq_t));
+	p->nr_parts = nr_parts;
+	for (i = 0; i < nr_parts; i++)
+		queue_init(&p->queues[i], queue_size, penalty, OVERFLOW_BLOCK);
+}
+
+void partq_destroy(struct partq_t *p)
+{
+	uint32_t i;
+
+	for (i = 0; i < p->nr_parts; i++)
+		queue_destroy(&p->queues[i]);
+}
+
+/* Partition the key hashes to. */
+static inline uint32_t partq_home(struct partq_t *p, uint64_t key)
+{
+	return partq_hash(key) % p->nr_parts;
+}
+
+static struct partq_key *moved_find(struct partq_t *p, uint64_t key, int insert)
+{
+	uint32_t i = partq_hash(key) & (PARTQ_MAX_MOVED - 1), n;
+
+	for (n = 0; n < PARTQ_MAX_MOVED; n++) {
+		struct partq_key *m = &p->moved[i];
+
+		if (m->key == key + 1)
+			return m;
+		if (m->key == 0) {
+			if (!insert)
+				return NULL;
+			m->key = key + 1;
+			m->part = partq_home(p, key);
+			p->nr_moved ++;
+			return m;
+		}
+		i = (i + 1) & (PARTQ_MAX_MOVED - 1);
+	}
+	return NULL;
+}
+
+/* Frees the entry, shifting back the entries of its probe run that
+ * would no longer be found past the hole. */
+static void moved_delete(struct partq_t *p, struct partq_key *m)
+{
+	uint32_t i = m - p->moved, j = i, home;
+
+	p->moved[i].key = 0;
+	p->nr_moved --;
+	for (;;) {
+		j = (j + 1) & (PARTQ_MAX_MOVED - 1);
+		if (p->moved[j].key == 0)
+			break;
+		home = partq_hash(p->moved[j].key - 1) & (PARTQ_MAX_MOVED - 1);
+		/* Entry j may fill the hole at i unless its home slot lies
+		 * cyclically in (i, j]. */
+		if (i <= j ? (home > i && home <= j) : (home > i || home <= j))
+			continue;
+		p->moved[i] = p->moved[j];
+		p->moved[j].key = 0;
+		i = j;
+	}
+}
+
+/* Partition the key's elements currently go to. */
+uint32_t partq_route(struct partq_t *p, uint64_t key)
+{
+	struct partq_key *m;
+
+	if (p->nr_moved && (m = moved_find(p, key, 0)) != NULL)
+		return m->part;
+	return partq_home(p, key);
+}
+
+/* Keeps the keys seen most often since the last rebalance: a key takes
+ * over its slot only after the current holder has decayed to 0. */
+static inline void heat_note(struct partq_t *p, uint64_t key)
+{
+	struct partq_key *h = &p->heat[partq_hash(key) & (PARTQ_HEAT - 1)];
+
+	if (h->key == key + 1)
+		h->count ++;
+	else if (h->count == 0) {
+		h->key = key + 1;
+		h->count = 1;
+	} else
+		h->count --;
+}
+
+static void push(struct queue_t *q, ELEMENT_TYPE value)
+{
+	struct wait_state ws;
+
+	if (enqueue(q, value) == SUCCESS)
+		return;
+
+	q->full_counter ++;
+	q->traffic_full ++;
+	wait_init(&ws, q->wait);
+	do {
+		wait_for(&ws, q->penalty);
+	} while (enqueue(q, value) != SUCCESS);
+}
+
+static void lane_flush(struct partq_t *p, uint32_t i)
+{
+	struct partq_lane *l = &p->lanes[i];
+	uint32_t k;
+
+	for (k = 0; k < l->fill; k++)
+		push(&p->queues[i], l->buf[k]);
+	l->enqueued += l->fill;
+	l->window += l->fill;
+	l->fill = 0;
+}
+
+static inline void lane_append(struct partq_t *p, uint32_t i, ELEMENT_TYPE value)
+{
+	struct partq_lane *l = &p->lanes[i];
+
+	l->buf[l->fill++] = value;
+	if (l->fill == PARTQ_BATCH)
+		lane_flush(p, i);
+}
+
+/* Completes the move in progress once the old queue has drained up to
+ * the fence.  Returns 1 if no move is in progress anymore. */
+static int mig_try_finish(struct partq_t *p)
+{
+	struct partq_key *m;
+	uint32_t k;
+
+	if (!p->migrating)
+		return 1;
+	if (READ_ONCE(p->lanes[p->mig.part].consumed) < p->mig_fence)
+		return 0;
+
+	m = moved_find(p, p->mig.key, 0);
+	if (p->mig_to == partq_home(p, p->mig.key))
+		moved_delete(p, m);
+	else
+		m->part = p->mig_to;
+	for (k = 0; k < p->nr_pending; k++)
+		lane_append(p, p->mig_to, p->pending[k]);
+	p->nr_pending = 0;
+	p->migrating = 0;
+	p->moves ++;
+	return 1;
+}
+
+static void mig_wait(struct partq_t *p)
+{
+	struct wait_state ws;
+	struct queue_t *q = &p->queues[p->mig.part];
+
+	wait_init(&ws, q->wait);
+	while (!mig_try_finish(p))
+		wait_for(&ws, q->penalty);
+}
+
+/* Producer only.  Blocks while the destination queue is full, and
+ * while a moving key has filled the pending area. */
+void partq_enqueue(struct partq_t *p, uint64_t key, ELEMENT_TYPE value)
+{
+	heat_note(p, key);
+
+	if ( unlikely(p->migrating) && key == p->mig.key ) {
+		if ( !mig_try_finish(p) ) {
+			if (p->nr_pending < PARTQ_PENDING) {
+				p->pending[p->nr_pending++] = value;
+				return;
+			}
+			mig_wait(p);
+		}
+	}
+
+	lane_append(p, partq_route(p, key), value);
+}
+
+/* Writes out the buffered elements.  The producer calls it when it
+ * runs out of input, so that nothing stays behind in the buffers. */
+void partq_flush(struct partq_t *p)
+{
+	uint32_t i;
+
+	if ( unlikely(p->migrating) && !mig_try_finish(p) ) {
+		for (i = 0; i < p->nr_parts; i++)
+			lane_flush(p, i);
+		mig_wait(p);
+	}
+	for (i = 0; i < p->nr_parts; i++)
+		lane_flush(p, i);
+}
+
+/* Consumer of partition i only.  The element returned by the previous
+ * call is published as consumed first. */
+int partq_dequeue(struct partq_t *p, uint32_t i, ELEMENT_TYPE *value)
+{
+	struct partq_lane *l = &p->lanes[i];
+
+	if (l->consumed != l->taken)
+		WRITE_ONCE(l->consumed, l->taken);
+	if (dequeue(&p->queues[i], value) != SUCCESS)
+		return BUFFER_EMPTY;
+	l->taken ++;
+	return SUCCESS;
+}
+
+/* The key must have an entry in moved[] already. */
+static void mig_start(struct partq_t *p, uint64_t key, uint32_t from,
+		uint32_t to)
+{
+	/* Everything of the key enqueued so far must be consumed before
+	 * its new queue may be read. */
+	lane_flush(p, from);
+	p->mig.key = key;
+	p->mig.part = from;
+	p->mig_to = to;
+	p->mig_fence = p->lanes[from].enqueued;
+	p->nr_pending = 0;
+	p->migrating = 1;
+}
+
+/* Starts moving the key to partition `to'.  Returns 0 on success or if
+ * the key is already there, -1 if another move is still in progress or
+ * too many keys have been moved.  In the latter case the moved key
+ * under moved_hand starts going back home instead, which frees its
+ * entry for a later move. */
+int partq_move(struct partq_t *p, uint64_t key, uint32_t to)
+{
+	uint32_t from = partq_route(p, key), n;
+	struct partq_key *m;
+
+	if (to >= p->nr_parts || !mig_try_finish(p))
+		return -1;
+	if (from == to)
+		return 0;
+	if (moved_find(p, key, 1) != NULL) {
+		mig_start(p, key, from, to);
+		return 0;
+	}
+
+	p->refused ++;
+	for (n = 0; n < PARTQ_MAX_MOVED; n++) {
+		m = &p->moved[p->moved_hand];
+		p->moved_hand = (p->moved_hand + 1) & (PARTQ_MAX_MOVED - 1);
+		if (m->key) {
+			mig_start(p, m->key - 1, m->part, partq_home(p, m->key - 1));
+			break;
+		}
+	}
+	return -1;
+}
+
+/* Moves the hottest key that narrows the gap between the busiest and
+ * the idlest partition since the last call.  Returns 1 if a move was
+ * started. */
+int partq_rebalance(struct partq_t *p)
+{
+	uint32_t i, hi = 0, lo = 0, best = PARTQ_HEAT;
+	uint64_t gap, count = 0;
+	int moved = 0;
+
+	if (p->nr_parts < 2 || !mig_try_finish(p))
+		return 0;
+
+	for (i = 1; i < p->nr_parts; i++) {
+		if (p->lanes[i].window > p->lanes[hi].window)
+			hi = i;
+		if (p->lanes[i].window < p->lanes[lo].window)
+			lo = i;
+	}
+	gap = p->lanes[hi].window - p->lanes[lo].window;
+
+	/* Moving a key with count c changes the gap to |gap - 2c|, which
+	 * is smaller for any 0 < c < gap. */
+	for (i = 0; i < PARTQ_HEAT; i++) {
+		struct partq_key *h = &p->heat[i];
+
+		if (h->key == 0 || h->count <= count || h->count >= gap)
+			continue;
+		if (partq_route(p, h->key - 1) != hi)
+			continue;
+		best = i;
+		count = h->count;
+	}
+	if (best < PARTQ_HEAT && partq_move(p, p->heat[best].key - 1, lo) == 0)
+		moved = 1;
+
+	for (i = 0; i < p->nr_parts; i++)
+		p->lanes[i].window = 0;
+	for (i = 0; i < PARTQ_HEAT; i++)
+		p->heat[i].count >>= 1;
+	return moved;
+}
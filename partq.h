@@ -0,0 +1,105 @@
+/*
+ *  partq.h: Key-partitioned EQueue.  One producer hashes every element's
+ *  key to one of N queues, each drained by its own consumer, so that
+ *  elements of the same key stay in order while different keys are
+ *  processed in parallel.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_PARTQ_H_
+#define _FIFO_PARTQ_H_
+
+#include "fifo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_PARTS 16
+/* Elements buffered per partition before they are written to its
+ * queue in one go. */
+#define PARTQ_BATCH 32
+/* Keys that may be routed away from their hash partition at once.  A
+ * key moved back home frees its entry. */
+#define PARTQ_MAX_MOVED 256
+/* Elements of a moving key held back until its old queue drains. */
+#define PARTQ_PENDING 4096
+/* Slots of the producer's hot-key table. */
+#define PARTQ_HEAT 1024
+
+/* Per partition. */
+struct partq_lane {
+	/* Accessed by producer only. */
+	ELEMENT_TYPE buf[PARTQ_BATCH] __attribute__ ((aligned(128)));
+	uint32_t fill;
+	uint64_t enqueued;		/* elements written to the queue */
+	uint64_t window;		/* enqueued since the last rebalance */
+
+	/* Accessed by the partition's consumer. */
+	uint64_t consumed __attribute__ ((aligned(128)));	/* published */
+	uint64_t taken;
+};
+
+struct partq_key {
+	uint64_t key;
+	uint32_t count;
+	uint32_t part;
+};
+
+struct partq_t {
+	struct queue_t queues[MAX_PARTS];
+	struct partq_lane lanes[MAX_PARTS];
+
+	/* readonly data */
+	uint32_t nr_parts __attribute__ ((aligned(128)));
+
+	/* Accessed by producer only. */
+	/* Keys routed away from their hash partition (part is the
+	 * destination), open addressing on key + 1 so that 0 is free. */
+	struct partq_key moved[PARTQ_MAX_MOVED] __attribute__ ((aligned(128)));
+	uint32_t nr_moved;
+	uint32_t moved_hand;		/* next entry to send home when full */
+	/* Approximate per-key counts since the last rebalance. */
+	struct partq_key heat[PARTQ_HEAT];
+	/* The move in progress, if any: elements of mig.key wait in
+	 * pending until the consumer of mig.part has taken everything
+	 * enqueued there before the move started (mig_fence). */
+	int migrating;
+	struct partq_key mig;
+	uint32_t mig_to;
+	uint64_t mig_fence;
+	uint32_t nr_pending;
+	ELEMENT_TYPE pending[PARTQ_PENDING];
+	uint64_t moves;			/* completed key moves */
+	uint64_t refused;		/* moves refused, moved[] being full */
+};
+
+void partq_init(struct partq_t *, uint32_t, uint64_t, uint64_t);
+void partq_destroy(struct partq_t *);
+void partq_enqueue(struct partq_t *, uint64_t, ELEMENT_TYPE);
+void partq_flush(struct partq_t *);
+int partq_dequeue(struct partq_t *, uint32_t, ELEMENT_TYPE *);
+uint32_t partq_route(struct partq_t *, uint64_t);
+int partq_move(struct partq_t *, uint64_t, uint32_t);
+int partq_rebalance(struct partq_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
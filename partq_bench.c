@@ -0,0 +1,298 @@
+/*
+ *  partq_bench.c: Throughput and per-queue imbalance of the key-
+ *  partitioned EQueue (partq.c) under Zipf-distributed keys, with and
+ *  without hot-key rebalancing.
+ *
+ *  Every element carries its key and a per-key sequence number; the
+ *  consumers check that each key's elements arrive in order, also
+ *  across the moves of the rebalancer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "partq.h"
+
+#define DEFAULT_TEST_SIZE 4000000
+/* Element layout: key in the high bits, per-key sequence (from 1) in
+ * the low SEQ_BITS. */
+#define SEQ_BITS 40
+#define SEQ_MASK ((1UL << SEQ_BITS) - 1)
+/* Keys are drawn in advance, then replayed. */
+#define MAX_DRAWS (1UL << 22)
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t nr_keys = 10000;
+static uint32_t nr_parts = 4;
+static uint64_t workload = 200;
+static uint64_t rebalance_every = 16384;
+static uint64_t cores[MAX_PARTS + 1];
+static int nr_cores;
+
+static struct partq_t *pq;
+static uint64_t *draws;
+static uint64_t nr_draws;
+static uint64_t *last_seq;		/* per key, written by its consumer */
+static uint64_t order_errors[MAX_PARTS];
+static volatile int producer_done;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+/* Draw keys 0..nr_keys-1 with P(k) proportional to 1 / (k + 1)^theta,
+ * by inverting the CDF.  The keys are shuffled over the ranks so that
+ * the hot ones do not all hash alike. */
+static void zipf_draw(double theta)
+{
+	double *cdf = malloc(nr_keys * sizeof(double)), sum = 0;
+	uint64_t *perm = malloc(nr_keys * sizeof(uint64_t));
+	uint64_t i, seed = 88172645463325252UL, lo, hi, mid;
+	double u;
+
+	if (cdf == NULL || perm == NULL) {
+		printf("Error in allocating the key distribution.\n");
+		exit(-1);
+	}
+	for (i = 0; i < nr_keys; i++) {
+		sum += 1.0 / pow((double)(i + 1), theta);
+		cdf[i] = sum;
+		perm[i] = i;
+	}
+	for (i = nr_keys - 1; i > 0; i--) {
+		uint64_t j = xorshift(&seed) % (i + 1), t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+
+	for (i = 0; i < nr_draws; i++) {
+		u = (xorshift(&seed) >> 11) * (1.0 / (1UL << 53)) * sum;
+		lo = 0;
+		hi = nr_keys - 1;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (cdf[mid] < u)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		draws[i] = perm[lo];
+	}
+	free(cdf);
+	free(perm);
+}
+
+static void *consumer(void *arg)
+{
+	uint32_t i = (uint32_t)(uintptr_t)arg;
+	ELEMENT_TYPE value;
+	uint64_t key, seq;
+
+	if (nr_cores)
+		pin(cores[(i + 1) % nr_cores]);
+	for (;;) {
+		if (partq_dequeue(pq, i, &value) != SUCCESS) {
+			if (!producer_done)
+				continue;
+			/* Everything was enqueued before producer_done. */
+			if (partq_dequeue(pq, i, &value) != SUCCESS)
+				break;
+		}
+		key = value >> SEQ_BITS;
+		seq = value & SEQ_MASK;
+		if (seq != last_seq[key] + 1)
+			order_errors[i] ++;
+		last_seq[key] = seq;
+		if (workload)
+			wait_ticks(workload);
+	}
+	return NULL;
+}
+
+static void run_one(double theta, int rebalance)
+{
+	pthread_t cons[MAX_PARTS];
+	uint64_t *seq = calloc(nr_keys, sizeof(uint64_t));
+	uint64_t i, key, ns, sum = 0, max = 0, errors = 0;
+	uint32_t k;
+
+	if (seq == NULL) {
+		printf("Error in allocating key sequences.\n");
+		exit(-1);
+	}
+	memset(last_seq, 0, nr_keys * sizeof(uint64_t));
+	memset(order_errors, 0, sizeof(order_errors));
+	partq_init(pq, nr_parts, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY);
+	producer_done = 0;
+
+	ns = now_ns();
+	for (k = 0; k < nr_parts; k++)
+		pthread_create(&cons[k], NULL, consumer, (void *)(uintptr_t)k);
+	for (i = 0; i < test_size; i++) {
+		key = draws[i % nr_draws];
+		partq_enqueue(pq, key, (key << SEQ_BITS) | ++seq[key]);
+		if (rebalance && (i + 1) % rebalance_every == 0)
+			partq_rebalance(pq);
+	}
+	partq_flush(pq);
+	producer_done = 1;
+	for (k = 0; k < nr_parts; k++)
+		pthread_join(cons[k], NULL);
+	ns = now_ns() - ns;
+
+	printf("zipf %4.2f %-9s %8.3f Mitems/s", theta,
+			rebalance ? "rebalance" : "static", test_size * 1e3 / ns);
+	for (k = 0; k < nr_parts; k++) {
+		sum += pq->lanes[k].enqueued;
+		if (pq->lanes[k].enqueued > max)
+			max = pq->lanes[k].enqueued;
+		errors += order_errors[k];
+	}
+	printf("  max/mean %5.2f  moves %4lu  refused %4lu  order errors %lu  share:",
+			sum ? (double)max * nr_parts / sum : 0.0, pq->moves,
+			pq->refused, errors);
+	for (k = 0; k < nr_parts; k++)
+		printf(" %5.1f%%", sum ? 100.0 * pq->lanes[k].enqueued / sum : 0.0);
+	printf("\n");
+
+	partq_destroy(pq);
+	free(seq);
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	double thetas[16] = { 0, 0.8, 0.99, 1.2 };
+	int nr_thetas = 4, opt, t;
+	char *s, *save;
+
+	char * usage =
+		"Usage: partq_bench [-t test_size (default: 4,000,000)]\n\
+		[-n partitions/consumers (default: 4)]\n\
+		[-k keys (default: 10,000)]\n\
+		[-z Zipf skews, e.g. 0,0.99 (default: 0,0.8,0.99,1.2)]\n\
+		[-w consumer workload (default: 200 cycles)]\n\
+		[-r rebalance every r elements (default: 16384)]\n\
+		[-C cores, producer first, e.g. 0,2,4,6,8 (default: unpinned)]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "ht:n:k:z:w:r:C:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'n':
+				nr_parts = atoi(optarg);
+				break;
+			case 'k':
+				nr_keys = atoll(optarg);
+				break;
+			case 'z':
+				nr_thetas = 0;
+				for (s = strtok_r(optarg, ",", &save); s && nr_thetas < 16;
+						s = strtok_r(NULL, ",", &save))
+					thetas[nr_thetas++] = atof(s);
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'r':
+				rebalance_every = atoll(optarg);
+				break;
+			case 'C':
+				nr_cores = parse_list(optarg, cores, MAX_PARTS + 1);
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (nr_parts < 1 || nr_parts > MAX_PARTS || nr_keys < 1 ||
+			nr_keys >= (1UL << (64 - SEQ_BITS)) || rebalance_every == 0) {
+		printf("%s\n", usage);
+		exit(-1);
+	}
+
+	nr_draws = test_size < MAX_DRAWS ? test_size : MAX_DRAWS;
+	draws = malloc(nr_draws * sizeof(uint64_t));
+	last_seq = calloc(nr_keys, sizeof(uint64_t));
+	pq = aligned_alloc(128, sizeof(struct partq_t));
+	if (draws == NULL || last_seq == NULL || pq == NULL) {
+		printf("Error in allocating the benchmark.\n");
+		exit(-1);
+	}
+	if (nr_cores)
+		pin(cores[0]);
+
+	printf("===== %u partitions, %lu keys, %lu items, workload %lu cycles =====\n",
+			nr_parts, nr_keys, test_size, workload);
+	for (t = 0; t < nr_thetas; t++) {
+		zipf_draw(thetas[t]);
+		run_one(thetas[t], 0);
+		run_one(thetas[t], 1);
+	}
+
+	free(draws);
+	free(last_seq);
+	free(pq);
+	return 0;
+}
@@ -0,0 +1,738 @@
+/*
+ *  pcap_bench.c: Packet-processing pipeline fed from a pcap file.
+ *
+ *  A reader memory-maps a pcap file (Ethernet link type) and replays its
+ *  packets at the recorded timestamps, scaled by -x, or as fast as it
+ *  can.  Each packet becomes a descriptor (its replay sequence number)
+ *  that goes through three stages of workers connected by EQueues:
+ *
+ *    parse      Ethernet / VLAN / IPv4 / IPv6 and TCP/UDP ports into a
+ *               flow key
+ *    flowhash   hash of the flow key
+ *    aggregate  per-flow packet and byte counts, and the latency from
+ *               the reader's send to here
+ *
+ *  The descriptor indexes a table of per-packet metadata that the stages
+ *  fill in.  Without -f a synthetic trace is generated first (IMIX
+ *  sizes, skewed flow popularity, a share of ARP), so the benchmark runs
+ *  offline; -g keeps it in a file.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pipeline.h"
+#include "latency.h"
+#include "tsc.h"
+
+#define DEFAULT_PACKETS 200000
+#define DEFAULT_FLOWS 1024
+#define DEFAULT_RATE 1000000		/* generated packets per second */
+#define SNAP_LEN 96			/* bytes captured per generated packet */
+#define META_SIZE (1UL << 20)		/* descriptors in flight; power of two */
+#define META_MASK (META_SIZE - 1)
+#define FLOW_TABLE_SIZE (1UL << 16)	/* per aggregator; power of two */
+#define SPIN_LIMIT 100000		/* cycles the reader spins before yielding */
+
+#define PCAP_MAGIC_US 0xa1b2c3d4
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define LINKTYPE_ETHERNET 1
+
+#define ETH_IPV4 0x0800
+#define ETH_ARP 0x0806
+#define ETH_VLAN 0x8100
+#define ETH_IPV6 0x86dd
+#define IP_TCP 6
+#define IP_UDP 17
+
+struct pcap_hdr {
+	uint32_t magic;
+	uint16_t major;
+	uint16_t minor;
+	int32_t zone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec {
+	uint32_t sec;
+	uint32_t frac;			/* us or ns, after the magic */
+	uint32_t caplen;
+	uint32_t len;
+};
+
+/* One packet of the mapped file. */
+struct pkt_ref {
+	uint64_t ts_ns;
+	uint64_t off;			/* of the packet bytes */
+	uint32_t caplen;
+	uint32_t len;
+};
+
+/* IPv6 addresses are folded to 32 bits. */
+struct flow_key {
+	uint32_t src;
+	uint32_t dst;
+	uint16_t sport;
+	uint16_t dport;
+	uint8_t proto;			/* 0: not IP */
+	uint8_t pad[3];
+};
+
+struct pkt_meta {
+	uint64_t sent;			/* reader's TSC */
+	struct flow_key key;
+	uint32_t len;
+	uint32_t hash;
+};
+
+struct flow_entry {
+	struct flow_key key;
+	uint32_t hash;
+	uint64_t packets;		/* 0: free */
+	uint64_t bytes;
+};
+
+struct aggregator {
+	uint64_t packets __attribute__ ((aligned(128)));
+	uint64_t bytes;
+	uint64_t non_ip;
+	uint64_t table_full;		/* packets of flows that found no entry */
+	uint32_t flows;
+	struct flow_entry *table;
+	struct latency_hist lat;
+};
+
+/* The trace */
+static const uint8_t *map;
+static size_t map_len;
+static struct pkt_ref *refs;
+static uint64_t nr_pkts, span_ns;
+
+/* Reader */
+static double speed = 1.0;		/* 0: as fast as possible */
+static uint64_t start_tsc, window_end, late, max_lag;
+
+static struct pkt_meta *meta;
+static struct aggregator aggs[MAX_STAGE_WORKERS];
+static uint32_t nr_aggs;
+
+/* ---------------------------------------------------------------- */
+/* Trace generation and loading                                      */
+/* ---------------------------------------------------------------- */
+
+static uint64_t lcg(uint64_t *x)
+{
+	*x = *x * 6364136223846793005UL + 1442695040888963407UL;
+	return *x >> 33;
+}
+
+static void put16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v;
+}
+
+static void put32(uint8_t *p, uint32_t v)
+{
+	put16(p, v >> 16);
+	put16(p + 2, v);
+}
+
+/* Frame of `len' bytes of flow f; returns the bytes written to pkt. */
+static uint32_t build_packet(uint8_t *pkt, uint32_t f, uint32_t len, int arp)
+{
+	uint32_t proto = f & 1 ? IP_UDP : IP_TCP;
+
+	memset(pkt, 0, SNAP_LEN);
+	pkt[5] = 1;			/* dst 00:00:00:00:00:01 */
+	pkt[11] = 2;			/* src 00:00:00:00:00:02 */
+	if (arp) {
+		put16(pkt + 12, ETH_ARP);
+		return 42;
+	}
+	put16(pkt + 12, ETH_IPV4);
+	pkt[14] = 0x45;
+	put16(pkt + 16, len - 14);
+	pkt[22] = 64;			/* TTL */
+	pkt[23] = proto;
+	put32(pkt + 26, 0x0a000000 | f);		/* 10.x.y.z */
+	put32(pkt + 30, 0xc0a80000 | (f * 7 & 0xffff));	/* 192.168.x.y */
+	put16(pkt + 34, 1024 + f % 50000);
+	put16(pkt + 36, f & 2 ? 443 : 53);
+	return len < SNAP_LEN ? len : SNAP_LEN;
+}
+
+/* nr packets of nr_flows flows at about rate packets/s; sizes follow
+ * the simple IMIX (7:4:1 of 64, 576 and 1500 bytes), low flow numbers
+ * are the most popular, and one packet in 100 is ARP. */
+static int generate(const char *path, uint64_t nr, uint32_t nr_flows,
+		uint64_t rate)
+{
+	struct pcap_hdr h = { PCAP_MAGIC_US, 2, 4, 0, 0, SNAP_LEN,
+		LINKTYPE_ETHERNET };
+	uint8_t pkt[SNAP_LEN];
+	uint64_t i, x = 1, ts = 0, r;
+	struct pcap_rec rec;
+	uint32_t f, len;
+	int arp;
+	double u;
+	FILE *fp;
+
+	if ((fp = fopen(path, "w")) == NULL) {
+		printf("Error: cannot create %s.\n", path);
+		return -1;
+	}
+	fwrite(&h, sizeof(h), 1, fp);
+	for (i = 0; i < nr; i++) {
+		r = lcg(&x) % 12;
+		len = r < 7 ? 64 : (r < 11 ? 576 : 1500);
+		u = (double)lcg(&x) / (1UL << 31);
+		f = (uint32_t)(nr_flows * u * u * u);
+		arp = lcg(&x) % 100 == 0;
+		rec.caplen = build_packet(pkt, f, len, arp);
+		rec.len = arp ? rec.caplen : len;
+		/* Gaps uniform in [0, 2/rate). */
+		ts += lcg(&x) % (2000000000UL / rate + 1);
+		rec.sec = ts / 1000000000UL;
+		rec.frac = ts % 1000000000UL / 1000;
+		fwrite(&rec, sizeof(rec), 1, fp);
+		fwrite(pkt, rec.caplen, 1, fp);
+	}
+	if (fclose(fp) != 0) {
+		printf("Error: cannot write %s.\n", path);
+		return -1;
+	}
+	return 0;
+}
+
+static uint32_t swap32(uint32_t v, int swapped)
+{
+	return swapped ? __builtin_bswap32(v) : v;
+}
+
+/* Map the file and index its packets. */
+static int load(const char *path)
+{
+	const struct pcap_hdr *h;
+	const struct pcap_rec *rec;
+	uint64_t off, cap = 1024, ns;
+	int fd, swapped, nano;
+	struct stat st;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+		printf("Error: cannot open %s.\n", path);
+		return -1;
+	}
+	map_len = st.st_size;
+	if (map_len < sizeof(struct pcap_hdr)) {
+		printf("Error: %s is not a pcap file.\n", path);
+		close(fd);
+		return -1;
+	}
+	map = mmap(NULL, map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		printf("Error: cannot map %s.\n", path);
+		return -1;
+	}
+
+	h = (const struct pcap_hdr *)map;
+	swapped = h->magic == __builtin_bswap32(PCAP_MAGIC_US) ||
+		h->magic == __builtin_bswap32(PCAP_MAGIC_NS);
+	nano = swap32(h->magic, swapped) == PCAP_MAGIC_NS;
+	if (swap32(h->magic, swapped) != PCAP_MAGIC_US && !nano) {
+		printf("Error: %s is not a pcap file.\n", path);
+		return -1;
+	}
+	if (swap32(h->linktype, swapped) != LINKTYPE_ETHERNET) {
+		printf("Error: link type %u of %s is not Ethernet.\n",
+				swap32(h->linktype, swapped), path);
+		return -1;
+	}
+
+	refs = malloc(cap * sizeof(struct pkt_ref));
+	nr_pkts = 0;
+	for (off = sizeof(struct pcap_hdr); off + sizeof(struct pcap_rec) <= map_len;
+			off += sizeof(struct pcap_rec) + refs[nr_pkts++].caplen) {
+		rec = (const struct pcap_rec *)(map + off);
+		if (off + sizeof(struct pcap_rec) + swap32(rec->caplen, swapped) > map_len)
+			break;			/* truncated last record */
+		if (nr_pkts == cap) {
+			cap <<= 1;
+			refs = realloc(refs, cap * sizeof(struct pkt_ref));
+		}
+		if (refs == NULL) {
+			printf("Error in allocating the packet index.\n");
+			return -1;
+		}
+		ns = swap32(rec->frac, swapped);
+		refs[nr_pkts].ts_ns = swap32(rec->sec, swapped) * 1000000000UL +
+			(nano ? ns : ns * 1000);
+		refs[nr_pkts].off = off + sizeof(struct pcap_rec);
+		refs[nr_pkts].caplen = swap32(rec->caplen, swapped);
+		refs[nr_pkts].len = swap32(rec->len, swapped);
+	}
+	if (nr_pkts == 0) {
+		printf("Error: no packets in %s.\n", path);
+		return -1;
+	}
+	/* A loop of the trace lasts one mean gap longer than the trace. */
+	span_ns = refs[nr_pkts - 1].ts_ns - refs[0].ts_ns;
+	if (nr_pkts > 1)
+		span_ns += span_ns / (nr_pkts - 1);
+	return 0;
+}
+
+/* ---------------------------------------------------------------- */
+/* Stages                                                            */
+/* ---------------------------------------------------------------- */
+
+static inline struct pkt_ref *ref_of(ELEMENT_TYPE seq)
+{
+	return &refs[(seq - 1) % nr_pkts];
+}
+
+static uint64_t completed(void)
+{
+	uint64_t n = 0;
+	uint32_t i;
+
+	for (i = 0; i < nr_aggs; i++)
+		n += READ_ONCE(aggs[i].packets);
+	return n;
+}
+
+static ELEMENT_TYPE reader_fn(ELEMENT_TYPE seq, void *arg)
+{
+	struct pkt_ref *r = ref_of(seq);
+	uint64_t due, now, loop = (seq - 1) / nr_pkts;
+
+	/* Keep at most half of the metadata table in flight, so that no
+	 * slot is reused while its descriptor is still in a queue. */
+	while (seq > window_end) {
+		window_end = completed() + META_SIZE / 2;
+		if (seq > window_end)
+			sched_yield();
+	}
+	if (seq == 1)
+		start_tsc = rdtsc_bare();
+	if (speed > 0) {
+		due = start_tsc + (uint64_t)((loop * span_ns + r->ts_ns -
+					refs[0].ts_ns) / speed * tsc_clock.ticks_per_ns);
+		while ((now = rdtsc_bare()) < due) {
+			if (due - now > SPIN_LIMIT)
+				sched_yield();
+		}
+		/* Behind schedule by more than a microsecond. */
+		if (now - due > tsc_clock.ticks_per_ns * 1000) {
+			late ++;
+			if (now - due > max_lag)
+				max_lag = now - due;
+		}
+	}
+	meta[seq & META_MASK].sent = rdtsc_bare();
+	return seq;
+}
+
+static ELEMENT_TYPE parse_fn(ELEMENT_TYPE seq, void *arg)
+{
+	struct pkt_meta *m = &meta[seq & META_MASK];
+	struct pkt_ref *r = ref_of(seq);
+	const uint8_t *p = map + r->off, *l4 = NULL;
+	uint32_t caplen = r->caplen, ihl, k;
+	uint16_t type;
+
+	memset(&m->key, 0, sizeof(struct flow_key));
+	m->len = r->len;
+	if (caplen < 14)
+		return seq;
+	type = p[12] << 8 | p[13];
+	p += 14;
+	caplen -= 14;
+	if (type == ETH_VLAN && caplen >= 4) {
+		type = p[2] << 8 | p[3];
+		p += 4;
+		caplen -= 4;
+	}
+	if (type == ETH_IPV4 && caplen >= 20) {
+		ihl = (p[0] & 0xf) * 4;
+		m->key.proto = p[9];
+		memcpy(&m->key.src, p + 12, 4);
+		memcpy(&m->key.dst, p + 16, 4);
+		if (ihl >= 20 && caplen >= ihl + 4)
+			l4 = p + ihl;
+	}
+	else if (type == ETH_IPV6 && caplen >= 40) {
+		m->key.proto = p[6];
+		for (k = 0; k < 16; k += 4) {
+			m->key.src ^= *(const uint32_t *)(p + 8 + k);
+			m->key.dst ^= *(const uint32_t *)(p + 24 + k);
+		}
+		if (caplen >= 44)
+			l4 = p + 40;
+	}
+	if (l4 && (m->key.proto == IP_TCP || m->key.proto == IP_UDP)) {
+		m->key.sport = l4[0] << 8 | l4[1];
+		m->key.dport = l4[2] << 8 | l4[3];
+	}
+	return seq;
+}
+
+static inline uint32_t key_hash(const struct flow_key *k)
+{
+	uint64_t h = ((uint64_t)k->src << 32 | k->dst) * 0x9E3779B97F4A7C15UL;
+
+	h ^= ((uint64_t)k->sport << 24 | (uint64_t)k->dport << 8 | k->proto) *
+		0xC2B2AE3D27D4EB4FUL;
+	h ^= h >> 29;
+	return (uint32_t)(h ^ h >> 32);
+}
+
+static ELEMENT_TYPE flowhash_fn(ELEMENT_TYPE seq, void *arg)
+{
+	struct pkt_meta *m = &meta[seq & META_MASK];
+
+	m->hash = key_hash(&m->key);
+	return seq;
+}
+
+/* Entry of key in a table of size entries (open addressing); NULL if
+ * the table is full. */
+static struct flow_entry *flow_lookup(struct flow_entry *table,
+		uint64_t size, const struct flow_key *key, uint32_t hash)
+{
+	uint64_t i, k;
+
+	for (k = 0, i = hash & (size - 1); k < size; k++, i = (i + 1) & (size - 1)) {
+		if (table[i].packets == 0) {
+			table[i].key = *key;
+			table[i].hash = hash;
+			return &table[i];
+		}
+		if (table[i].hash == hash &&
+				memcmp(&table[i].key, key, sizeof(*key)) == 0)
+			return &table[i];
+	}
+	return NULL;
+}
+
+static ELEMENT_TYPE aggregate_fn(ELEMENT_TYPE seq, void *arg)
+{
+	struct aggregator *a = (struct aggregator *)arg;
+	struct pkt_meta *m = &meta[seq & META_MASK];
+	struct flow_entry *e;
+
+	latency_record(&a->lat, tsc_sub_overhead(rdtsc_bare() - m->sent));
+	if (m->key.proto == 0)
+		a->non_ip ++;
+	else if ((e = flow_lookup(a->table, FLOW_TABLE_SIZE, &m->key, m->hash))) {
+		if (e->packets == 0)
+			a->flows ++;
+		e->packets ++;
+		e->bytes += m->len;
+	}
+	else
+		a->table_full ++;
+	a->bytes += m->len;
+	WRITE_ONCE(a->packets, a->packets + 1);
+	return 0;
+}
+
+/* ---------------------------------------------------------------- */
+/* Reporting                                                         */
+/* ---------------------------------------------------------------- */
+
+/* Final size and resize events of the queues between each two stages. */
+static void report_queues(struct pipeline_t *p)
+{
+	uint32_t s, i, n, size, min, max;
+	uint64_t sum, enlarges, shrinks;
+	char name[32];
+
+	printf("%-20s %6s %8s %8s %8s %9s %8s\n", "queues", "count",
+			"min", "avg", "max", "enlarges", "shrinks");
+	for (s = 0; s + 1 < p->nr_stages; s++) {
+		n = p->stages[s].parallelism * p->stages[s + 1].parallelism;
+		min = ~0U;
+		max = 0;
+		sum = enlarges = shrinks = 0;
+		for (i = 0; i < n; i++) {
+			size = p->queues[s][i].info.queue_size;
+			min = size < min ? size : min;
+			max = size > max ? size : max;
+			sum += size;
+			enlarges += p->queues[s][i].enlarges;
+			shrinks += p->queues[s][i].shrink_success;
+		}
+		snprintf(name, sizeof(name), "%s->%s", p->stages[s].name,
+				p->stages[s + 1].name);
+		printf("%-20s %6u %8u %8.0f %8u %9lu %8lu\n", name, n, min,
+				(double)sum / n, max, enlarges, shrinks);
+	}
+}
+
+static void report_flows(void)
+{
+	uint64_t size = FLOW_TABLE_SIZE * nr_aggs, packets = 0, non_ip = 0;
+	uint64_t full = 0, top = 0, flows = 0, k;
+	struct flow_entry *all, *e;
+	uint32_t i;
+
+	all = calloc(size, sizeof(struct flow_entry));
+	if (all == NULL)
+		return;
+	for (i = 0; i < nr_aggs; i++) {
+		packets += aggs[i].packets;
+		non_ip += aggs[i].non_ip;
+		full += aggs[i].table_full;
+		for (k = 0; k < FLOW_TABLE_SIZE; k++) {
+			if (aggs[i].table[k].packets == 0)
+				continue;
+			e = flow_lookup(all, size, &aggs[i].table[k].key,
+					aggs[i].table[k].hash);
+			if (e->packets == 0)
+				flows ++;
+			e->packets += aggs[i].table[k].packets;
+			e->bytes += aggs[i].table[k].bytes;
+			top = e->packets > top ? e->packets : top;
+		}
+	}
+	printf("flows: %lu, top flow %.1f%% of packets, non-IP %lu, "
+			"table overflow %lu\n", flows,
+			packets ? 100.0 * top / packets : 0.0, non_ip, full);
+	free(all);
+}
+
+static void report_latency(void)
+{
+	struct latency_hist lat;
+	uint32_t i;
+	int k;
+
+	memset(&lat, 0, sizeof(lat));
+	for (i = 0; i < nr_aggs; i++) {
+		lat.count += aggs[i].lat.count;
+		lat.sum += aggs[i].lat.sum;
+		if (aggs[i].lat.max > lat.max)
+			lat.max = aggs[i].lat.max;
+		for (k = 0; k < 65; k++)
+			lat.hist[k] += aggs[i].lat.hist[k];
+	}
+	printf("latency reader->aggregate: avg %.0f, p50 < %.0f, p99 < %.0f, "
+			"p99.9 < %.0f, max %.0f %s\n", tsc_out(latency_avg(&lat)),
+			tsc_out(latency_percentile(&lat, 50)),
+			tsc_out(latency_percentile(&lat, 99)),
+			tsc_out(latency_percentile(&lat, 99.9)),
+			tsc_out(lat.max), tsc_unit());
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t nr_gen = DEFAULT_PACKETS, rate = DEFAULT_RATE, loops = 1;
+	uint64_t queue_size = DEFAULT_QUEUE_SIZE, penalty = DEFAULT_PENALTY;
+	uint64_t par[3] = { 1, 1, 1 }, cores[4 * MAX_STAGE_WORKERS], bytes;
+	uint32_t nr_flows = DEFAULT_FLOWS, s, i;
+	const char *names[4] = { "reader", "parse", "flowhash", "aggregate" };
+	stage_fn_t fns[4] = { reader_fn, parse_fn, flowhash_fn, aggregate_fn };
+	char tmp[] = "/tmp/pcap_bench.XXXXXX";
+	const char *path = NULL, *gen_path = NULL;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	int nr_cores = 0, next_core = 0, opt, fd;
+	struct stage_desc stages[4];
+	struct pipeline_t *p;
+	char pace[32];
+	double secs;
+
+	char * usage =
+		"Usage: pcap_bench [-f pcap file (default: generate one)]\n\
+		[-g generate the trace into this file and keep it]\n\
+		[-n packets to generate (default: 200,000)]\n\
+		[-F flows to generate (default: 1024)]\n\
+		[-r generated packet rate (default: 1,000,000 packets/s)]\n\
+		[-x replay speed: 1 recorded, k k times faster, 0 as fast as possible (default: 1)]\n\
+		[-l loops over the trace (default: 1)]\n\
+		[-P workers of parse, flowhash and aggregate, e.g. 2,1,2 (default: 1,1,1)]\n\
+		[-C cores in worker order, reader first (default: spread over online CPUs)]\n\
+		[-q queue_size  (default: 1024*2 )]\n\
+		[-p penalty     (default: 1000 cycles)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNf:g:n:F:r:x:l:P:C:q:p:")) != -1) {
+		switch (opt) {
+			case 'f':
+				path = optarg;
+				break;
+			case 'g':
+				gen_path = optarg;
+				break;
+			case 'n':
+				nr_gen = atoll(optarg);
+				break;
+			case 'F':
+				nr_flows = atoi(optarg);
+				break;
+			case 'r':
+				rate = atoll(optarg);
+				break;
+			case 'x':
+				speed = atof(optarg);
+				break;
+			case 'l':
+				loops = atoll(optarg);
+				break;
+			case 'P':
+				parse_list(optarg, par, 3);
+				break;
+			case 'C':
+				nr_cores = parse_list(optarg, cores, 4 * MAX_STAGE_WORKERS);
+				break;
+			case 'q':
+				queue_size = atoll(optarg);
+				break;
+			case 'p':
+				penalty = atoll(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (nr_gen < 1 || nr_flows < 1 || rate < 1 || loops < 1 || speed < 0) {
+		printf("%s\n", usage);
+		exit(-1);
+	}
+
+	if (path == NULL) {
+		if (gen_path == NULL) {
+			if ((fd = mkstemp(tmp)) < 0) {
+				printf("Error: cannot create a temporary file.\n");
+				exit(-1);
+			}
+			close(fd);
+			path = tmp;
+		}
+		else
+			path = gen_path;
+		printf("===== Generating %lu packets of %u flows at %lu packets/s "
+				"into %s =====\n", nr_gen, nr_flows, rate, path);
+		if (generate(path, nr_gen, nr_flows, rate) != 0)
+			exit(-1);
+	}
+	if (load(path) != 0)
+		exit(-1);
+	/* The mapping keeps a temporary trace alive. */
+	if (path == tmp)
+		unlink(tmp);
+
+	tsc_init();
+	meta = aligned_alloc(128, META_SIZE * sizeof(struct pkt_meta));
+	if (meta == NULL) {
+		printf("Error in allocating packet metadata.\n");
+		exit(-1);
+	}
+
+	memset(stages, 0, sizeof(stages));
+	for (s = 0; s < 4; s++) {
+		stages[s].name = names[s];
+		stages[s].fn = fns[s];
+		stages[s].parallelism = s ? par[s - 1] : 1;
+		if (stages[s].parallelism < 1 ||
+				stages[s].parallelism > MAX_STAGE_WORKERS) {
+			printf("Error: workers per stage must be in [1, %d].\n",
+					MAX_STAGE_WORKERS);
+			exit(-1);
+		}
+		for (i = 0; i < stages[s].parallelism; i++, next_core++)
+			stages[s].cores[i] = nr_cores ?
+				(int)cores[next_core % nr_cores] : next_core % ncpu;
+	}
+	nr_aggs = stages[3].parallelism;
+	for (i = 0; i < nr_aggs; i++) {
+		aggs[i].table = calloc(FLOW_TABLE_SIZE, sizeof(struct flow_entry));
+		if (aggs[i].table == NULL) {
+			printf("Error in allocating flow tables.\n");
+			exit(-1);
+		}
+		stages[3].worker_arg[i] = &aggs[i];
+	}
+
+	p = pipeline_create(stages, 4, queue_size, penalty);
+	if (p == NULL)
+		exit(-1);
+	secs = span_ns / 1e9;
+	if (speed > 0)
+		snprintf(pace, sizeof(pace), "x%g", speed);
+	else
+		snprintf(pace, sizeof(pace), "max");
+	printf("===== %s: %lu packets, %.3f s, %lu loop(s), speed %s =====\n",
+			path == tmp ? "generated trace" : path, nr_pkts, secs, loops,
+			pace);
+	if (pipeline_run(p, nr_pkts * loops) != 0) {
+		pipeline_destroy(p);
+		exit(-1);
+	}
+
+	pipeline_report(p, stdout);
+	report_queues(p);
+	report_latency();
+	report_flows();
+	secs = p->run_ns / 1e9;
+	for (i = 0, bytes = 0; i < nr_aggs; i++)
+		bytes += aggs[i].bytes;
+	printf("packets: %lu in %.3f s, %.3f Mpps, %.3f Gbit/s; reader late %lu "
+			"(max %.0f us)\n", completed(), secs, completed() / secs / 1e6,
+			8.0 * bytes / secs / 1e9, late, tsc_to_ns(max_lag) / 1e3);
+
+	pipeline_destroy(p);
+	for (i = 0; i < nr_aggs; i++)
+		free(aggs[i].table);
+	free(meta);
+	free(refs);
+	munmap((void *)map, map_len);
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ *  perf.c: Per-thread hardware performance counters for the benchmarks.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "perf.h"
+
+#define CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+struct perf_event_desc {
+	const char *name;
+	uint32_t type;
+	uint64_t config;
+	int intel_only;
+};
+
+/* The raw events use the same encoding (umask << 8 | event) from
+ * Skylake to Sapphire Rapids: OFFCORE_REQUESTS.DEMAND_DATA_RD and
+ * MEM_LOAD_L3_HIT_RETIRED.XSNP_HITM (XSNP_FWD on newer cores). */
+static const struct perf_event_desc perf_events[NR_PERF_EVENTS] = {
+	[PERF_INSTRUCTIONS] = { "instr", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_INSTRUCTIONS, 0 },
+	[PERF_CYCLES] = { "cycles", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_CPU_CYCLES, 0 },
+	[PERF_BRANCH_MISSES] = { "br-miss", PERF_TYPE_HARDWARE,
+		PERF_COUNT_HW_BRANCH_MISSES, 0 },
+	[PERF_L1D_MISSES] = { "L1d-miss", PERF_TYPE_HW_CACHE,
+		CACHE_MISS(PERF_COUNT_HW_CACHE_L1D), 0 },
+	[PERF_LLC_MISSES] = { "LLC-miss", PERF_TYPE_HW_CACHE,
+		CACHE_MISS(PERF_COUNT_HW_CACHE_LL), 0 },
+	[PERF_DTLB_MISSES] = { "dTLB-miss", PERF_TYPE_HW_CACHE,
+		CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB), 0 },
+	[PERF_OFFCORE_RD] = { "offcore-rd", PERF_TYPE_RAW, 0x01b0, 1 },
+	[PERF_HITM] = { "HITM", PERF_TYPE_RAW, 0x04d2, 1 },
+};
+
+static int is_intel(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	__asm__ __volatile__("cpuid"
+			: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+			: "a"(0), "c"(0));
+	return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e;
+}
+
+int perf_open(struct perf_counters *pc)
+{
+	struct perf_event_attr attr;
+	int intel = is_intel();
+	int err[NR_PERF_EVENTS] = { 0 };
+	int k;
+
+	memset(pc, 0, sizeof(*pc));
+	for (k = 0; k < NR_PERF_EVENTS; k++) {
+		pc->fd[k] = -1;
+		if (perf_events[k].intel_only && !intel)
+			continue;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = perf_events[k].type;
+		attr.config = perf_events[k].config;
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+			PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		/* This thread, any CPU. */
+		pc->fd[k] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+		if (pc->fd[k] < 0) {
+			err[k] = errno;
+			pc->fd[k] = -1;
+			continue;
+		}
+		pc->nr_open ++;
+	}
+
+	if (pc->nr_open == 0) {
+		printf("perf: no hardware counters available (%s), running without them\n",
+				strerror(err[PERF_CYCLES]));
+		return 0;
+	}
+	for (k = 0; k < NR_PERF_EVENTS; k++)
+		if (err[k])
+			printf("perf: %s unavailable (%s)\n",
+					perf_events[k].name, strerror(err[k]));
+	return pc->nr_open;
+}
+
+void perf_start(struct perf_counters *pc)
+{
+	int k;
+
+	for (k = 0; k < NR_PERF_EVENTS; k++) {
+		if (pc->fd[k] < 0)
+			continue;
+		ioctl(pc->fd[k], PERF_EVENT_IOC_RESET, 0);
+		ioctl(pc->fd[k], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void perf_stop(struct perf_counters *pc)
+{
+	uint64_t buf[3];	/* value, time enabled, time running */
+	int k;
+
+	for (k = 0; k < NR_PERF_EVENTS; k++) {
+		if (pc->fd[k] < 0)
+			continue;
+		ioctl(pc->fd[k], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(pc->fd[k], buf, sizeof(buf)) != sizeof(buf)) {
+			close(pc->fd[k]);
+			pc->fd[k] = -1;
+			continue;
+		}
+		if (buf[2] == 0)
+			pc->value[k] = 0;
+		else if (buf[2] < buf[1])
+			pc->value[k] = (uint64_t)((double)buf[0] * buf[1] / buf[2]);
+		else
+			pc->value[k] = buf[0];
+	}
+}
+
+void perf_close(struct perf_counters *pc)
+{
+	int k;
+
+	for (k = 0; k < NR_PERF_EVENTS; k++) {
+		if (pc->fd[k] >= 0)
+			close(pc->fd[k]);
+		pc->fd[k] = -1;
+	}
+	pc->nr_open = 0;
+}
+
+void perf_report(FILE *out, const char *who, struct perf_counters *pc,
+		uint64_t ops)
+{
+	int k;
+
+	fprintf(out, "%s perf/op:", who);
+	for (k = 0; k < NR_PERF_EVENTS; k++) {
+		if (pc->fd[k] < 0)
+			fprintf(out, " %s n/a", perf_events[k].name);
+		else
+			fprintf(out, " %s %.3f", perf_events[k].name,
+					ops ? (double)pc->value[k] / ops : 0.0);
+	}
+	if (pc->fd[PERF_INSTRUCTIONS] >= 0 && pc->fd[PERF_CYCLES] >= 0 &&
+			pc->value[PERF_CYCLES])
+		fprintf(out, " IPC %.2f", (double)pc->value[PERF_INSTRUCTIONS] /
+				pc->value[PERF_CYCLES]);
+	fprintf(out, "\n");
+}
@@ -0,0 +1,57 @@
+/*
+ *  perf.h: Per-thread hardware performance counters for the benchmarks,
+ *  read through perf_event_open(2).
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _EQUEUE_PERF_H_
+#define _EQUEUE_PERF_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define PERF_INSTRUCTIONS 0
+#define PERF_CYCLES 1
+#define PERF_BRANCH_MISSES 2
+#define PERF_L1D_MISSES 3
+#define PERF_LLC_MISSES 4
+#define PERF_DTLB_MISSES 5
+#define PERF_OFFCORE_RD 6	/* Intel only: demand data reads sent to the uncore */
+#define PERF_HITM 7		/* Intel only: loads hitting a modified line in another core */
+#define NR_PERF_EVENTS 8
+
+/* One set per thread.  A counter the kernel or the CPU does not
+ * provide has fd -1 and is reported as "n/a"; the others still work. */
+struct perf_counters {
+	int fd[NR_PERF_EVENTS];
+	uint64_t value[NR_PERF_EVENTS];
+	int nr_open;
+};
+
+/* Open the counters for the calling thread, disabled.  Returns the
+ * number of counters opened (0 if perf is unavailable). */
+int perf_open(struct perf_counters *);
+void perf_start(struct perf_counters *);
+/* Stop counting and read the values, scaled if the kernel multiplexed
+ * the counters. */
+void perf_stop(struct perf_counters *);
+void perf_close(struct perf_counters *);
+/* Print one line of counts per operation. */
+void perf_report(FILE *, const char *, struct perf_counters *, uint64_t);
+
+#endif
@@ -0,0 +1,455 @@
+/*
+ *  pipeline.c: Multi-stage pipeline runtime wired by EQueues.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "pipeline.h"
+#include <sched.h>
+#include <time.h>
+#include "wait.h"
+
+/* Input queue occupancy is sampled once every OCCUPANCY_SAMPLE items. */
+#define OCCUPANCY_SAMPLE (256UL)
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static struct queue_t *alloc_queues(uint32_t n, uint64_t queue_size,
+		uint64_t penalty)
+{
+	struct queue_t *qs;
+	uint32_t i;
+
+	qs = aligned_alloc(128, n * sizeof(struct queue_t));
+	if (qs == NULL) {
+		printf("Error in allocating pipeline queues.\n");
+		exit(-1);
+	}
+	for (i = 0; i < n; i++)
+		queue_init(&qs[i], queue_size, penalty, OVERFLOW_BLOCK);
+	return qs;
+}
+
+struct pipeline_t *pipeline_create(const struct stage_desc *stages,
+		uint32_t nr_stages, uint64_t queue_size, uint64_t penalty)
+{
+	struct pipeline_t *p;
+	uint32_t s, i, j;
+
+	if (nr_stages < 2 || nr_stages > MAX_STAGES) {
+		printf("Error: a pipeline needs 2 to %d stages.\n", MAX_STAGES);
+		return NULL;
+	}
+	for (s = 0; s < nr_stages; s++) {
+		if (stages[s].parallelism < 1 ||
+				stages[s].parallelism > MAX_STAGE_WORKERS) {
+			printf("Error: stage %u parallelism must be in [1, %d].\n",
+					s, MAX_STAGE_WORKERS);
+			return NULL;
+		}
+		if (stages[s].reorder && (s == 0 || stages[s].parallelism != 1 ||
+					stages[0].parallelism != 1)) {
+			printf("Error: reorder stage %u needs parallelism 1, "
+					"and so does the source.\n", s);
+			return NULL;
+		}
+	}
+
+	p = calloc(1, sizeof(struct pipeline_t));
+	if (p == NULL)
+		return NULL;
+	p->nr_stages = nr_stages;
+	memcpy(p->stages, stages, nr_stages * sizeof(struct stage_desc));
+
+	for (s = 0; s + 1 < nr_stages; s++)
+		p->queues[s] = alloc_queues(stages[s].parallelism *
+				stages[s + 1].parallelism, queue_size, penalty);
+
+	for (s = 0; s < nr_stages; s++) {
+		uint32_t par = stages[s].parallelism;
+		uint32_t par_prev = s > 0 ? stages[s - 1].parallelism : 0;
+		uint32_t par_next = s + 1 < nr_stages ? stages[s + 1].parallelism : 0;
+
+		p->workers[s] = aligned_alloc(128, par * sizeof(struct pipe_worker));
+		if (p->workers[s] == NULL) {
+			printf("Error in allocating pipeline workers.\n");
+			exit(-1);
+		}
+		memset(p->workers[s], 0, par * sizeof(struct pipe_worker));
+
+		for (i = 0; i < par; i++) {
+			struct pipe_worker *w = &p->workers[s][i];
+
+			w->p = p;
+			w->stage = s;
+			w->index = i;
+			w->core = stages[s].cores[i];
+			w->nr_in = par_prev;
+			w->nr_out = par_next;
+			w->in = calloc(par_prev + 1, sizeof(struct queue_t *));
+			w->out = calloc(par_next + 1, sizeof(struct queue_t *));
+			for (j = 0; j < par_prev; j++)
+				w->in[j] = &p->queues[s - 1][j * par + i];
+			for (j = 0; j < par_next; j++)
+				w->out[j] = &p->queues[s][i * par_next + j];
+			/* Spread the starting point of the round robin. */
+			w->rr = par_next ? i % par_next : 0;
+			if (stages[s].reorder) {
+				w->reorder = malloc(sizeof(struct reorder_t));
+				if (w->reorder == NULL || reorder_init(w->reorder,
+							w->in, par_prev, stages[s].reorder,
+							1, PIPE_EOS, stages[s].seq) != 0) {
+					printf("Error in allocating the reorder stage.\n");
+					exit(-1);
+				}
+			}
+		}
+	}
+
+	return p;
+}
+
+void pipeline_destroy(struct pipeline_t *p)
+{
+	uint32_t s, i;
+
+	for (s = 0; s < p->nr_stages; s++) {
+		for (i = 0; i < p->stages[s].parallelism; i++) {
+			free(p->workers[s][i].in);
+			free(p->workers[s][i].out);
+			if (p->workers[s][i].reorder) {
+				reorder_destroy(p->workers[s][i].reorder);
+				free(p->workers[s][i].reorder);
+			}
+		}
+		free(p->workers[s]);
+	}
+	for (s = 0; s + 1 < p->nr_stages; s++) {
+		for (i = 0; i < p->stages[s].parallelism *
+				p->stages[s + 1].parallelism; i++)
+			queue_destroy(&p->queues[s][i]);
+		free(p->queues[s]);
+	}
+	free(p);
+}
+
+/* Index of the output queue for the next element.  JSQ reads the
+ * consumer index of every output queue, but stops at the first empty
+ * one; starting the scan at the round-robin position spreads ties. */
+static uint32_t pipe_pick(struct pipe_worker *w)
+{
+	uint32_t j = w->rr, k, best = w->rr;
+	uint64_t n, min;
+
+	if (++w->rr == w->nr_out)
+		w->rr = 0;
+	if (w->p->stages[w->stage].dispatch != PIPE_DISPATCH_JSQ)
+		return best;
+
+	min = queue_occupancy(w->out[best]);
+	for (k = 1; k < w->nr_out && min > 0; k++) {
+		if (++j == w->nr_out)
+			j = 0;
+		n = queue_occupancy(w->out[j]);
+		if (n < min) {
+			min = n;
+			best = j;
+		}
+	}
+	return best;
+}
+
+static void pipe_send(struct pipe_worker *w, uint32_t j, ELEMENT_TYPE value)
+{
+	struct queue_t *q = w->out[j];
+	struct wait_state ws;
+	uint64_t start;
+
+	if (enqueue(q, value) == SUCCESS)
+		return;
+
+	w->full_stalls ++;
+	q->full_counter ++;
+	q->traffic_full ++;
+	wait_init(&ws, q->wait);
+	start = rdtsc_bare();
+	do {
+		wait_for(&ws, q->penalty);
+	} while (enqueue(q, value) != SUCCESS);
+	w->full_cycles += rdtsc_bare() - start;
+}
+
+static void send_eos(struct pipe_worker *w)
+{
+	uint32_t j;
+
+	for (j = 0; j < w->nr_out; j++)
+		pipe_send(w, j, PIPE_EOS);
+}
+
+static void run_source(struct pipe_worker *w, struct stage_desc *sd)
+{
+	void *arg = sd->worker_arg[w->index] ? sd->worker_arg[w->index] : sd->arg;
+	uint64_t seq;
+	ELEMENT_TYPE out;
+
+	for (seq = w->first; seq < w->last; seq++) {
+		w->items_in ++;
+		out = sd->fn((ELEMENT_TYPE)seq, arg);
+		if (out) {
+			pipe_send(w, pipe_pick(w), out);
+			w->items_out ++;
+		}
+	}
+}
+
+static void run_stage(struct pipe_worker *w, struct stage_desc *sd)
+{
+	struct queue_t *active[MAX_STAGE_WORKERS];
+	uint32_t nr_active = w->nr_in, cur = 0, misses = 0;
+	uint64_t empty_start = 0;
+	void *arg = sd->worker_arg[w->index] ? sd->worker_arg[w->index] : sd->arg;
+	ELEMENT_TYPE value, out;
+	struct wait_state ws;
+
+	memcpy(active, w->in, nr_active * sizeof(struct queue_t *));
+	wait_init(&ws, w->nr_in ? w->in[0]->wait : wait_default);
+
+	while (nr_active > 0) {
+		struct queue_t *q = active[cur];
+
+		if (dequeue(q, &value) != SUCCESS) {
+			if (++misses == nr_active) {
+				/* A whole sweep found nothing. */
+				if (empty_start == 0) {
+					uint32_t k;
+					w->empty_stalls ++;
+					for (k = 0; k < nr_active; k++) {
+						active[k]->empty_counter ++;
+						active[k]->traffic_empty ++;
+					}
+					empty_start = rdtsc_bare();
+				}
+				wait_idle(&ws, NULL);
+				misses = 0;
+			}
+			if (++cur >= nr_active)
+				cur = 0;
+			continue;
+		}
+
+		misses = 0;
+		if (empty_start) {
+			wait_reset(&ws);
+			w->empty_cycles += rdtsc_bare() - empty_start;
+			empty_start = 0;
+		}
+
+		if (value == PIPE_EOS) {
+			active[cur] = active[--nr_active];
+			if (cur >= nr_active)
+				cur = 0;
+			continue;
+		}
+
+		if ((w->items_in++ & (OCCUPANCY_SAMPLE - 1)) == 0) {
+			w->occupancy_sum += queue_occupancy(q);
+			w->occupancy_samples ++;
+		}
+
+		out = sd->fn(value, arg);
+		if (w->nr_out == 0)
+			continue;
+		if (out) {
+			pipe_send(w, pipe_pick(w), out);
+			w->items_out ++;
+		}
+	}
+}
+
+/* Ordered fan-in, see stage_desc.reorder. */
+static void run_reorder(struct pipe_worker *w, struct stage_desc *sd)
+{
+	struct reorder_t *r = w->reorder;
+	uint64_t empty_start = 0;
+	void *arg = sd->worker_arg[w->index] ? sd->worker_arg[w->index] : sd->arg;
+	ELEMENT_TYPE value, out;
+	struct wait_state ws;
+	uint32_t k;
+
+	wait_init(&ws, w->in[0]->wait);
+
+	while (!reorder_done(r)) {
+		if (reorder_next(r, &value) != SUCCESS) {
+			if (empty_start == 0) {
+				w->empty_stalls ++;
+				for (k = 0; k < w->nr_in; k++) {
+					w->in[k]->empty_counter ++;
+					w->in[k]->traffic_empty ++;
+				}
+				empty_start = rdtsc_bare();
+			}
+			wait_idle(&ws, NULL);
+			continue;
+		}
+
+		if (empty_start) {
+			wait_reset(&ws);
+			w->empty_cycles += rdtsc_bare() - empty_start;
+			empty_start = 0;
+		}
+		if ((w->items_in++ & (OCCUPANCY_SAMPLE - 1)) == 0) {
+			for (k = 0; k < w->nr_in; k++)
+				w->occupancy_sum += queue_occupancy(w->in[k]);
+			w->occupancy_samples += w->nr_in;
+		}
+
+		out = sd->fn(value, arg);
+		if (w->nr_out == 0)
+			continue;
+		if (out) {
+			pipe_send(w, pipe_pick(w), out);
+			w->items_out ++;
+		}
+	}
+}
+
+static void *pipeline_worker(void *arg)
+{
+	struct pipe_worker *w = (struct pipe_worker *)arg;
+	struct pipeline_t *p = w->p;
+	struct stage_desc *sd = &p->stages[w->stage];
+	cpu_set_t cur_mask;
+
+	if (w->core >= 0) {
+		CPU_ZERO(&cur_mask);
+		CPU_SET(w->core, &cur_mask);
+		if (sched_setaffinity(0, sizeof(cur_mask), &cur_mask) < 0)
+			printf("Error: sched_setaffinity for stage %u worker %u\n",
+					w->stage, w->index);
+	}
+
+	pthread_barrier_wait(&p->barrier);
+	w->start_c = rdtsc_bare();
+
+	if (w->stage == 0)
+		run_source(w, sd);
+	else if (w->reorder)
+		run_reorder(w, sd);
+	else
+		run_stage(w, sd);
+	send_eos(w);
+
+	w->stop_c = rdtsc_bare();
+	return NULL;
+}
+
+int pipeline_run(struct pipeline_t *p, uint64_t nr_items)
+{
+	uint32_t s, i, nr_threads = 0;
+	uint32_t par0 = p->stages[0].parallelism;
+	uint64_t start;
+
+	for (s = 0; s < p->nr_stages; s++)
+		nr_threads += p->stages[s].parallelism;
+	if (pthread_barrier_init(&p->barrier, NULL, nr_threads + 1) != 0) {
+		perror("pipeline barrier");
+		return -1;
+	}
+
+	/* Split the sequence space 1..nr_items among the source workers. */
+	for (i = 0; i < par0; i++) {
+		p->workers[0][i].first = 1 + nr_items * i / par0;
+		p->workers[0][i].last = 1 + nr_items * (i + 1) / par0;
+	}
+	p->nr_items = nr_items;
+
+	for (s = 0; s < p->nr_stages; s++) {
+		for (i = 0; i < p->stages[s].parallelism; i++) {
+			struct pipe_worker *w = &p->workers[s][i];
+			if (pthread_create(&w->tid, NULL, pipeline_worker, w) != 0) {
+				perror("cannot create thread for pipeline worker");
+				return -1;
+			}
+		}
+	}
+
+	pthread_barrier_wait(&p->barrier);
+	start = now_ns();
+	for (s = 0; s < p->nr_stages; s++)
+		for (i = 0; i < p->stages[s].parallelism; i++)
+			pthread_join(p->workers[s][i].tid, NULL);
+	p->run_ns = now_ns() - start;
+
+	pthread_barrier_destroy(&p->barrier);
+	return 0;
+}
+
+void pipeline_report(struct pipeline_t *p, FILE *out)
+{
+	uint32_t s, i;
+	double secs = p->run_ns / 1e9;
+
+	fprintf(out, "%-12s %4s %12s %10s %12s %12s %8s %8s %10s\n",
+			"stage", "par", "items", "Mitems/s", "full_stalls",
+			"empty_stalls", "full%", "empty%", "occupancy");
+	for (s = 0; s < p->nr_stages; s++) {
+		uint64_t items = 0, fulls = 0, empties = 0;
+		uint64_t full_c = 0, empty_c = 0, busy_c = 0;
+		uint64_t occ = 0, occ_n = 0;
+
+		for (i = 0; i < p->stages[s].parallelism; i++) {
+			struct pipe_worker *w = &p->workers[s][i];
+			items += w->items_in;
+			fulls += w->full_stalls;
+			empties += w->empty_stalls;
+			full_c += w->full_cycles;
+			empty_c += w->empty_cycles;
+			busy_c += w->stop_c - w->start_c;
+			occ += w->occupancy_sum;
+			occ_n += w->occupancy_samples;
+		}
+		fprintf(out, "%-12s %4u %12lu %10.3f %12lu %12lu %7.1f%% %7.1f%% %10.1f\n",
+				p->stages[s].name ? p->stages[s].name : "-",
+				p->stages[s].parallelism, items,
+				secs > 0 ? items / secs / 1e6 : 0.0, fulls, empties,
+				busy_c ? 100.0 * full_c / busy_c : 0.0,
+				busy_c ? 100.0 * empty_c / busy_c : 0.0,
+				occ_n ? (double)occ / occ_n : 0.0);
+	}
+	for (s = 0; s < p->nr_stages; s++) {
+		struct reorder_t *r = p->workers[s][0].reorder;
+
+		if (r == NULL)
+			continue;
+		fprintf(out, "%-12s reorder window %u: stalls %lu, held %lu, "
+				"occupancy avg %.1f max %u\n",
+				p->stages[s].name ? p->stages[s].name : "-",
+				r->mask + 1, r->stalls, r->held_stalls,
+				r->window_samples ?
+				(double)r->window_sum / r->window_samples : 0.0,
+				r->window_max);
+	}
+	fprintf(out, "end-to-end: %lu items in %.3f s, %.3f Mitems/s\n",
+			p->nr_items, secs, secs > 0 ? p->nr_items / secs / 1e6 : 0.0);
+}
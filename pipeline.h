@@ -0,0 +1,118 @@
+/*
+ *  pipeline.h: Multi-stage pipeline runtime wired by EQueues.
+ *
+ *  A pipeline is a list of stages.  Every stage runs its stage function
+ *  on `parallelism' pinned worker threads.  Each worker of stage s is
+ *  connected to each worker of stage s+1 by its own single-producer/
+ *  single-consumer EQueue; workers send round robin and poll their
+ *  inputs round robin.  The first stage is the source: its function is
+ *  called with sequence numbers 1..N.  The last stage is the sink.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_PIPELINE_H_
+#define _FIFO_PIPELINE_H_
+
+#include "fifo.h"
+#include "reorder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_STAGES 16
+#define MAX_STAGE_WORKERS 16
+
+/* End-of-stream marker.  Stage functions must never return it. */
+#define PIPE_EOS (~(ELEMENT_TYPE)0)
+
+/* How a worker picks the next-stage worker for each element. */
+#define PIPE_DISPATCH_RR 0	/* round robin */
+#define PIPE_DISPATCH_JSQ 1	/* join the shortest queue, see queue_occupancy() */
+
+/* Returns the element to pass downstream, or 0 to filter it out. */
+typedef ELEMENT_TYPE (*stage_fn_t)(ELEMENT_TYPE, void *);
+
+struct stage_desc {
+	const char *name;
+	stage_fn_t fn;
+	void *arg;
+	void *worker_arg[MAX_STAGE_WORKERS];	/* per worker; NULL: use arg */
+	uint32_t parallelism;
+	uint32_t dispatch;		/* PIPE_DISPATCH_* towards the next stage */
+	/* If non-zero, the stage (parallelism 1) merges its inputs back
+	 * into sequence order through a reorder window of this size.  The
+	 * source numbers elements from 1 and must have parallelism 1;
+	 * seq recovers the number from an element (NULL: the element is
+	 * the number), and the stages in between must not filter. */
+	uint32_t reorder;
+	reorder_seq_t seq;
+	int cores[MAX_STAGE_WORKERS];	/* -1: leave the worker unpinned */
+};
+
+struct pipe_worker {
+	/* Accessed by the worker thread only. */
+	uint64_t items_in __attribute__ ((aligned(128)));
+	uint64_t items_out;
+	uint64_t full_stalls;		/* sends that found the queue full */
+	uint64_t empty_stalls;		/* input sweeps that found nothing */
+	uint64_t full_cycles;		/* cycles spent waiting on full */
+	uint64_t empty_cycles;		/* cycles spent waiting on empty */
+	uint64_t occupancy_sum;		/* sampled input queue occupancy */
+	uint64_t occupancy_samples;
+	uint64_t start_c;
+	uint64_t stop_c;
+	uint32_t rr;
+	struct reorder_t *reorder;	/* reorder stages only */
+
+	/* readonly data */
+	struct pipeline_t *p __attribute__ ((aligned(128)));
+	uint32_t stage;
+	uint32_t index;
+	int core;
+	uint64_t first;			/* source only: sequence range */
+	uint64_t last;
+	uint32_t nr_in;
+	uint32_t nr_out;
+	struct queue_t **in;
+	struct queue_t **out;
+	pthread_t tid;
+};
+
+struct pipeline_t {
+	uint32_t nr_stages;
+	struct stage_desc stages[MAX_STAGES];
+	struct pipe_worker *workers[MAX_STAGES];
+	/* queues[s][i * parallelism(s+1) + j]: worker i of s to worker j of s+1 */
+	struct queue_t *queues[MAX_STAGES];
+	uint64_t nr_items;
+	uint64_t run_ns;
+	pthread_barrier_t barrier;
+};
+
+struct pipeline_t *pipeline_create(const struct stage_desc *, uint32_t,
+		uint64_t, uint64_t);
+int pipeline_run(struct pipeline_t *, uint64_t);
+void pipeline_report(struct pipeline_t *, FILE *);
+void pipeline_destroy(struct pipeline_t *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ *  pipeline_bench.c: End-to-end throughput of synthetic 3-6 stage
+ *  pipelines built with the pipeline runtime.
+ *
+ *  Every middle stage mixes the element with a multiplicative hash and
+ *  then spins for its configured number of cycles, like the consumer
+ *  workload in main.c.  The source emits sequence numbers and the sink
+ *  only counts.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+#define DEFAULT_TEST_SIZE 10000000
+
+static uint64_t stage_work[MAX_STAGES];
+
+static ELEMENT_TYPE source_fn(ELEMENT_TYPE seq, void *arg)
+{
+	return seq;
+}
+
+static ELEMENT_TYPE work_fn(ELEMENT_TYPE v, void *arg)
+{
+	uint64_t work = *(uint64_t *)arg;
+
+	v = (v * 0x9E3779B97F4A7C15UL) | 1;	/* never 0 */
+	if (v == PIPE_EOS)
+		v --;
+	if (work)
+		wait_ticks(work);
+	return v;
+}
+
+static ELEMENT_TYPE sink_fn(ELEMENT_TYPE v, void *arg)
+{
+	uint64_t work = *(uint64_t *)arg;
+
+	if (work)
+		wait_ticks(work);
+	return 0;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+static int run_one(uint32_t nr_stages, uint64_t *par, int nr_par,
+		uint64_t *cores, int nr_cores, uint64_t test_size,
+		uint64_t queue_size, uint64_t penalty)
+{
+	struct stage_desc stages[MAX_STAGES];
+	struct pipeline_t *p;
+	uint32_t s, i;
+	int next_core = 0;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+	memset(stages, 0, sizeof(stages));
+	for (s = 0; s < nr_stages; s++) {
+		static char names[MAX_STAGES][16];
+
+		if (s == 0)
+			snprintf(names[s], sizeof(names[s]), "source");
+		else if (s == nr_stages - 1)
+			snprintf(names[s], sizeof(names[s]), "sink");
+		else
+			snprintf(names[s], sizeof(names[s]), "stage%u", s);
+		stages[s].name = names[s];
+		stages[s].fn = s == 0 ? source_fn :
+			(s == nr_stages - 1 ? sink_fn : work_fn);
+		stages[s].arg = &stage_work[s];
+		stages[s].parallelism = s < (uint32_t)nr_par ? par[s] : 1;
+		if (stages[s].parallelism < 1 ||
+				stages[s].parallelism > MAX_STAGE_WORKERS) {
+			printf("Error: parallelism of stage %u must be in [1, %d].\n",
+					s, MAX_STAGE_WORKERS);
+			return -1;
+		}
+		/* Place workers on the listed cores in order, or spread
+		 * them over the online CPUs. */
+		for (i = 0; i < stages[s].parallelism; i++, next_core++)
+			stages[s].cores[i] = nr_cores ?
+				(int)cores[next_core % nr_cores] : next_core % ncpu;
+	}
+
+	p = pipeline_create(stages, nr_stages, queue_size, penalty);
+	if (p == NULL)
+		return -1;
+
+	printf("===== %u-stage pipeline, %lu items =====\n", nr_stages, test_size);
+	if (pipeline_run(p, test_size) != 0) {
+		pipeline_destroy(p);
+		return -1;
+	}
+	pipeline_report(p, stdout);
+	pipeline_destroy(p);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t test_size = DEFAULT_TEST_SIZE;
+	uint64_t queue_size = DEFAULT_QUEUE_SIZE;
+	uint64_t penalty = DEFAULT_PENALTY;
+	uint64_t par[MAX_STAGES], cores[MAX_STAGES * MAX_STAGE_WORKERS];
+	int nr_par = 0, nr_cores = 0, nr_work = 0, opt;
+	uint32_t nr_stages = 0, s;
+
+	char * usage =
+		"Usage: pipeline_bench [-n stages (default: run 3, 4, 5 and 6)]\n\
+		[-t test_size   (default:  10,000,000)]\n\
+		[-P parallelism per stage, e.g. 1,2,2,1 (default: 1 each)]\n\
+		[-w work cycles per stage, e.g. 0,200,100,0 (default: 100 each middle stage)]\n\
+		[-C cores in worker order, e.g. 0,2,4,6 (default: spread over online CPUs)]\n\
+		[-q queue_size  (default: 1024*2 )]\n\
+		[-p penalty     (default: 1000 cycles)]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hn:t:P:w:C:q:p:")) != -1) {
+		switch (opt) {
+			case 'n':
+				nr_stages = atoi(optarg);
+				break;
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'P':
+				nr_par = parse_list(optarg, par, MAX_STAGES);
+				break;
+			case 'w':
+				nr_work = parse_list(optarg, stage_work, MAX_STAGES);
+				break;
+			case 'C':
+				nr_cores = parse_list(optarg, cores,
+						MAX_STAGES * MAX_STAGE_WORKERS);
+				break;
+			case 'q':
+				queue_size = atoll(optarg);
+				break;
+			case 'p':
+				penalty = atoll(optarg);
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+	if (nr_work == 0)
+		for (s = 1; s + 1 < MAX_STAGES; s++)
+			stage_work[s] = 100;
+
+	if (nr_stages) {
+		if (nr_work == 0 && nr_stages <= MAX_STAGES)
+			stage_work[nr_stages - 1] = 0;	/* sink */
+		if (run_one(nr_stages, par, nr_par, cores, nr_cores,
+					test_size, queue_size, penalty) != 0)
+			return -1;
+		return 0;
+	}
+
+	for (nr_stages = 3; nr_stages <= 6; nr_stages++) {
+		if (nr_work == 0)
+			stage_work[nr_stages - 1] = 0;	/* sink */
+		if (run_one(nr_stages, par, nr_par, cores, nr_cores,
+					test_size, queue_size, penalty) != 0)
+			return -1;
+		if (nr_work == 0)
+			stage_work[nr_stages - 1] = 100;
+	}
+
+	return 0;
+}
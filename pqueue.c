@@ -0,0 +1,101 @@
+/*
+ *  pqueue.c: Prioritized EQueue built from several EQueue lanes that
+ *  share one producer and one consumer.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "pqueue.h"
+
+void pqueue_init(struct pqueue_t *pq, uint32_t nr_lanes, uint64_t queue_size,
+		uint64_t penalty, uint32_t mode, const uint32_t *weight)
+{
+	uint32_t i;
+
+	if (nr_lanes < 1 || nr_lanes > MAX_LANES) {
+		printf("Error: number of lanes must be in [1, %d].\n", MAX_LANES);
+		exit(-1);
+	}
+
+	memset(pq, 0, sizeof(struct pqueue_t));
+	pq->nr_lanes = nr_lanes;
+	pq->mode = mode;
+	for (i = 0; i < nr_lanes; i++) {
+		queue_init(&pq->lanes[i], queue_size, penalty, OVERFLOW_BLOCK);
+		/* By default, lane i gets nr_lanes - i turns per round. */
+		pq->weight[i] = (weight != NULL && weight[i] > 0) ?
+			weight[i] : nr_lanes - i;
+	}
+}
+
+void pqueue_destroy(struct pqueue_t *pq)
+{
+	uint32_t i;
+
+	for (i = 0; i < pq->nr_lanes; i++)
+		queue_destroy(&pq->lanes[i]);
+}
+
+int pqueue_enqueue(struct pqueue_t *pq, uint32_t lane, ELEMENT_TYPE value)
+{
+	return enqueue(&pq->lanes[lane], value);
+}
+
+/* Same bookkeeping as producer()/consumer() do for a plain queue; the
+ * traffic counters drive the adaptive size of each lane. */
+void pqueue_note_full(struct pqueue_t *pq, uint32_t lane)
+{
+	INC_RELAXED(pq->lanes[lane].full_counter);
+	INC_RELAXED(pq->lanes[lane].traffic_full);
+}
+
+void pqueue_note_empty(struct pqueue_t *pq)
+{
+	uint32_t i;
+
+	for (i = 0; i < pq->nr_lanes; i++) {
+		pq->lanes[i].empty_counter ++;
+		INC_RELAXED(pq->lanes[i].traffic_empty);
+	}
+}
+
+int pqueue_dequeue(struct pqueue_t *pq, ELEMENT_TYPE *value, uint32_t *lane)
+{
+	uint32_t l, mask = pqueue_ready(pq);
+
+	if (mask == 0)
+		return BUFFER_EMPTY;
+
+	if (pq->mode == PQ_STRICT) {
+		l = __builtin_ctz(mask);
+	}
+	else {
+		l = pq->cur;
+		if (pq->credit == 0 || !(mask & (1U << l))) {
+			/* Move on to the next ready lane, wrapping around. */
+			uint32_t above = mask & ~((2U << l) - 1);
+			l = above ? __builtin_ctz(above) : __builtin_ctz(mask);
+			pq->cur = l;
+			pq->credit = pq->weight[l];
+		}
+		pq->credit --;
+	}
+
+	*lane = l;
+	/* The slot is known to be full and we are the only consumer. */
+	return dequeue(&pq->lanes[l], value);
+}
@@ -0,0 +1,78 @@
+/*
+ *  pqueue.h: Prioritized EQueue.  One logical single-producer/single-
+ *  consumer queue made of several lanes, each of which is a complete,
+ *  dynamically sized EQueue.  Lane 0 has the highest priority.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_PQUEUE_H_
+#define _FIFO_PQUEUE_H_
+
+#include "fifo.h"
+#include "atomics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_LANES 8
+
+/* Drain orders */
+#define PQ_STRICT 0     /* always serve the lowest-numbered ready lane */
+#define PQ_WEIGHTED 1   /* round robin, up to weight[lane] items per turn */
+
+struct pqueue_t {
+	struct queue_t lanes[MAX_LANES];
+
+	/* readonly data */
+	uint32_t nr_lanes __attribute__ ((aligned(128)));
+	uint32_t mode;
+	uint32_t weight[MAX_LANES];
+
+	/* Accessed by consumer only. */
+	uint32_t cur __attribute__ ((aligned(128)));
+	uint32_t credit;
+};
+
+void pqueue_init(struct pqueue_t *, uint32_t, uint64_t, uint64_t,
+		uint32_t, const uint32_t *);
+void pqueue_destroy(struct pqueue_t *);
+int pqueue_enqueue(struct pqueue_t *, uint32_t, ELEMENT_TYPE);
+int pqueue_dequeue(struct pqueue_t *, ELEMENT_TYPE *, uint32_t *);
+void pqueue_note_full(struct pqueue_t *, uint32_t);
+void pqueue_note_empty(struct pqueue_t *);
+
+/* Bit i is set when lane i has at least one element.  Only the slot
+ * under each lane's tail is read, so this costs one load per lane. */
+static inline uint32_t pqueue_ready(struct pqueue_t *pq)
+{
+	uint32_t i, mask = 0;
+
+	for (i = 0; i < pq->nr_lanes; i++) {
+		struct queue_t *q = &pq->lanes[i];
+		if (LOAD_ACQUIRE(q->data[q->tail]))
+			mask |= 1U << i;
+	}
+	return mask;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
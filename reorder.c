@@ -0,0 +1,143 @@
+/*
+ *  reorder.c: Reorder buffer that merges several EQueues of sequence-
+ *  tagged elements back into one stream in sequence order.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "reorder.h"
+
+/* window is rounded up to a power of two; first is the sequence number
+ * of the first element. */
+int reorder_init(struct reorder_t *r, struct queue_t **in, uint32_t nr_in,
+		uint32_t window, uint64_t first, ELEMENT_TYPE eos, reorder_seq_t seq)
+{
+	uint32_t size = 1;
+
+	if (nr_in < 1 || nr_in > MAX_REORDER_INPUTS) {
+		printf("Error: a reorder buffer takes 1 to %d inputs.\n",
+				MAX_REORDER_INPUTS);
+		return -1;
+	}
+	while (size < window)
+		size <<= 1;
+
+	memset(r, 0, sizeof(struct reorder_t));
+	r->slots = calloc(size, sizeof(ELEMENT_TYPE));
+	if (r->slots == NULL) {
+		printf("Error in allocating the reorder window.\n");
+		return -1;
+	}
+	memcpy(r->in, in, nr_in * sizeof(struct queue_t *));
+	r->nr_in = nr_in;
+	r->nr_open = nr_in;
+	r->eos = eos;
+	r->seq = seq;
+	r->next = first;
+	r->mask = size - 1;
+	return 0;
+}
+
+void reorder_destroy(struct reorder_t *r)
+{
+	free(r->slots);
+	r->slots = NULL;
+}
+
+static inline uint64_t seq_of(struct reorder_t *r, ELEMENT_TYPE v)
+{
+	return r->seq ? r->seq(v) : (uint64_t)v;
+}
+
+static inline void park(struct reorder_t *r, uint64_t s, ELEMENT_TYPE v)
+{
+	r->slots[s & r->mask] = v;
+	r->in_window ++;
+	r->window_sum += r->in_window;
+	r->window_samples ++;
+	if (r->in_window > r->window_max)
+		r->window_max = r->in_window;
+}
+
+static inline int emit(struct reorder_t *r, ELEMENT_TYPE *value)
+{
+	ELEMENT_TYPE *slot = &r->slots[r->next & r->mask];
+
+	if (*slot == 0)
+		return 0;
+	*value = *slot;
+	*slot = 0;
+	r->in_window --;
+	r->next ++;
+	r->emitted ++;
+	return 1;
+}
+
+/* Returns the element due next, or BUFFER_EMPTY if it has not arrived
+ * yet.  Each call reads at most one element from every input; the one
+ * due next is passed straight through without touching the window. */
+int reorder_next(struct reorder_t *r, ELEMENT_TYPE *value)
+{
+	uint32_t k, i;
+	ELEMENT_TYPE v;
+	uint64_t s;
+
+	if (r->in_window && emit(r, value))
+		return SUCCESS;
+
+	for (k = 0; k < r->nr_in; k++) {
+		i = r->cur + k;
+		if (i >= r->nr_in)
+			i -= r->nr_in;
+
+		if (r->held[i]) {
+			v = r->held[i];
+			s = seq_of(r, v);
+			if (s - r->next > r->mask)
+				continue;
+			r->held[i] = 0;
+		} else {
+			if (r->in[i] == NULL || dequeue(r->in[i], &v) != SUCCESS)
+				continue;
+			if (r->eos && v == r->eos) {
+				r->in[i] = NULL;
+				r->nr_open --;
+				continue;
+			}
+			s = seq_of(r, v);
+		}
+
+		if (s == r->next) {
+			r->next ++;
+			r->emitted ++;
+			r->cur = i + 1 < r->nr_in ? i + 1 : 0;
+			*value = v;
+			return SUCCESS;
+		}
+		if (s - r->next > r->mask) {
+			r->held[i] = v;
+			r->held_stalls ++;
+			continue;
+		}
+		park(r, s, v);
+	}
+
+	if (r->in_window && emit(r, value))
+		return SUCCESS;
+	r->stalls ++;
+	return BUFFER_EMPTY;
+}
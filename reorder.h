@@ -0,0 +1,82 @@
+/*
+ *  reorder.h: Reorder buffer that merges several EQueues of sequence-
+ *  tagged elements back into one stream in sequence order.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_REORDER_H_
+#define _FIFO_REORDER_H_
+
+#include "fifo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MAX_REORDER_INPUTS 16
+
+/* Returns the sequence number carried by an element. */
+typedef uint64_t (*reorder_seq_t)(ELEMENT_TYPE);
+
+/* Used by the consumer of the input queues only, so nothing in here is
+ * shared: the inputs are plain EQueues.  Every sequence number must
+ * arrive exactly once, and each input must deliver its elements in
+ * increasing sequence order (e.g. a round-robin fan-out of one ordered
+ * stream); then the element due next is never held back and a window
+ * of any size makes progress. */
+struct reorder_t {
+	struct queue_t *in[MAX_REORDER_INPUTS];
+	uint32_t nr_in;
+	uint32_t nr_open;		/* inputs that have not sent eos */
+	ELEMENT_TYPE eos;		/* end-of-stream marker, 0: none */
+	reorder_seq_t seq;		/* NULL: the element is its sequence */
+
+	uint64_t next;			/* sequence to emit next */
+	uint32_t mask;			/* window size - 1 */
+	uint32_t in_window;		/* elements parked in slots */
+	ELEMENT_TYPE *slots;		/* slots[seq & mask], 0: empty */
+	/* Per input: an element read too far ahead of next to fit in the
+	 * window.  The input is not read again until it fits. */
+	ELEMENT_TYPE held[MAX_REORDER_INPUTS];
+	uint32_t cur;			/* input the next sweep starts at */
+
+	/* Statistics */
+	uint64_t emitted;
+	uint64_t stalls;		/* calls that found nothing to emit */
+	uint64_t held_stalls;		/* elements held outside the window */
+	uint64_t window_sum;		/* occupancy sampled at every park */
+	uint64_t window_samples;
+	uint32_t window_max;
+};
+
+int reorder_init(struct reorder_t *, struct queue_t **, uint32_t, uint32_t,
+		uint64_t, ELEMENT_TYPE, reorder_seq_t);
+void reorder_destroy(struct reorder_t *);
+int reorder_next(struct reorder_t *, ELEMENT_TYPE *);
+
+/* All inputs have sent eos and nothing is left to emit. */
+static inline int reorder_done(struct reorder_t *r)
+{
+	return r->nr_open == 0 && r->in_window == 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
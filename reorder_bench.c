@@ -0,0 +1,189 @@
+/*
+ *  reorder_bench.c: Throughput retained by a fan-out/fan-in pipeline
+ *  that restores sequence order (reorder.c), compared with a single
+ *  producer/consumer pair doing the same work.
+ *
+ *  Three pipelines are run:
+ *    pair:       source -> one worker -> sink
+ *    unordered:  source -> N workers (round robin) -> sink
+ *    reordered:  as unordered, but the sink merges its inputs back into
+ *                sequence order through a window of -W elements and
+ *                checks the order.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+#define DEFAULT_TEST_SIZE 4000000
+
+static uint64_t workload = 400;
+static uint64_t expected, order_errors;
+
+static ELEMENT_TYPE source_fn(ELEMENT_TYPE seq, void *arg)
+{
+	return seq;
+}
+
+/* Workers keep the element, i.e. its sequence number. */
+static ELEMENT_TYPE work_fn(ELEMENT_TYPE v, void *arg)
+{
+	if (workload)
+		wait_ticks(workload);
+	return v;
+}
+
+static ELEMENT_TYPE sink_fn(ELEMENT_TYPE v, void *arg)
+{
+	return 0;
+}
+
+static ELEMENT_TYPE ordered_sink_fn(ELEMENT_TYPE v, void *arg)
+{
+	if (v != ++expected) {
+		order_errors ++;
+		expected = v;
+	}
+	return 0;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+/* Returns Mitems/s, or a negative value on error. */
+static double run_one(const char *name, uint32_t workers, uint32_t window,
+		uint64_t *cores, int nr_cores, uint64_t test_size)
+{
+	struct stage_desc stages[3];
+	struct pipeline_t *p;
+	long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t s, i;
+	int next = 0;
+	double rate;
+
+	memset(stages, 0, sizeof(stages));
+	stages[0].name = "source";
+	stages[0].fn = source_fn;
+	stages[0].parallelism = 1;
+	stages[1].name = "workers";
+	stages[1].fn = work_fn;
+	stages[1].parallelism = workers;
+	stages[2].name = "sink";
+	stages[2].fn = window ? ordered_sink_fn : sink_fn;
+	stages[2].parallelism = 1;
+	stages[2].reorder = window;
+	for (s = 0; s < 3; s++)
+		for (i = 0; i < stages[s].parallelism; i++, next++)
+			stages[s].cores[i] = nr_cores ?
+				(int)cores[next % nr_cores] : next % ncpu;
+
+	p = pipeline_create(stages, 3, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY);
+	if (p == NULL)
+		return -1;
+	expected = 0;
+	order_errors = 0;
+
+	printf("===== %s: %u worker(s), %lu items =====\n", name, workers, test_size);
+	if (pipeline_run(p, test_size) != 0) {
+		pipeline_destroy(p);
+		return -1;
+	}
+	pipeline_report(p, stdout);
+	if (window)
+		printf("order errors: %lu\n", order_errors +
+				(expected != test_size));
+	rate = p->run_ns ? test_size * 1e3 / p->run_ns : 0.0;
+	pipeline_destroy(p);
+	return rate;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t test_size = DEFAULT_TEST_SIZE;
+	uint64_t cores[MAX_STAGE_WORKERS + 2];
+	uint32_t workers = 4, window = 1024;
+	double pair, unordered, reordered;
+	int nr_cores = 0, opt;
+
+	char * usage =
+		"Usage: reorder_bench [-t test_size (default: 4,000,000)]\n\
+		[-n fan-out workers (default: 4)]\n\
+		[-w worker workload (default: 400 cycles)]\n\
+		[-W reorder window (default: 1024)]\n\
+		[-C cores in worker order: source, workers, sink (default: spread over online CPUs)]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "ht:n:w:W:C:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'n':
+				workers = atoi(optarg);
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'W':
+				window = atoi(optarg);
+				break;
+			case 'C':
+				nr_cores = parse_list(optarg, cores, MAX_STAGE_WORKERS + 2);
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (window == 0) {
+		printf("%s\n", usage);
+		exit(-1);
+	}
+
+	pair = run_one("pair", 1, 0, cores, nr_cores, test_size);
+	unordered = run_one("unordered fan-in", workers, 0, cores, nr_cores,
+			test_size);
+	reordered = run_one("reordered fan-in", workers, window, cores,
+			nr_cores, test_size);
+	if (pair <= 0 || unordered < 0 || reordered < 0)
+		return -1;
+
+	printf("Mitems/s: pair %.3f, unordered %.3f (%.0f%%), reordered %.3f (%.0f%% of pair, %.0f%% of unordered)\n",
+			pair, unordered, 100 * unordered / pair, reordered,
+			100 * reordered / pair,
+			unordered > 0 ? 100 * reordered / unordered : 0.0);
+	return 0;
+}
@@ -0,0 +1,247 @@
+/*
+ *  resize_bench.c: Shrink success rate and memory reclaimed by the
+ *  adaptive queue size under an oscillating load.
+ *
+ *  Every cycle the producer first runs flat out for `burst' items
+ *  against a consumer spending `workload' cycles per item, which makes
+ *  the queue enlarge.  It then sends `quiet' items one every `idle'
+ *  cycles, so that the consumer keeps finding the queue empty and the
+ *  queue shrinks back.  Build with -DSHRINK_FULL_CAS to measure the
+ *  former full-word CAS shrink instead of LT-CAS.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include "fifo.h"
+
+static uint64_t cycles = 10;
+static uint64_t burst = 1000000;
+static uint64_t quiet = 200000;
+static uint64_t workload = 200;
+static uint64_t idle = 2000;
+static int producer_core = 0;
+static int consumer_core = 1;
+
+static struct queue_t q __attribute__ ((aligned(128)));
+static uint64_t total, errors;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+/* Bytes of the ring that are backed by physical memory. */
+static uint64_t resident_bytes(void)
+{
+	uint64_t page = sysconf(_SC_PAGESIZE);
+	uint64_t pages = (MAX_QUEUE_SIZE * sizeof(ELEMENT_TYPE) + page - 1) / page;
+	unsigned char *vec = malloc(pages);
+	uint64_t i, n = 0;
+
+	if (vec == NULL || mincore(q.data, pages * page, vec) != 0) {
+		free(vec);
+		return 0;
+	}
+	for (i = 0; i < pages; i++)
+		n += vec[i] & 1;
+	free(vec);
+	return n * page;
+}
+
+static void *consumer(void *arg)
+{
+	ELEMENT_TYPE value;
+	uint64_t i;
+	int flag;
+
+	pin(consumer_core);
+	for (i = 1; i <= total; i++) {
+		flag = 0;
+		while (dequeue(&q, &value) != SUCCESS) {
+			if (flag == 0) {
+				q.empty_counter ++;
+				q.traffic_empty ++;
+				flag = 1;
+			}
+		}
+		if (value != i)
+			errors ++;
+		wait_ticks(workload);
+	}
+	return NULL;
+}
+
+static void push(uint64_t i)
+{
+	int flag = 0;
+
+	while (enqueue(&q, (ELEMENT_TYPE)i) != SUCCESS) {
+		if (flag == 0) {
+			q.full_counter ++;
+			q.traffic_full ++;
+			flag = 1;
+		}
+		wait_ticks(q.penalty);
+	}
+}
+
+static void *producer(void *arg)
+{
+	uint64_t c, j, i = 1;
+	uint32_t peak;
+
+	pin(producer_core);
+	for (c = 0; c < cycles; c++) {
+		peak = 0;
+		for (j = 0; j < burst; j++, i++) {
+			push(i);
+			if (q.info.queue_size > peak)
+				peak = q.info.queue_size;
+		}
+		for (j = 0; j < quiet; j++, i++) {
+			push(i);
+			wait_ticks(idle);
+		}
+		printf("cycle %3lu: peak size %7u, size after quiet %7u, resident %8lu bytes\n",
+				c, peak, READ_ONCE(q.info.queue_size), resident_bytes());
+	}
+	return NULL;
+}
+
+/* Regression check of the shrink, single-threaded.  The producer laps
+ * the consumer and fills the ring up to the one slot the consumer takes
+ * last before it wraps; a shrink forced at that wrap must fail, or the
+ * elements in the upper half of the ring are lost.  Returns the number
+ * of elements lost or out of order. */
+static uint64_t lapped_check(int batching)
+{
+	uint64_t in = 0, out = 0, bad = 0;
+	uint32_t qsize;
+	ELEMENT_TYPE v;
+
+	queue_init(&q, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY, OVERFLOW_BLOCK);
+	qsize = q.info.queue_size;
+	/* Move both sides to the last slot, then fill it. */
+	while (q.tail != qsize - 1) {
+		if ((batching ? enqueue_batching(&q, in + 1) :
+					enqueue_nobatching(&q, in + 1)) == SUCCESS)
+			in ++;
+		if (dequeue(&q, &v) == SUCCESS && v != ++out)
+			bad ++;
+	}
+	/* Lap: fill the ring until the producer stops. */
+	while ((batching ? enqueue_batching(&q, in + 1) :
+				enqueue_nobatching(&q, in + 1)) == SUCCESS)
+		in ++;
+
+	q.traffic_full = 0;
+	q.traffic_empty = SHRINK_THRESHOLD;
+	while (dequeue(&q, &v) == SUCCESS)
+		if (v != ++out)
+			bad ++;
+	printf("Lapped shrink check (%s): size %u -> %u, %lu lost, %lu out of order\n",
+			batching ? "batching" : "no batching", qsize,
+			q.info.queue_size, in - out, bad);
+	queue_destroy(&q);
+	return (in - out) + bad;
+}
+
+int main(int argc, char *argv[])
+{
+	pthread_t prod, cons;
+	uint64_t lost;
+	int opt;
+
+	char * usage =
+		"Usage: resize_bench [-c cycles (default: 10)]\n\
+		[-n burst items per cycle (default: 1,000,000)]\n\
+		[-m quiet items per cycle (default: 200,000)]\n\
+		[-w consumer workload (default: 200 cycles)]\n\
+		[-i producer cycles/item when quiet (default: 2000)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hc:n:m:w:i:a:b:")) != -1) {
+		switch (opt) {
+			case 'c':
+				cycles = atoll(optarg);
+				break;
+			case 'n':
+				burst = atoll(optarg);
+				break;
+			case 'm':
+				quiet = atoll(optarg);
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'i':
+				idle = atoll(optarg);
+				break;
+			case 'a':
+				producer_core = atoi(optarg);
+				break;
+			case 'b':
+				consumer_core = atoi(optarg);
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+#if defined(SHRINK_FULL_CAS)
+	printf("Shrink CAS: full word\n");
+#else
+	printf("Shrink CAS: LT-CAS\n");
+#endif
+	lost = lapped_check(0) + lapped_check(1);
+
+	total = cycles * (burst + quiet);
+	queue_init(&q, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY, OVERFLOW_BLOCK);
+
+	pthread_create(&cons, NULL, consumer, NULL);
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	printf("Shrink attempts: %lu, succeeded: %lu (%.1f%%), reclaimed: %lu bytes, order errors: %lu\n",
+			q.shrink_attempts, q.shrink_success,
+			q.shrink_attempts ? 100.0 * q.shrink_success / q.shrink_attempts : 0.0,
+			q.reclaimed_bytes, errors);
+
+	queue_destroy(&q);
+	if (lost) {
+		printf("Error: %lu elements lost or reordered by a shrink after a lap.\n", lost);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,118 @@
+/*
+ *  rpc.c: Request/response channel between two threads.  The client
+ *  sends requests on one EQueue and the server answers on another;
+ *  each response carries the correlation id of its request.
+ *
+ *  The server answers in order, but the client does not rely on it:
+ *  rpc_poll() hands back whichever response comes next with its id.
+ *  rpc_call() is the synchronous form, for a client with no other
+ *  request outstanding.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include "rpc.h"
+#include "wait.h"
+
+void rpc_init(struct rpc_chan *ch, uint64_t queue_size, uint64_t penalty)
+{
+	memset(ch, 0, sizeof(struct rpc_chan));
+	queue_init(&ch->req, queue_size, penalty, OVERFLOW_BLOCK);
+	queue_init(&ch->resp, queue_size, penalty, OVERFLOW_BLOCK);
+}
+
+void rpc_destroy(struct rpc_chan *ch)
+{
+	queue_destroy(&ch->req);
+	queue_destroy(&ch->resp);
+}
+
+/* Send a request without waiting for its response; its id is returned
+ * in *id.  Returns BUFFER_FULL if the request queue is full. */
+int rpc_send(struct rpc_chan *ch, uint32_t payload, uint32_t *id)
+{
+	uint32_t next = ch->next_id + 1;
+
+	if (next == 0)
+		next = 1;
+	if (enqueue(&ch->req, RPC_MSG(next, payload)) != SUCCESS) {
+		ch->req.full_counter ++;
+		ch->req.traffic_full ++;
+		return BUFFER_FULL;
+	}
+	ch->next_id = next;
+	ch->calls ++;
+	*id = next;
+	return SUCCESS;
+}
+
+/* Take the next response, if any. */
+int rpc_poll(struct rpc_chan *ch, uint32_t *id, uint32_t *payload)
+{
+	ELEMENT_TYPE m;
+
+	if (dequeue(&ch->resp, &m) != SUCCESS)
+		return BUFFER_EMPTY;
+	*id = RPC_ID(m);
+	*payload = RPC_PAYLOAD(m);
+	return SUCCESS;
+}
+
+/* Send a request and wait for its response.  No other request of this
+ * client may be outstanding. */
+uint32_t rpc_call(struct rpc_chan *ch, uint32_t payload)
+{
+	struct wait_state ws;
+	uint32_t id, rid, reply;
+
+	wait_init(&ws, ch->req.wait);
+	while (rpc_send(ch, payload, &id) != SUCCESS)
+		wait_for(&ws, ch->req.penalty);
+
+	wait_init(&ws, ch->resp.wait);
+	while (rpc_poll(ch, &rid, &reply) != SUCCESS || rid != id)
+		wait_idle(&ws, &ch->resp.data[ch->resp.tail]);
+	return reply;
+}
+
+/* Server: take the next request, if any. */
+int rpc_recv(struct rpc_chan *ch, uint32_t *id, uint32_t *payload)
+{
+	ELEMENT_TYPE m;
+
+	if (dequeue(&ch->req, &m) != SUCCESS)
+		return BUFFER_EMPTY;
+	*id = RPC_ID(m);
+	*payload = RPC_PAYLOAD(m);
+	return SUCCESS;
+}
+
+/* Server: answer request id.  Waits while the response queue is full. */
+void rpc_reply(struct rpc_chan *ch, uint32_t id, uint32_t payload)
+{
+	struct wait_state ws;
+
+	if (enqueue(&ch->resp, RPC_MSG(id, payload)) != SUCCESS) {
+		wait_init(&ws, ch->resp.wait);
+		do {
+			ch->resp.full_counter ++;
+			ch->resp.traffic_full ++;
+			wait_for(&ws, ch->resp.penalty);
+		} while (enqueue(&ch->resp, RPC_MSG(id, payload)) != SUCCESS);
+	}
+	ch->served ++;
+}
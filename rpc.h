@@ -0,0 +1,64 @@
+/*
+ *  rpc.h: Request/response channel between two threads, made of two
+ *  EQueues.  Every message carries a correlation id, so that a client
+ *  with several requests outstanding can match the responses.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_RPC_H_
+#define _FIFO_RPC_H_
+
+#include "fifo.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A message is one element: the correlation id in the high 32 bits
+ * (never 0, so neither is the element) and a 32-bit payload. */
+#define RPC_MSG(id, payload) (((uint64_t)(id) << 32) | (uint32_t)(payload))
+#define RPC_ID(m) ((uint32_t)((m) >> 32))
+#define RPC_PAYLOAD(m) ((uint32_t)(m))
+
+struct rpc_chan {
+	struct queue_t req;		/* client -> server */
+	struct queue_t resp;		/* server -> client */
+
+	/* Accessed by the client only. */
+	uint32_t next_id __attribute__ ((aligned(128)));
+	uint64_t calls;
+
+	/* Accessed by the server only. */
+	uint64_t served __attribute__ ((aligned(128)));
+};
+
+void rpc_init(struct rpc_chan *, uint64_t, uint64_t);
+void rpc_destroy(struct rpc_chan *);
+/* Client side */
+int rpc_send(struct rpc_chan *, uint32_t, uint32_t *);
+int rpc_poll(struct rpc_chan *, uint32_t *, uint32_t *);
+uint32_t rpc_call(struct rpc_chan *, uint32_t);
+/* Server side */
+int rpc_recv(struct rpc_chan *, uint32_t *, uint32_t *);
+void rpc_reply(struct rpc_chan *, uint32_t, uint32_t);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,263 @@
+/*
+ *  rpc_bench.c: Round-trip latency of the request/response channel
+ *  (rpc.c) with 1..N requests outstanding, for every client/server
+ *  placement of an affinity file.
+ *
+ *  Each distinct (producer, consumer) pair of the affinity file is one
+ *  placement: the client runs on the producer core, the server on the
+ *  consumer core.  The client keeps k requests in flight (a closed
+ *  loop): every response is timed against its request's send time,
+ *  looked up by correlation id, and answered with a new request.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "rpc.h"
+#include "latency.h"
+#include "tsc.h"
+#include "wait.h"
+
+#define DEFAULT_TEST_SIZE 1000000
+/* Most requests in flight; a power of two. */
+#define MAX_OUTSTANDING 128
+#define MAX_LEVELS 16
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t workload = 0;
+static int server_core;
+
+static struct rpc_chan ch __attribute__ ((aligned(128)));
+static volatile int stop;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static void *server(void *arg)
+{
+	struct wait_state ws;
+	uint32_t id, payload;
+
+	pin(server_core);
+	wait_init(&ws, ch.req.wait);
+	for (;;) {
+		if (rpc_recv(&ch, &id, &payload) != SUCCESS) {
+			if (stop)
+				break;
+			wait_idle(&ws, &ch.req.data[ch.req.tail]);
+			continue;
+		}
+		wait_reset(&ws);
+		if (workload)
+			wait_ticks(workload);
+		rpc_reply(&ch, id, payload + 1);
+	}
+	return NULL;
+}
+
+/* Client side of one run with k requests outstanding.  Returns the
+ * number of responses that did not match a request. */
+static uint64_t run(uint32_t k, struct latency_hist *lat, double *rate)
+{
+	uint64_t sent_at[MAX_OUTSTANDING] = { 0 };
+	uint32_t payload_of[MAX_OUTSTANDING];
+	uint64_t sent = 0, done = 0, errors = 0, now, start;
+	struct wait_state ws, wf;
+	uint32_t id, payload, slot;
+	pthread_t srv;
+
+	rpc_init(&ch, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY);
+	stop = 0;
+	memset(lat, 0, sizeof(struct latency_hist));
+	pthread_create(&srv, NULL, server, NULL);
+
+	wait_init(&ws, ch.resp.wait);
+	wait_init(&wf, ch.req.wait);
+	start = rdtsc_bare();
+	while (done < test_size) {
+		/* Top the window up to k. */
+		while (sent - done < k && sent < test_size) {
+			now = rdtsc_bare();
+			if (rpc_send(&ch, (uint32_t)sent, &id) != SUCCESS) {
+				wait_for(&wf, ch.req.penalty);
+				continue;
+			}
+			slot = id & (MAX_OUTSTANDING - 1);
+			sent_at[slot] = now;
+			payload_of[slot] = (uint32_t)sent;
+			sent ++;
+		}
+		if (rpc_poll(&ch, &id, &payload) != SUCCESS) {
+			wait_idle(&ws, &ch.resp.data[ch.resp.tail]);
+			continue;
+		}
+		now = rdtsc_bare();
+		wait_reset(&ws);
+		slot = id & (MAX_OUTSTANDING - 1);
+		if (sent_at[slot] == 0 || payload != payload_of[slot] + 1)
+			errors ++;
+		else
+			latency_record(lat, tsc_sub_overhead(now - sent_at[slot]));
+		sent_at[slot] = 0;
+		done ++;
+	}
+	*rate = done / tsc_to_ns(rdtsc_bare() - start) * 1e3;
+
+	stop = 1;
+	pthread_join(srv, NULL);
+	rpc_destroy(&ch);
+	return errors;
+}
+
+/* Parse "a,b,c" into at most max numbers; returns how many were read. */
+static int parse_list(const char *s, uint64_t *out, int max)
+{
+	int n = 0;
+	char *end;
+
+	while (*s && n < max) {
+		out[n++] = strtoull(s, &end, 0);
+		if (*end != ',')
+			break;
+		s = end + 1;
+	}
+	return n;
+}
+
+/* Distinct (producer, consumer) pairs of an affinity file, in order. */
+static int read_placements(const char *path, int pairs[][2])
+{
+	FILE *fp = fopen(path, "r");
+	int i, j, n = 0, p, c;
+
+	if (fp == NULL) {
+		printf("Incorrect affinity file parameter.\n");
+		return -1;
+	}
+	for (i = 0; i < MAX_CORE_NUM; i++) {
+		if (fscanf(fp, "%d", &p) != 1 || fscanf(fp, "%d", &c) != 1) {
+			fclose(fp);
+			printf("Incorrect affinity file format.\n");
+			return -1;
+		}
+		for (j = 0; j < n; j++)
+			if (pairs[j][0] == p && pairs[j][1] == c)
+				break;
+		if (j == n) {
+			pairs[n][0] = p;
+			pairs[n][1] = c;
+			n ++;
+		}
+	}
+	fclose(fp);
+	return n;
+}
+
+int main(int argc, char *argv[])
+{
+	uint64_t levels[MAX_LEVELS] = { 1, 2, 4, 8, 16 };
+	int pairs[MAX_CORE_NUM][2];
+	const char *affinity = "affinity.tree.conf";
+	int nr_levels = 5, nr_pairs, opt, i, l;
+	struct latency_hist lat;
+	uint64_t errors;
+	double rate;
+
+	char * usage =
+		"Usage: rpc_bench [-t round trips per run (default: 1,000,000)]\n\
+		[-o requests outstanding, e.g. 1,2,4,8,16 (default), at most 128]\n\
+		[-a affinity conf., one run per client/server pair (default: affinity.tree.conf)]\n\
+		[-w server workload per request (default: 0 cycles)]\n\
+		[-W wait strategy: spin, pause, backoff, yield, umwait (default: pause)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:o:a:w:W:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'o':
+				nr_levels = parse_list(optarg, levels, MAX_LEVELS);
+				break;
+			case 'a':
+				affinity = optarg;
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'W':
+				if (wait_parse(optarg) < 0) {
+					printf("%s\n", usage);
+					exit(-1);
+				}
+				wait_default = wait_parse(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	for (l = 0; l < nr_levels; l++) {
+		if (levels[l] < 1 || levels[l] > MAX_OUTSTANDING) {
+			printf("Outstanding requests must be in [1, %d].\n",
+					MAX_OUTSTANDING);
+			exit(-1);
+		}
+	}
+	if ((nr_pairs = read_placements(affinity, pairs)) < 0)
+		exit(-1);
+
+	tsc_init();
+	printf("%-6s %-6s %5s %10s %10s %10s %10s %10s %10s %10s %8s\n",
+			"client", "server", "outst", "avg", "p50", "p90", "p99",
+			"p99.9", "max", "Mreq/s", "errors");
+	for (i = 0; i < nr_pairs; i++) {
+		server_core = pairs[i][1];
+		pin(pairs[i][0]);
+		for (l = 0; l < nr_levels; l++) {
+			errors = run(levels[l], &lat, &rate);
+			printf("%-6d %-6d %5lu %10.0f %10.0f %10.0f %10.0f %10.0f "
+					"%10.0f %10.3f %8lu\n", pairs[i][0], pairs[i][1],
+					levels[l], tsc_out(latency_avg(&lat)),
+					tsc_out(latency_percentile(&lat, 50)),
+					tsc_out(latency_percentile(&lat, 90)),
+					tsc_out(latency_percentile(&lat, 99)),
+					tsc_out(latency_percentile(&lat, 99.9)),
+					tsc_out(lat.max), rate, errors);
+		}
+	}
+	printf("Round-trip times in %s.\n", tsc_unit());
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *  slot_bench.c: Stream throughput and cache misses of the compact
+ *  queue (cqueue.c) for each slot layout: 16, 32 and 64-bit slots, and
+ *  one slot per cache line.
+ *
+ *  Every layout gets the same number of slots, so the ring takes 2, 4,
+ *  8 and 64 bytes per element.  With -e the producer and the consumer
+ *  count L1d and LLC misses and, on Intel, loads that hit a line
+ *  modified by the other core (HITM), i.e. the coherence misses of the
+ *  cache lines passed between them.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "cqueue.h"
+#include "perf.h"
+#include "wait.h"
+
+#define DEFAULT_TEST_SIZE 20000000
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t queue_size = DEFAULT_QUEUE_SIZE;
+static int producer_core = 0;
+static int consumer_core = 1;
+static int perf_enabled;
+
+static struct cqueue_t q __attribute__ ((aligned(128)));
+static struct perf_counters pc_prod, pc_cons;
+static uint64_t order_errors;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+/* Elements run 1..max_value, then around again. */
+static inline uint64_t next_element(uint64_t v)
+{
+	return v == q.max_value ? 1 : v + 1;
+}
+
+static void *consumer(void *arg)
+{
+	struct wait_state ws;
+	uint64_t i, value, expected = 1;
+	int flag;
+
+	pin(consumer_core);
+	wait_init(&ws, q.wait);
+	if (perf_enabled && perf_open(&pc_cons) > 0)
+		perf_start(&pc_cons);
+	for (i = 0; i < test_size; i++) {
+		flag = 0;
+		while (cqueue_dequeue(&q, &value) != SUCCESS) {
+			if (flag == 0) {
+				q.empty_counter ++;
+				flag = 1;
+			}
+			wait_for(&ws, DEFAULT_PENALTY);
+		}
+		if (flag)
+			wait_reset(&ws);
+		if (value != expected)
+			order_errors ++;
+		expected = next_element(value);
+	}
+	if (perf_enabled && pc_cons.nr_open > 0)
+		perf_stop(&pc_cons);
+	return NULL;
+}
+
+/* Returns elements per second. */
+static double run(uint32_t layout)
+{
+	struct wait_state ws;
+	struct timespec t0, t1;
+	pthread_t cons;
+	uint64_t i, v = 1;
+
+	cqueue_init(&q, queue_size, layout, DEFAULT_PENALTY);
+	memset(&pc_prod, 0, sizeof(pc_prod));
+	memset(&pc_cons, 0, sizeof(pc_cons));
+	order_errors = 0;
+	pthread_create(&cons, NULL, consumer, NULL);
+
+	wait_init(&ws, q.wait);
+	if (perf_enabled && perf_open(&pc_prod) > 0)
+		perf_start(&pc_prod);
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < test_size; i++) {
+		while (cqueue_enqueue(&q, v) != SUCCESS) {
+			q.full_counter ++;
+			wait_for(&ws, q.penalty);
+		}
+		v = next_element(v);
+	}
+	pthread_join(cons, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	if (perf_enabled && pc_prod.nr_open > 0)
+		perf_stop(&pc_prod);
+
+	return test_size / ((t1.tv_sec - t0.tv_sec) +
+			(t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+/* Counter k per element, producer plus consumer; negative if either
+ * side could not count it. */
+static double per_op(int k)
+{
+	if (pc_prod.nr_open == 0 || pc_cons.nr_open == 0 ||
+			pc_prod.fd[k] < 0 || pc_cons.fd[k] < 0)
+		return -1;
+	return (double)(pc_prod.value[k] + pc_cons.value[k]) / test_size;
+}
+
+static void print_counter(int k)
+{
+	double v = per_op(k);
+
+	if (v < 0)
+		printf(" %10s", "n/a");
+	else
+		printf(" %10.4f", v);
+}
+
+int main(int argc, char *argv[])
+{
+	int layouts[NR_SLOT_LAYOUTS] = { SLOT_16, SLOT_32, SLOT_64, SLOT_PADDED };
+	int nr_layouts = NR_SLOT_LAYOUTS, opt, k;
+	char *s, *tok;
+	double rate;
+
+	char * usage =
+		"Usage: slot_bench [-t test_size (default: 20,000,000)]\n\
+		[-l layouts, e.g. 16,32,64,pad (default: all)]\n\
+		[-q queue size in slots (default: 2048)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-e count cache misses with perf_event_open()]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "het:l:q:a:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'l':
+				nr_layouts = 0;
+				s = strdup(optarg);
+				for (tok = strtok(s, ","); tok && nr_layouts < NR_SLOT_LAYOUTS;
+						tok = strtok(NULL, ",")) {
+					if (strcmp(tok, "16") == 0)
+						layouts[nr_layouts++] = SLOT_16;
+					else if (strcmp(tok, "32") == 0)
+						layouts[nr_layouts++] = SLOT_32;
+					else if (strcmp(tok, "64") == 0)
+						layouts[nr_layouts++] = SLOT_64;
+					else if (strcmp(tok, "pad") == 0)
+						layouts[nr_layouts++] = SLOT_PADDED;
+					else {
+						printf("Unknown slot layout %s.\n", tok);
+						exit(-1);
+					}
+				}
+				free(s);
+				break;
+			case 'q':
+				queue_size = atoll(optarg);
+				break;
+			case 'a':
+				producer_core = atoi(optarg);
+				break;
+			case 'b':
+				consumer_core = atoi(optarg);
+				break;
+			case 'e':
+				perf_enabled = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+	pin(producer_core);
+	printf("%-8s %10s %10s %12s %10s %10s %10s %10s\n", "layout",
+			"slots/line", "ring bytes", "Mitems/s", "L1d/op", "LLC/op",
+			"HITM/op", "errors");
+	for (k = 0; k < nr_layouts; k++) {
+		rate = run(layouts[k]);
+		printf("%-8s %10u %10lu %12.2f", slot_name(layouts[k]),
+				layouts[k] == SLOT_PADDED ? 1 :
+				CACHE_LINE / slot_bytes(layouts[k]), q.bytes, rate / 1e6);
+		print_counter(PERF_L1D_MISSES);
+		print_counter(PERF_LLC_MISSES);
+		print_counter(PERF_HITM);
+		printf(" %10lu\n", order_errors);
+		if (perf_enabled) {
+			perf_close(&pc_prod);
+			perf_close(&pc_cons);
+		}
+		cqueue_destroy(&q);
+	}
+	if (perf_enabled)
+		printf("Cache misses per element, producer plus consumer.\n");
+	return 0;
+}
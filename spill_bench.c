@@ -0,0 +1,226 @@
+/*
+ *  spill_bench.c: Producer latency through an overflow, with and without
+ *  the spill-to-file mode.
+ *
+ *  The producer first runs flat out for half of the items (the burst),
+ *  which overruns a consumer spending `workload' cycles per item until
+ *  the ring reaches MAX_QUEUE_SIZE.  It then slows down to one item per
+ *  `cool' cycles so that the consumer can catch up and drain the spill
+ *  file.  Every enqueue (including retries) is timed.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include "fifo.h"
+#include "latency.h"
+#include "tsc.h"
+
+#define DEFAULT_TEST_SIZE 4000000
+
+/* Latency classes of an enqueue. */
+#define PHASE_BURST 0
+#define PHASE_COOL 1
+#define PHASE_SPILL 2	/* the element went to the spill file */
+#define NR_PHASES 3
+
+static const char *phase_name[NR_PHASES] = { "burst", "cool-down", "spilled" };
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t workload = 200;
+static uint64_t cool = 400;
+static uint64_t queue_size = DEFAULT_QUEUE_SIZE;
+static int producer_core = 0;
+static int consumer_core = 1;
+
+static struct queue_t q __attribute__ ((aligned(128)));
+static struct latency_hist lat[NR_PHASES];
+static uint64_t errors;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static void *consumer(void *arg)
+{
+	ELEMENT_TYPE value;
+	uint64_t i;
+	int flag;
+
+	pin(consumer_core);
+	for (i = 1; i <= test_size; i++) {
+		flag = 0;
+		while (dequeue(&q, &value) != SUCCESS) {
+			if (flag == 0) {
+				q.empty_counter ++;
+				q.traffic_empty ++;
+				flag = 1;
+			}
+		}
+		if (value != i)
+			errors ++;
+		wait_ticks(workload);
+	}
+	return NULL;
+}
+
+static void *producer(void *arg)
+{
+	uint64_t i, start, spilled;
+	int flag, phase;
+
+	pin(producer_core);
+	for (i = 1; i <= test_size; i++) {
+		spilled = q.spill ? q.spill->spilled_bytes : 0;
+		start = rdtsc_bare();
+		flag = 0;
+		while (enqueue(&q, (ELEMENT_TYPE)i) != SUCCESS) {
+			if (flag == 0) {
+				q.full_counter ++;
+				q.traffic_full ++;
+				flag = 1;
+			}
+			wait_ticks(q.penalty);
+		}
+		if (q.spill && q.spill->spilled_bytes != spilled)
+			phase = PHASE_SPILL;
+		else
+			phase = i <= test_size / 2 ? PHASE_BURST : PHASE_COOL;
+		latency_record(&lat[phase], tsc_sub_overhead(rdtsc_bare() - start));
+
+		if (i > test_size / 2)
+			wait_ticks(cool);
+	}
+	return NULL;
+}
+
+static int run(const char *spill_path, uint64_t spill_size)
+{
+	pthread_t prod, cons;
+	int k;
+
+	memset(lat, 0, sizeof(lat));
+	errors = 0;
+	queue_init(&q, queue_size, DEFAULT_PENALTY, OVERFLOW_BLOCK);
+	if (spill_path && queue_spill_init(&q, spill_path, spill_size) != 0)
+		return -1;
+
+	pthread_create(&cons, NULL, consumer, NULL);
+	pthread_create(&prod, NULL, producer, NULL);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+
+	printf("===== %s =====\n", spill_path ? "spill to file" : "block (no spill)");
+	for (k = 0; k < NR_PHASES; k++) {
+		if (lat[k].count == 0)
+			continue;
+		printf("%-10s enqueues %9lu  avg %8.0f  p50 < %8.0f  p99 < %10.0f  p99.9 < %10.0f  max %10.0f %s\n",
+				phase_name[k], lat[k].count,
+				tsc_out(latency_avg(&lat[k])),
+				tsc_out(latency_percentile(&lat[k], 50)),
+				tsc_out(latency_percentile(&lat[k], 99)),
+				tsc_out(latency_percentile(&lat[k], 99.9)),
+				tsc_out(lat[k].max), tsc_unit());
+	}
+	printf("Buffer full: %u, final queue size: %u, order errors: %lu\n",
+			q.full_counter, q.info.queue_size, errors);
+	if (q.spill)
+		printf("Spill: events %lu, spilled %lu bytes, drained %lu bytes, max drain lag %lu items\n",
+				q.spill->spill_events, q.spill->spilled_bytes,
+				q.spill->drained_bytes, q.spill->max_lag);
+
+	queue_destroy(&q);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	const char *spill_path = "/tmp/equeue.spill";
+	uint64_t spill_size = DEFAULT_SPILL_SIZE;
+	int opt;
+
+	char * usage =
+		"Usage: spill_bench [-t test_size (default: 4,000,000)]\n\
+		[-w consumer workload (default: 200 cycles)]\n\
+		[-l producer cycles/item after the burst (default: 400)]\n\
+		[-q initial queue size (default: 1024*2)]\n\
+		[-f spill file (default: /tmp/equeue.spill)]\n\
+		[-m spill file size in bytes (default: 1 GB)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:w:l:q:f:m:a:b:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'l':
+				cool = atoll(optarg);
+				break;
+			case 'q':
+				queue_size = atoll(optarg);
+				break;
+			case 'f':
+				spill_path = optarg;
+				break;
+			case 'm':
+				spill_size = atoll(optarg);
+				break;
+			case 'a':
+				producer_core = atoi(optarg);
+				break;
+			case 'b':
+				consumer_core = atoi(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+
+	tsc_init();
+	printf("Test ready to run. Items: %lu, workload: %lu, cool-down: %lu\n",
+			test_size, workload, cool);
+
+	if (run(NULL, 0) != 0)
+		return -1;
+	if (run(spill_path, spill_size) != 0)
+		return -1;
+
+	return 0;
+}
@@ -0,0 +1,352 @@
+/*
+ *  stats.c: Statistics of repeated benchmark runs, see stats.h.
+ *
+ *  The median is used rather than the mean because run times are
+ *  skewed: a run that lost the CPU for a while is much slower, never
+ *  much faster.  For the same reason the comparison uses a rank test
+ *  (Mann-Whitney U), which assumes no distribution.
+ *
+ *  A baseline file is text:
+ *
+ *      # EQueue baseline
+ *      env turbo=on governor=performance
+ *      metric <name> <better> <n> <v1> ... <vn>
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "stats.h"
+
+int stats_add(struct sample_set *sets, int *nr, int max, const char *name,
+		int better, double v)
+{
+	int i;
+
+	for (i = 0; i < *nr; i++)
+		if (strcmp(sets[i].name, name) == 0)
+			break;
+	if (i == *nr) {
+		if (*nr == max)
+			return -1;
+		memset(&sets[i], 0, sizeof(struct sample_set));
+		snprintf(sets[i].name, STATS_NAME_LEN, "%s", name);
+		sets[i].better = better;
+		(*nr) ++;
+	}
+	if (sets[i].n == MAX_REPS)
+		return -1;
+	sets[i].v[sets[i].n++] = v;
+	return 0;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void sorted(const struct sample_set *s, double *out)
+{
+	memcpy(out, s->v, s->n * sizeof(double));
+	qsort(out, s->n, sizeof(double), cmp_double);
+}
+
+double stats_median(const struct sample_set *s)
+{
+	double v[MAX_REPS];
+
+	if (s->n == 0)
+		return 0;
+	sorted(s, v);
+	return s->n & 1 ? v[s->n / 2] : (v[s->n / 2 - 1] + v[s->n / 2]) / 2;
+}
+
+/* [x(j), x(n-j+1)] covers the median with probability 1 - 2 P(X < j),
+ * X ~ Binomial(n, 1/2); j is the largest that keeps this >= 95%. */
+double stats_median_ci(const struct sample_set *s, double *lo, double *hi)
+{
+	double v[MAX_REPS], p = pow(0.5, s->n), tail = 0;
+	uint32_t j = 0, k;
+
+	if (s->n == 0) {
+		*lo = *hi = 0;
+		return 0;
+	}
+	sorted(s, v);
+	/* P(X = k) from P(X = k - 1). */
+	for (k = 0; k < s->n / 2; k++) {
+		if (2 * (tail + p) > 0.05)
+			break;
+		tail += p;
+		j = k + 1;
+		p = p * (s->n - k) / (k + 1);
+	}
+	if (j == 0) {
+		*lo = v[0];
+		*hi = v[s->n - 1];
+		return 1 - 2 * pow(0.5, s->n);
+	}
+	*lo = v[j - 1];
+	*hi = v[s->n - j];
+	return 1 - 2 * tail;
+}
+
+static double mean(const struct sample_set *s)
+{
+	double sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < s->n; i++)
+		sum += s->v[i];
+	return s->n ? sum / s->n : 0;
+}
+
+static double stddev(const struct sample_set *s)
+{
+	double m = mean(s), sum = 0;
+	uint32_t i;
+
+	for (i = 0; i < s->n; i++)
+		sum += (s->v[i] - m) * (s->v[i] - m);
+	return s->n > 1 ? sqrt(sum / (s->n - 1)) : 0;
+}
+
+struct ranked {
+	double v;
+	int group;
+};
+
+static int cmp_ranked(const void *a, const void *b)
+{
+	return cmp_double(&((const struct ranked *)a)->v,
+			&((const struct ranked *)b)->v);
+}
+
+double stats_mann_whitney(const struct sample_set *a, const struct sample_set *b)
+{
+	struct ranked all[2 * MAX_REPS];
+	double r1 = 0, ties = 0, u, mu, sigma, z, t, rank;
+	uint32_t n = a->n + b->n, i, j, k;
+
+	if (a->n == 0 || b->n == 0)
+		return 1;
+	for (i = 0; i < a->n; i++)
+		all[i] = (struct ranked){ a->v[i], 0 };
+	for (i = 0; i < b->n; i++)
+		all[a->n + i] = (struct ranked){ b->v[i], 1 };
+	qsort(all, n, sizeof(struct ranked), cmp_ranked);
+
+	/* Tied values share their average rank. */
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && all[j].v == all[i].v; j++)
+			;
+		t = j - i;
+		rank = (i + 1 + j) / 2.0;
+		for (k = i; k < j; k++)
+			if (all[k].group == 0)
+				r1 += rank;
+		ties += t * t * t - t;
+	}
+	u = r1 - a->n * (a->n + 1) / 2.0;
+	mu = a->n * (double)b->n / 2;
+	sigma = sqrt(a->n * (double)b->n / 12 *
+			((n + 1) - ties / ((double)n * (n - 1))));
+	if (sigma == 0)
+		return 1;
+	z = (fabs(u - mu) - 0.5) / sigma;
+	if (z < 0)
+		z = 0;
+	return erfc(z / sqrt(2));
+}
+
+static int read_word(const char *path, char *buf, size_t len)
+{
+	FILE *fp = fopen(path, "r");
+	int ok;
+
+	if (fp == NULL)
+		return -1;
+	ok = fgets(buf, len, fp) != NULL;
+	fclose(fp);
+	if (!ok)
+		return -1;
+	buf[strcspn(buf, "\n")] = '\0';
+	return 0;
+}
+
+void stats_env(char *buf, size_t len)
+{
+	char turbo[32] = "unknown", gov[32] = "unknown", v[32];
+
+	if (read_word("/sys/devices/system/cpu/intel_pstate/no_turbo", v,
+				sizeof(v)) == 0)
+		snprintf(turbo, sizeof(turbo), "%s", atoi(v) ? "off" : "on");
+	else if (read_word("/sys/devices/system/cpu/cpufreq/boost", v,
+				sizeof(v)) == 0)
+		snprintf(turbo, sizeof(turbo), "%s", atoi(v) ? "on" : "off");
+	read_word("/sys/devices/system/cpu/cpu0/cpufreq/scaling_governor", gov,
+			sizeof(gov));
+	snprintf(buf, len, "turbo=%s governor=%s", turbo, gov);
+}
+
+/* cpufreq if the kernel has it, else "cpu MHz" of /proc/cpuinfo. */
+double stats_cpu_mhz(int cpu)
+{
+	char path[96], line[256];
+	int cur = -1;
+	FILE *fp;
+
+	snprintf(path, sizeof(path),
+			"/sys/devices/system/cpu/cpu%d/cpufreq/scaling_cur_freq", cpu);
+	if (read_word(path, line, sizeof(line)) == 0)
+		return atof(line) / 1000;
+	if ((fp = fopen("/proc/cpuinfo", "r")) == NULL)
+		return 0;
+	while (fgets(line, sizeof(line), fp)) {
+		if (strncmp(line, "processor", 9) == 0)
+			cur = atoi(strchr(line, ':') + 1);
+		else if (cur == cpu && strncmp(line, "cpu MHz", 7) == 0) {
+			fclose(fp);
+			return atof(strchr(line, ':') + 1);
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+void stats_report(FILE *out, const struct sample_set *sets, int nr)
+{
+	double lo, hi, cover, m;
+	int i;
+
+	fprintf(out, "%-48s %4s %12s %25s %12s %8s\n", "metric", "n", "median",
+			"CI of the median", "mean", "cv");
+	for (i = 0; i < nr; i++) {
+		m = mean(&sets[i]);
+		cover = stats_median_ci(&sets[i], &lo, &hi);
+		fprintf(out, "%-48s %4u %12.2f [%10.2f, %10.2f] %3.0f%% %8.2f %7.2f%%\n",
+				sets[i].name, sets[i].n, stats_median(&sets[i]), lo, hi,
+				100 * cover, m, m != 0 ? 100 * stddev(&sets[i]) / m : 0.0);
+	}
+}
+
+int stats_save(const char *path, const struct sample_set *sets, int nr,
+		const char *env)
+{
+	FILE *fp = fopen(path, "w");
+	uint32_t k;
+	int i;
+
+	if (fp == NULL) {
+		printf("Error: cannot create baseline %s.\n", path);
+		return -1;
+	}
+	fprintf(fp, "# EQueue baseline\nenv %s\n", env);
+	for (i = 0; i < nr; i++) {
+		fprintf(fp, "metric %s %d %u", sets[i].name, sets[i].better, sets[i].n);
+		for (k = 0; k < sets[i].n; k++)
+			fprintf(fp, " %.17g", sets[i].v[k]);
+		fprintf(fp, "\n");
+	}
+	return fclose(fp);
+}
+
+/* Returns the number of metrics read, or -1. */
+int stats_load(const char *path, struct sample_set *sets, int max, char *env,
+		size_t env_len)
+{
+	char line[8192], *tok, *save;
+	FILE *fp = fopen(path, "r");
+	struct sample_set *s;
+	uint32_t k, n;
+	int nr = 0;
+
+	if (fp == NULL) {
+		printf("Error: cannot open baseline %s.\n", path);
+		return -1;
+	}
+	env[0] = '\0';
+	while (fgets(line, sizeof(line), fp) && nr < max) {
+		line[strcspn(line, "\n")] = '\0';
+		if (strncmp(line, "env ", 4) == 0) {
+			snprintf(env, env_len, "%s", line + 4);
+			continue;
+		}
+		if (strncmp(line, "metric ", 7) != 0)
+			continue;
+		s = &sets[nr];
+		memset(s, 0, sizeof(struct sample_set));
+		if ((tok = strtok_r(line + 7, " ", &save)) == NULL)
+			continue;
+		snprintf(s->name, STATS_NAME_LEN, "%s", tok);
+		if ((tok = strtok_r(NULL, " ", &save)) == NULL)
+			continue;
+		s->better = atoi(tok);
+		if ((tok = strtok_r(NULL, " ", &save)) == NULL)
+			continue;
+		n = atoi(tok);
+		for (k = 0; k < n && k < MAX_REPS &&
+				(tok = strtok_r(NULL, " ", &save)); k++)
+			s->v[s->n++] = atof(tok);
+		nr ++;
+	}
+	fclose(fp);
+	return nr;
+}
+
+int stats_compare(FILE *out, const struct sample_set *cur, int nr_cur,
+		const struct sample_set *base, int nr_base)
+{
+	double m0, m1, p, change;
+	const char *verdict;
+	int i, j, worse, regressions = 0;
+
+	fprintf(out, "%-48s %12s %12s %9s %8s  %s\n", "metric", "baseline",
+			"now", "change", "p", "verdict");
+	for (i = 0; i < nr_cur; i++) {
+		if (cur[i].better == STATS_INFO)
+			continue;
+		for (j = 0; j < nr_base; j++)
+			if (strcmp(cur[i].name, base[j].name) == 0)
+				break;
+		if (j == nr_base) {
+			fprintf(out, "%-48s %12s %12.2f %9s %8s  not in baseline\n",
+					cur[i].name, "-", stats_median(&cur[i]), "-", "-");
+			continue;
+		}
+		m0 = stats_median(&base[j]);
+		m1 = stats_median(&cur[i]);
+		change = m0 != 0 ? 100 * (m1 - m0) / m0 : 0;
+		p = stats_mann_whitney(&base[j], &cur[i]);
+		worse = cur[i].better == STATS_LOWER ? m1 > m0 : m1 < m0;
+		if (p >= STATS_ALPHA)
+			verdict = "same";
+		else if (worse) {
+			verdict = "REGRESSION";
+			regressions ++;
+		}
+		else
+			verdict = "improved";
+		fprintf(out, "%-48s %12.2f %12.2f %+8.2f%% %8.4f  %s\n", cur[i].name,
+				m0, m1, change, p, verdict);
+	}
+	return regressions;
+}
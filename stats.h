@@ -0,0 +1,69 @@
+/*
+ *  stats.h: Repeated benchmark runs: per-metric samples, median and its
+ *  confidence interval, and comparison against a stored baseline.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _EQUEUE_STATS_H_
+#define _EQUEUE_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define MAX_REPS 64
+#define MAX_METRICS 128
+#define STATS_NAME_LEN 96
+#define STATS_ENV_LEN 128
+#define STATS_ALPHA 0.05	/* significance level of the comparison */
+
+/* Which way a metric improves.  STATS_INFO metrics (e.g. the CPU
+ * frequency) are reported but never flagged. */
+#define STATS_LOWER 0
+#define STATS_HIGHER 1
+#define STATS_INFO 2
+
+struct sample_set {
+	char name[STATS_NAME_LEN];	/* no blanks */
+	int better;
+	uint32_t n;
+	double v[MAX_REPS];
+};
+
+/* Append v to the set called name, creating it if needed; returns -1
+ * when the table or the set is full. */
+int stats_add(struct sample_set *, int *, int, const char *, int, double);
+double stats_median(const struct sample_set *);
+/* Distribution-free interval of the median from order statistics;
+ * returns its actual coverage, below 0.95 for fewer than 6 samples. */
+double stats_median_ci(const struct sample_set *, double *, double *);
+/* Two-sided p-value of the Mann-Whitney U test (normal approximation). */
+double stats_mann_whitney(const struct sample_set *, const struct sample_set *);
+
+/* Turbo and governor state, "turbo=on governor=performance". */
+void stats_env(char *, size_t);
+/* Current frequency of a CPU in MHz; 0 if unknown. */
+double stats_cpu_mhz(int);
+
+void stats_report(FILE *, const struct sample_set *, int);
+int stats_save(const char *, const struct sample_set *, int, const char *);
+int stats_load(const char *, struct sample_set *, int, char *, size_t);
+/* Returns the number of metrics flagged as regressions. */
+int stats_compare(FILE *, const struct sample_set *, int,
+		const struct sample_set *, int);
+
+#endif
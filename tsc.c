@@ -0,0 +1,114 @@
+/*
+ *  tsc.c: Calibrated time-stamp counter for the benchmarks.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <time.h>
+#include "fifo.h"
+#include "tsc.h"
+
+/* Length of one calibration window and number of windows. */
+#define TSC_CALIBRATE_NS (20 * 1000 * 1000UL)
+#define TSC_CALIBRATE_ROUNDS 5
+#define TSC_OVERHEAD_ROUNDS 10000
+
+struct tsc_clock tsc_clock;
+int tsc_ns_output;
+
+static uint64_t mono_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+static int tsc_invariant(void)
+{
+	uint32_t eax, ebx, ecx, edx;
+
+	__asm__ __volatile__("cpuid"
+			: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+			: "a"(0x80000000), "c"(0));
+	if (eax < 0x80000007)
+		return 0;
+	__asm__ __volatile__("cpuid"
+			: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+			: "a"(0x80000007), "c"(0));
+	return (edx >> 8) & 1;
+}
+
+/* Minimum cost of two back-to-back reads. */
+#define TSC_OVERHEAD(read) ({					\
+	uint64_t __min = ~0UL, __a, __b;			\
+	int __k;						\
+	for (__k = 0; __k < TSC_OVERHEAD_ROUNDS; __k++) {	\
+		__a = read();					\
+		__b = read();					\
+		if (__b - __a < __min)				\
+			__min = __b - __a;			\
+	}							\
+	__min;							\
+})
+
+/* Each window brackets the TSC reads with the clock reads; the median
+ * of the windows filters out the ones hit by an interrupt. */
+static double tsc_calibrate(void)
+{
+	double rate[TSC_CALIBRATE_ROUNDS], tmp;
+	uint64_t t0, t1, c0, c1;
+	int k, j;
+
+	for (k = 0; k < TSC_CALIBRATE_ROUNDS; k++) {
+		t0 = mono_ns();
+		c0 = rdtscp();
+		do {
+			t1 = mono_ns();
+		} while (t1 - t0 < TSC_CALIBRATE_NS);
+		c1 = rdtscp();
+		rate[k] = (double)(c1 - c0) / (t1 - t0);
+	}
+	for (k = 1; k < TSC_CALIBRATE_ROUNDS; k++)
+		for (j = k; j > 0 && rate[j - 1] > rate[j]; j--) {
+			tmp = rate[j];
+			rate[j] = rate[j - 1];
+			rate[j - 1] = tmp;
+		}
+	return rate[TSC_CALIBRATE_ROUNDS / 2];
+}
+
+void tsc_init(void)
+{
+	if (tsc_clock.ticks_per_ns > 0)
+		return;
+
+	tsc_clock.invariant = tsc_invariant();
+	if (!tsc_clock.invariant)
+		printf("Warning: the TSC is not invariant; cycle counts and nanoseconds may drift with the CPU frequency.\n");
+	tsc_clock.ticks_per_ns = tsc_calibrate();
+	tsc_clock.overhead_bare = TSC_OVERHEAD(rdtsc_bare);
+	tsc_clock.overhead_serial = TSC_OVERHEAD(rdtscp);
+	tsc_clock.overhead_barrier = TSC_OVERHEAD(rdtsc_barrier);
+
+	printf("===== TSC: %.3f GHz, invariant: %s, overhead (cycles): rdtsc %lu, rdtscp %lu, rdtsc_barrier %lu =====\n",
+			tsc_clock.ticks_per_ns,
+			tsc_clock.invariant ? "yes" : "no",
+			tsc_clock.overhead_bare, tsc_clock.overhead_serial,
+			tsc_clock.overhead_barrier);
+}
@@ -0,0 +1,83 @@
+/*
+ *  tsc.h: Calibrated time-stamp counter for the benchmarks.
+ *
+ *  tsc_init() measures the TSC frequency against CLOCK_MONOTONIC,
+ *  checks for an invariant TSC and measures the overhead of the three
+ *  TSC reads of fifo.c (rdtsc_bare(), rdtscp() and rdtsc_barrier()).
+ *  Benchmarks keep counting in cycles and convert when printing:
+ *  tsc_out() and tsc_unit() give nanoseconds once tsc_ns_output is set
+ *  (their -N option), cycles otherwise.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_TSC_H_
+#define _FIFO_TSC_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct tsc_clock {
+	double ticks_per_ns;		/* 0 until tsc_init() */
+	int invariant;			/* CPUID.80000007H:EDX[8] */
+	uint64_t overhead_bare;		/* back-to-back rdtsc_bare(), cycles */
+	uint64_t overhead_serial;	/* back-to-back rdtscp() */
+	uint64_t overhead_barrier;	/* back-to-back rdtsc_barrier() */
+};
+
+extern struct tsc_clock tsc_clock;
+extern int tsc_ns_output;
+
+void tsc_init(void);
+
+static inline double tsc_to_ns(uint64_t cycles)
+{
+	return tsc_clock.ticks_per_ns > 0 ? cycles / tsc_clock.ticks_per_ns : 0.0;
+}
+
+/* A value measured with a pair of rdtsc_bare(), less the cost of the
+ * pair itself. */
+static inline uint64_t tsc_sub_overhead(uint64_t cycles)
+{
+	return cycles > tsc_clock.overhead_bare ? cycles - tsc_clock.overhead_bare : 0;
+}
+
+/* Cycles in the unit chosen for output. */
+static inline double tsc_out(uint64_t cycles)
+{
+	return tsc_ns_output ? tsc_to_ns(cycles) : (double)cycles;
+}
+
+/* Same for a difference, which may be negative. */
+static inline double tsc_out_diff(int64_t cycles)
+{
+	return cycles < 0 ? -tsc_out(-cycles) : tsc_out(cycles);
+}
+
+static inline const char *tsc_unit(void)
+{
+	return tsc_ns_output ? "ns" : "cycles";
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,176 @@
+/*
+ *  wait.c: Wait strategies for the full and empty paths of EQueue.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <sched.h>
+#include <string.h>
+#include "fifo.h"
+#include "wait.h"
+
+uint32_t wait_default = WAIT_PAUSE;
+
+static const char *wait_names[NR_WAIT] = {
+	"spin", "pause", "backoff", "yield", "umwait"
+};
+
+static inline void cpu_relax(void)
+{
+	__asm__ __volatile__("pause" ::: "memory");
+}
+
+static int has_waitpkg(void)
+{
+	static int cached = -1;
+	uint32_t eax, ebx, ecx, edx;
+
+	if (cached >= 0)
+		return cached;
+	__asm__ __volatile__("cpuid"
+			: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+			: "a"(0), "c"(0));
+	cached = 0;
+	if (eax >= 7) {
+		__asm__ __volatile__("cpuid"
+				: "=a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx)
+				: "a"(7), "c"(0));
+		cached = (ecx >> 5) & 1;
+	}
+	return cached;
+}
+
+/* WAITPKG instructions, spelled out so that no -mwaitpkg is needed.
+ * ecx = 1 selects the C0.1 state, the one with the faster wake-up. */
+static inline void tpause(uint64_t deadline)
+{
+	__asm__ __volatile__(".byte 0x66, 0x0f, 0xae, 0xf1"	/* tpause %ecx */
+			:: "c"(1), "a"((uint32_t)deadline),
+			"d"((uint32_t)(deadline >> 32)) : "cc", "memory");
+}
+
+static inline void umonitor(const volatile void *addr)
+{
+	__asm__ __volatile__(".byte 0xf3, 0x0f, 0xae, 0xf0"	/* umonitor %rax */
+			:: "a"(addr) : "memory");
+}
+
+static inline void umwait(uint64_t deadline)
+{
+	__asm__ __volatile__(".byte 0xf2, 0x0f, 0xae, 0xf1"	/* umwait %ecx */
+			:: "c"(1), "a"((uint32_t)deadline),
+			"d"((uint32_t)(deadline >> 32)) : "cc", "memory");
+}
+
+uint32_t wait_supported(uint32_t strategy)
+{
+	if (strategy >= NR_WAIT)
+		return WAIT_PAUSE;
+	if (strategy == WAIT_UMWAIT && !has_waitpkg())
+		return WAIT_PAUSE;
+	return strategy;
+}
+
+int wait_parse(const char *name)
+{
+	int k;
+
+	for (k = 0; k < NR_WAIT; k++)
+		if (strcmp(name, wait_names[k]) == 0)
+			return k;
+	return -1;
+}
+
+const char *wait_name(uint32_t strategy)
+{
+	return strategy < NR_WAIT ? wait_names[strategy] : "?";
+}
+
+void wait_init(struct wait_state *ws, uint32_t strategy)
+{
+	ws->strategy = wait_supported(strategy);
+	ws->step = 0;
+}
+
+/* Wait about `ticks' cycles. */
+void wait_for(struct wait_state *ws, uint64_t ticks)
+{
+	uint64_t now = rdtsc_bare();
+	uint64_t deadline = now + ticks;
+
+	switch (ws->strategy) {
+	case WAIT_SPIN:
+		wait_ticks(ticks);
+		break;
+	case WAIT_BACKOFF:
+		/* 64 << step cycles, capped by the penalty. */
+		if (ws->step < 16 && (64UL << ws->step) < ticks)
+			deadline = now + (64UL << ws->step);
+		ws->step ++;
+		/* fall through */
+	case WAIT_PAUSE:
+		while (rdtsc_bare() < deadline)
+			cpu_relax();
+		break;
+	case WAIT_YIELD:
+		do {
+			sched_yield();
+		} while (rdtsc_bare() < deadline);
+		break;
+	case WAIT_UMWAIT:
+		/* tpause may wake early (interrupt, OS time limit). */
+		while (rdtsc_bare() < deadline)
+			tpause(deadline);
+		break;
+	}
+}
+
+/* One idle step of a poll loop on *addr. */
+void wait_idle(struct wait_state *ws, const volatile void *addr)
+{
+	uint32_t n;
+
+	switch (ws->strategy) {
+	case WAIT_SPIN:
+		break;
+	case WAIT_PAUSE:
+		cpu_relax();
+		break;
+	case WAIT_BACKOFF:
+		n = ws->step < 10 ? 1U << ws->step : WAIT_BACKOFF_MAX;
+		ws->step ++;
+		while (n--)
+			cpu_relax();
+		break;
+	case WAIT_YIELD:
+		sched_yield();
+		break;
+	case WAIT_UMWAIT:
+		if (addr == NULL) {
+			/* Several queues polled: just a short nap. */
+			tpause(rdtsc_bare() + WAIT_UMWAIT_TICKS / 100);
+			break;
+		}
+		/* The store that fills the slot ends the wait.  Check the
+		 * slot again after arming the monitor, or a store landing
+		 * in between would be missed until the timeout. */
+		umonitor(addr);
+		if (*(const volatile ELEMENT_TYPE *)addr == 0)
+			umwait(rdtsc_bare() + WAIT_UMWAIT_TICKS);
+		break;
+	}
+}
@@ -0,0 +1,86 @@
+/*
+ *  wait.h: Wait strategies for the full and empty paths of EQueue.
+ *
+ *  A producer that finds the queue full waits for a penalty of a given
+ *  number of cycles (wait_for()); a consumer that finds it empty polls
+ *  again after one idle step (wait_idle()).  How both wait is chosen per
+ *  queue (q->wait, set from wait_default by queue_init()):
+ *
+ *    spin     rdtsc busy loop, idle steps return at once (the former
+ *             behavior of wait_ticks() and of the consumer loops)
+ *    pause    busy loop with the pause instruction
+ *    backoff  pause loop whose length doubles with every consecutive
+ *             wait, up to the penalty (or WAIT_BACKOFF_MAX pauses)
+ *    yield    sched_yield()
+ *    umwait   tpause until the deadline; idle steps umonitor the slot
+ *             being polled (or naps briefly when addr is NULL) and
+ *             umwait until it is written.  Needs
+ *             WAITPKG (CPUID.7.0:ECX[5]); falls back to pause otherwise.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _FIFO_WAIT_H_
+#define _FIFO_WAIT_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define WAIT_SPIN 0
+#define WAIT_PAUSE 1
+#define WAIT_BACKOFF 2
+#define WAIT_YIELD 3
+#define WAIT_UMWAIT 4
+#define NR_WAIT 5
+
+/* Longest idle backoff step, in pause instructions. */
+#define WAIT_BACKOFF_MAX (1024)
+/* Longest umwait of an idle step, in cycles. */
+#define WAIT_UMWAIT_TICKS (100000UL)
+
+/* Per waiter.  step counts consecutive waits for the backoff. */
+struct wait_state {
+	uint32_t strategy;
+	uint32_t step;
+};
+
+extern uint32_t wait_default;
+
+/* Returns the strategy actually used for `strategy' on this CPU. */
+uint32_t wait_supported(uint32_t strategy);
+/* Strategy of the given name, or -1. */
+int wait_parse(const char *name);
+const char *wait_name(uint32_t strategy);
+
+void wait_init(struct wait_state *, uint32_t strategy);
+void wait_for(struct wait_state *, uint64_t ticks);
+void wait_idle(struct wait_state *, const volatile void *addr);
+
+/* Called once the waiter made progress. */
+static inline void wait_reset(struct wait_state *ws)
+{
+	ws->step = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
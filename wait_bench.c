@@ -0,0 +1,297 @@
+/*
+ *  wait_bench.c: Throughput, wake-up latency and sibling slowdown of the
+ *  wait strategies in wait.h.
+ *
+ *  For every strategy two runs are made:
+ *    stream:  the producer runs flat out against a consumer spending
+ *             `workload' cycles per item; both ends hit the full and
+ *             empty paths.  Reports items per second.
+ *    idle:    the producer sends one item, stamped with the TSC, every
+ *             `gap' cycles, so the consumer spends its time on the empty
+ *             path.  A third thread on the sibling core (-s, e.g. the
+ *             SMT sibling of the consumer) runs an ALU loop meanwhile.
+ *             Reports the wake-up latency of the consumer and how much
+ *             slower the sibling ran than when alone.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include "fifo.h"
+#include "latency.h"
+#include "tsc.h"
+#include "wait.h"
+
+#define DEFAULT_TEST_SIZE 2000000
+#define DEFAULT_IDLE_ITEMS 20000
+
+static uint64_t test_size = DEFAULT_TEST_SIZE;
+static uint64_t idle_items = DEFAULT_IDLE_ITEMS;
+static uint64_t workload = 100;
+static uint64_t gap = 20000;
+static int producer_core = 0;
+static int consumer_core = 1;
+static int sibling_core = -1;
+
+static struct queue_t q __attribute__ ((aligned(128)));
+static struct latency_hist lat;
+static int stamped;
+static volatile int sibling_stop;
+static uint64_t sibling_iters;
+
+static void pin(int cpu)
+{
+	cpu_set_t mask;
+
+	CPU_ZERO(&mask);
+	CPU_SET(cpu, &mask);
+	if (sched_setaffinity(0, sizeof(mask), &mask) < 0)
+		printf("Error: sched_setaffinity to core %d\n", cpu);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Integer work that competes with the waiter for the core's ALUs. */
+static void *sibling(void *arg)
+{
+	uint64_t x = 88172645463325252UL, n = 0;
+
+	pin(sibling_core);
+	while (!sibling_stop) {
+		int k;
+		for (k = 0; k < 1024; k++) {
+			x ^= x << 13;
+			x ^= x >> 7;
+			x ^= x << 17;
+		}
+		n ++;
+	}
+	sibling_iters = n + (x == 0);
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	uint64_t items = *(uint64_t *)arg, i;
+	struct wait_state ws;
+	ELEMENT_TYPE value;
+	int flag;
+
+	pin(consumer_core);
+	wait_init(&ws, q.wait);
+	for (i = 1; i <= items; i++) {
+		flag = 0;
+		while (dequeue(&q, &value) != SUCCESS) {
+			if (flag == 0) {
+				q.empty_counter ++;
+				q.traffic_empty ++;
+				flag = 1;
+			}
+			wait_idle(&ws, &q.data[q.tail]);
+		}
+		if (flag)
+			wait_reset(&ws);
+		if (stamped)
+			latency_record(&lat, tsc_sub_overhead(rdtsc_bare() - value));
+		else if (workload)
+			wait_ticks(workload);
+	}
+	return NULL;
+}
+
+static void *producer(void *arg)
+{
+	uint64_t items = *(uint64_t *)arg, i;
+	struct wait_state ws;
+	int flag;
+
+	pin(producer_core);
+	wait_init(&ws, q.wait);
+	for (i = 1; i <= items; i++) {
+		flag = 0;
+		while (enqueue(&q, stamped ? rdtsc_bare() : (ELEMENT_TYPE)i) != SUCCESS) {
+			if (flag == 0) {
+				q.full_counter ++;
+				q.traffic_full ++;
+				flag = 1;
+			}
+			wait_for(&ws, q.penalty);
+		}
+		if (flag)
+			wait_reset(&ws);
+		if (stamped)
+			wait_ticks(gap);
+	}
+	return NULL;
+}
+
+/* Returns the wall-clock time of the run in ns. */
+static uint64_t run_pair(uint32_t strategy, uint64_t items, int idle_run)
+{
+	pthread_t prod, cons;
+	uint64_t start;
+
+	queue_init(&q, DEFAULT_QUEUE_SIZE, DEFAULT_PENALTY, OVERFLOW_BLOCK);
+	q.wait = strategy;
+	stamped = idle_run;
+	memset(&lat, 0, sizeof(lat));
+
+	start = now_ns();
+	pthread_create(&cons, NULL, consumer, &items);
+	pthread_create(&prod, NULL, producer, &items);
+	pthread_join(prod, NULL);
+	pthread_join(cons, NULL);
+	start = now_ns() - start;
+
+	queue_destroy(&q);
+	return start;
+}
+
+/* Sibling iterations per second while `items' > 0 items go through the
+ * idle run, or alone for `alone_ns' when items is 0. */
+static double run_sibling(uint32_t strategy, uint64_t items, uint64_t alone_ns,
+		uint64_t *run_ns)
+{
+	pthread_t sib;
+	uint64_t start, ns;
+
+	sibling_stop = 0;
+	pthread_create(&sib, NULL, sibling, NULL);
+	start = now_ns();
+	if (items)
+		run_pair(strategy, items, 1);
+	else
+		while (now_ns() - start < alone_ns)
+			;
+	sibling_stop = 1;
+	ns = now_ns() - start;
+	pthread_join(sib, NULL);
+	if (run_ns)
+		*run_ns = ns;
+	return sibling_iters * 1e9 / ns;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t list[NR_WAIT], nr = 0, k, used;
+	double alone = 0, with = 0;
+	uint64_t ns;
+	char *s, *save;
+	int opt;
+
+	char * usage =
+		"Usage: wait_bench [-t stream items (default: 2,000,000)]\n\
+		[-i idle items (default: 20,000)]\n\
+		[-w consumer workload in the stream run (default: 100 cycles)]\n\
+		[-g producer gap in the idle run (default: 20000 cycles)]\n\
+		[-W strategies, e.g. spin,pause (default: spin,pause,backoff,yield,umwait)]\n\
+		[-a producer core (default: 0)]\n\
+		[-b consumer core (default: 1)]\n\
+		[-s sibling core, e.g. the SMT sibling of -b (default: none)]\n\
+		[-N report times in nanoseconds instead of cycles]\n\
+		[-h help ]";
+
+	while ((opt = getopt(argc, argv, "hNt:i:w:g:W:a:b:s:")) != -1) {
+		switch (opt) {
+			case 't':
+				test_size = atoll(optarg);
+				break;
+			case 'i':
+				idle_items = atoll(optarg);
+				break;
+			case 'w':
+				workload = atoll(optarg);
+				break;
+			case 'g':
+				gap = atoll(optarg);
+				break;
+			case 'W':
+				for (s = strtok_r(optarg, ",", &save); s && nr < NR_WAIT;
+						s = strtok_r(NULL, ",", &save)) {
+					if (wait_parse(s) < 0) {
+						printf("Error: unknown wait strategy \"%s\".\n", s);
+						exit(-1);
+					}
+					list[nr++] = wait_parse(s);
+				}
+				break;
+			case 'a':
+				producer_core = atoi(optarg);
+				break;
+			case 'b':
+				consumer_core = atoi(optarg);
+				break;
+			case 's':
+				sibling_core = atoi(optarg);
+				break;
+			case 'N':
+				tsc_ns_output = 1;
+				break;
+			case 'h':
+				printf("%s\n", usage);
+				exit(0);
+			default:
+				printf("%s\n", usage);
+				exit(-1);
+		}
+	}
+	if (nr == 0)
+		for (nr = 0; nr < NR_WAIT; nr++)
+			list[nr] = nr;
+
+	tsc_init();
+	if (sibling_core >= 0) {
+		alone = run_sibling(0, 0, 500 * 1000 * 1000UL, NULL);
+		printf("Sibling alone on core %d: %.0f iterations/s\n",
+				sibling_core, alone);
+	}
+
+	printf("%-8s %-8s %12s %12s %12s %12s %10s\n", "wait", "used",
+			"Mitems/s", "wake avg", "wake p99", "sibling/s", "slowdown");
+	for (k = 0; k < nr; k++) {
+		used = wait_supported(list[k]);
+		ns = run_pair(list[k], test_size, 0);
+		if (sibling_core >= 0)
+			with = run_sibling(list[k], idle_items, 0, NULL);
+		else
+			run_pair(list[k], idle_items, 1);
+
+		printf("%-8s %-8s %12.3f %12.0f %12.0f ", wait_name(list[k]),
+				wait_name(used), test_size * 1e3 / ns,
+				tsc_out(latency_avg(&lat)),
+				tsc_out(latency_percentile(&lat, 99)));
+		if (sibling_core >= 0)
+			printf("%12.0f %9.1f%%\n", with,
+					alone > 0 ? 100.0 * (1 - with / alone) : 0.0);
+		else
+			printf("%12s %10s\n", "-", "-");
+	}
+	printf("Wake-up latency in %s.\n", tsc_unit());
+
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ *  work.c: Per-item work kernels, see work.h.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "work.h"
+
+#define LINE 64
+#define MIN_WORK_SIZE (4 * LINE)
+#define CALIBRATE_UNITS 100000
+
+extern uint64_t rdtsc_bare(void);
+
+static const char *work_names[NR_WORK_KINDS] = { "spin", "hash", "memcpy",
+	"chase", "checksum" };
+
+const char *work_name(uint32_t kind)
+{
+	return kind < NR_WORK_KINDS ? work_names[kind] : "?";
+}
+
+int work_parse(const char *arg, uint32_t *kind, uint64_t *size)
+{
+	const char *colon = strchr(arg, ':');
+	size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+	char *end;
+	uint32_t k;
+
+	for (k = 0; k < NR_WORK_KINDS; k++)
+		if (strlen(work_names[k]) == len && strncmp(arg, work_names[k], len) == 0)
+			break;
+	if (k == NR_WORK_KINDS) {
+		printf("Error: unknown work kernel \"%s\".\n", arg);
+		return -1;
+	}
+	*kind = k;
+	*size = DEFAULT_WORK_SIZE;
+	if (colon) {
+		*size = strtoull(colon + 1, &end, 0);
+		switch (*end) {
+			case 'g': case 'G': *size <<= 10;	/* fall through */
+			case 'm': case 'M': *size <<= 10;	/* fall through */
+			case 'k': case 'K': *size <<= 10;
+		}
+	}
+	return 0;
+}
+
+int work_init(struct work_state *w, uint32_t kind, uint64_t size)
+{
+	uint64_t lines, i, j, t, x = 1;
+	uint64_t *next;
+
+	memset(w, 0, sizeof(struct work_state));
+	w->kind = kind;
+	if (kind == WORK_SPIN)
+		return 0;
+	if (size < MIN_WORK_SIZE)
+		size = MIN_WORK_SIZE;
+	w->size = size & ~(2UL * LINE - 1);
+	w->buf = aligned_alloc(LINE, w->size);
+	if (w->buf == NULL) {
+		printf("Error: cannot allocate %lu bytes of working set.\n", w->size);
+		return -1;
+	}
+	for (i = 0; i < w->size; i++)
+		w->buf[i] = (uint8_t)(i * 131);
+	if (kind != WORK_CHASE)
+		return 0;
+
+	/* Sattolo's shuffle: a single cycle through all the lines, the
+	 * next index in the first word of each line. */
+	lines = w->size / LINE;
+	next = malloc(lines * sizeof(uint64_t));
+	if (next == NULL) {
+		printf("Error: cannot allocate the chase permutation.\n");
+		return -1;
+	}
+	for (i = 0; i < lines; i++)
+		next[i] = i;
+	for (i = lines - 1; i > 0; i--) {
+		x = x * 6364136223846793005UL + 1442695040888963407UL;
+		j = (x >> 33) % i;
+		t = next[i];
+		next[i] = next[j];
+		next[j] = t;
+	}
+	for (i = 0; i < lines; i++)
+		*(uint64_t *)(w->buf + i * LINE) = next[i];
+	free(next);
+	return 0;
+}
+
+void work_destroy(struct work_state *w)
+{
+	free(w->buf);
+	w->buf = NULL;
+}
+
+static inline __attribute__((always_inline))
+uint64_t work_hash(struct work_state *w, uint64_t h)
+{
+	const uint64_t *p = (const uint64_t *)(w->buf + w->cursor);
+	int k;
+
+	for (k = 0; k < LINE / 8; k++)
+		h = (h ^ p[k]) * 0x100000001B3UL;
+	w->cursor = (w->cursor + LINE) % w->size;
+	return h;
+}
+
+static inline __attribute__((always_inline))
+uint64_t work_memcpy(struct work_state *w, uint64_t value)
+{
+	uint64_t half = w->size / 2;
+	uint8_t *dst = w->buf + half + w->cursor;
+
+	memcpy(dst, w->buf + w->cursor, LINE);
+	*(uint64_t *)dst ^= value;
+	w->cursor = (w->cursor + LINE) % half;
+	return dst[LINE - 1];
+}
+
+static inline __attribute__((always_inline))
+uint64_t work_chase(struct work_state *w)
+{
+	w->cursor = *(volatile uint64_t *)(w->buf + w->cursor * LINE);
+	return w->cursor;
+}
+
+static inline __attribute__((always_inline))
+uint64_t work_checksum(struct work_state *w, uint64_t sum)
+{
+	const uint16_t *p = (const uint16_t *)(w->buf + w->cursor);
+	int k;
+
+	for (k = 0; k < LINE / 2; k++)
+		sum += p[k];
+	w->cursor = (w->cursor + LINE) % w->size;
+	return sum;
+}
+
+void work_run(struct work_state *w, uint64_t value)
+{
+	uint64_t i, r = value;
+
+	switch (w->kind) {
+		case WORK_HASH:
+			for (i = 0; i < w->reps; i++)
+				r = work_hash(w, r);
+			break;
+		case WORK_MEMCPY:
+			for (i = 0; i < w->reps; i++)
+				r += work_memcpy(w, value);
+			break;
+		case WORK_CHASE:
+			for (i = 0; i < w->reps; i++)
+				r += work_chase(w);
+			break;
+		case WORK_CHECKSUM:
+			for (i = 0; i < w->reps; i++)
+				r = work_checksum(w, r);
+			while (r >> 16)
+				r = (r & 0xffff) + (r >> 16);
+			break;
+	}
+	w->sink += r;
+}
+
+/* Units are timed over at least one pass through the working set, so
+ * the cost includes its cache misses (but not those the queue adds). */
+void work_calibrate(struct work_state *w, uint64_t cycles)
+{
+	uint64_t units = w->size / LINE, start;
+
+	if (w->kind == WORK_SPIN)
+		return;
+	if (units < CALIBRATE_UNITS)
+		units = CALIBRATE_UNITS;
+	w->reps = units;
+	work_run(w, 1);			/* warm up */
+	start = rdtsc_bare();
+	work_run(w, 2);
+	w->unit_cycles = (double)(rdtsc_bare() - start) / units;
+	w->reps = (uint64_t)(cycles / w->unit_cycles + 0.5);
+	if (w->reps == 0 && cycles)
+		w->reps = 1;
+	w->cursor = 0;
+}
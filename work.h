@@ -0,0 +1,62 @@
+/*
+ *  work.h: Per-item work kernels for the consumer of main.c.
+ *
+ *  wait_ticks() burns the workload without touching memory, so the ring
+ *  stays in the consumer's L1 whatever the workload.  A kernel does real
+ *  work over its own working set instead, and evicts the ring the way a
+ *  service does.  It is calibrated to take about the -w budget per item
+ *  on its own, so results stay comparable to the wait_ticks() runs.
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ *  Copyright (c) 2019 Junchang Wang, NUPT.
+ *
+*/
+
+#ifndef _EQUEUE_WORK_H_
+#define _EQUEUE_WORK_H_
+
+#include <stdint.h>
+
+/* Kernels.  Every unit of work covers one cache line of the working
+ * set; the buffer is walked in order except by chase. */
+#define WORK_SPIN 0		/* wait_ticks(), no memory traffic */
+#define WORK_HASH 1		/* multiplicative hash of a line, seeded by the item */
+#define WORK_MEMCPY 2		/* copy a line from one half of the set to the other */
+#define WORK_CHASE 3		/* one dependent load through a random cycle of lines */
+#define WORK_CHECKSUM 4		/* ones' complement (Internet) checksum of a line */
+#define NR_WORK_KINDS 5
+
+#define DEFAULT_WORK_SIZE (1UL << 20)
+
+struct work_state {
+	uint32_t kind;
+	uint64_t size;			/* working set, bytes */
+	uint64_t reps;			/* units per item */
+	uint64_t cursor;		/* byte offset; line index for chase */
+	uint8_t *buf;
+	double unit_cycles;		/* calibrated cost of one unit */
+	uint64_t sink;			/* keeps the results alive */
+};
+
+/* "chase:8M" or "hash"; returns 0, or -1 on an unknown kernel. */
+int work_parse(const char *, uint32_t *, uint64_t *);
+const char *work_name(uint32_t);
+int work_init(struct work_state *, uint32_t, uint64_t);
+/* Units per item so that an item takes about the given cycles. */
+void work_calibrate(struct work_state *, uint64_t);
+void work_run(struct work_state *, uint64_t);
+void work_destroy(struct work_state *);
+
+#endif